@@ -0,0 +1,394 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "maze.h"
+#include "solve.h"
+
+// file buffers per worker, bounding how far the prefetch threads run ahead
+#define BUFFERS_PER_WORKER 2
+#define DEFAULT_PREFETCH 2
+
+/**
+ * one line of the manifest:
+ *   <input> <output> <start_x> <start_y> <end_x> <end_y> [pruned|full|weighted]
+ * the output file gets exactly what solver, solver_full or solver_weighted
+ * would write for the same arguments
+ */
+typedef struct {
+  int line;
+  char *input;
+  char *output;
+  char *coords[4];
+  enum Mode mode;
+  int missing;       // input file could not be opened
+  int buffer;        // index of the file buffer holding the input, or -1
+} job_t;
+
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+  int error;
+} buffer_t;
+
+/**
+ * double-ended queue of job indices. the owning worker pushes and pops at the
+ * bottom, other workers steal from the top
+ */
+typedef struct {
+  int *jobs;
+  int top;
+  int bottom;
+  pthread_mutex_t lock;
+} deque_t;
+
+/**
+ * state shared by the prefetch threads and workers
+ * lock protects everything but the deques, which have their own locks
+ */
+typedef struct {
+  job_t *jobs;
+  int num_jobs;
+  deque_t *deques;
+  int num_workers;
+  buffer_t *buffers;
+  int *free_buffers;
+  int num_free;
+  int next_load;      // next job for a prefetch thread to load
+  int next_deque;     // deque the next loaded job goes to
+  int queued;         // jobs waiting in the deques
+  int loaders;        // prefetch threads still running
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t buffer_freed;
+  pthread_mutex_t print_lock;
+} pool_t;
+
+typedef struct {
+  pool_t *pool;
+  int id;
+} worker_arg_t;
+
+/**
+ * prints a message about a job, prefixed with its manifest line
+ */
+void report(pool_t *pool, job_t *job, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  pthread_mutex_lock(&pool->print_lock);
+  printf("%d: ", job->line);
+  vprintf(format, args);
+  pthread_mutex_unlock(&pool->print_lock);
+  va_end(args);
+}
+
+void push_bottom(deque_t *d, int job) {
+  pthread_mutex_lock(&d->lock);
+  d->jobs[d->bottom++] = job;
+  pthread_mutex_unlock(&d->lock);
+}
+
+int pop_bottom(deque_t *d) {
+  int job = -1;
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom > d->top)
+    job = d->jobs[--d->bottom];
+  pthread_mutex_unlock(&d->lock);
+  return job;
+}
+
+int steal_top(deque_t *d) {
+  int job = -1;
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom > d->top)
+    job = d->jobs[d->top++];
+  pthread_mutex_unlock(&d->lock);
+  return job;
+}
+
+/**
+ * prefetch thread: loads the input files of the jobs in manifest order into
+ * free buffers and hands each loaded job to the deque of the next worker.
+ * since only loaded jobs are ever queued, a worker never waits on a file read
+ */
+void *prefetch(void *ptr) {
+  pool_t *pool = (pool_t *) ptr;
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    int n = pool->next_load++;
+    if (n >= pool->num_jobs) {
+      if (--pool->loaders == 0)
+	pthread_cond_broadcast(&pool->work);
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    while (pool->num_free == 0)
+      pthread_cond_wait(&pool->buffer_freed, &pool->lock);
+    int b = pool->free_buffers[--pool->num_free];
+    pthread_mutex_unlock(&pool->lock);
+
+    job_t *job = &pool->jobs[n];
+    buffer_t *buf = &pool->buffers[b];
+    FILE *in = fopen(job->input, "r");
+    job->buffer = b;
+    if (in == NULL) {
+      job->missing = 1;
+    } else {
+      buf->error = read_file(in, &buf->data, &buf->len, &buf->cap);
+      fclose(in);
+    }
+
+    // counted in the same section as the push, so a worker can never take the job before it is
+    // counted and drive queued below zero
+    pthread_mutex_lock(&pool->lock);
+    int w = pool->next_deque;
+    pool->next_deque = (w + 1) % pool->num_workers;
+    push_bottom(&pool->deques[w], n);
+    pool->queued++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+void release_buffer(pool_t *pool, job_t *job) {
+  if (job->buffer < 0)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->free_buffers[pool->num_free++] = job->buffer;
+  pthread_cond_signal(&pool->buffer_freed);
+  pthread_mutex_unlock(&pool->lock);
+  job->buffer = -1;
+}
+
+/**
+ * runs one job with the same checks, in the same order, as solver
+ */
+void run_job(pool_t *pool, job_t *job, grid_t *grid) {
+  buffer_t *buf = &pool->buffers[job->buffer];
+  FILE *out = fopen(job->output, "w"); // solver opens both files up front
+  int start_x = atoi(job->coords[0]);
+  int start_y = atoi(job->coords[1]);
+  int end_x = atoi(job->coords[2]);
+  int end_y = atoi(job->coords[3]);
+
+  if (job->missing) {
+    report(pool, job, "Could not open input file: No such file or directory\n");
+  } else if (out == NULL) {
+    report(pool, job, "Could not open output file\n");
+  } else if (!parseable(job->coords, 4)) {
+    report(pool, job, "Could not parse coordinates\n");
+  } else if (buf->error || load_grid(grid, buf->data, buf->len, job->mode == MODE_WEIGHTED)) {
+    report(pool, job, "Could not read maze from input file\n");
+  } else {
+    release_buffer(pool, job); // the maze is in the grid now
+    if (out_of_bounds(start_x, start_y, grid->rows, grid->cols)) {
+      report(pool, job, "Start location out of bounds: (%d, %d)\n", start_x, start_y);
+    } else if (out_of_bounds(end_x, end_y, grid->rows, grid->cols)) {
+      report(pool, job, "End location out of bounds: (%d, %d)\n", end_x, end_y);
+    } else if (solve(grid, job->mode, start_x, start_y, end_x, end_y, out)) {
+      report(pool, job, "Could not solve maze\n");
+    }
+  }
+  release_buffer(pool, job);
+  if (out != NULL)
+    fclose(out);
+}
+
+/**
+ * worker: runs jobs from its own deque, steals from the others when it runs
+ * dry, and sleeps when every deque is empty until more jobs are loaded
+ */
+void *worker(void *ptr) {
+  worker_arg_t *arg = (worker_arg_t *) ptr;
+  pool_t *pool = arg->pool;
+  grid_t grid;
+  init_grid(&grid);
+
+  for (;;) {
+    int i, job = pop_bottom(&pool->deques[arg->id]);
+    for (i = 1; job < 0 && i < pool->num_workers; ++i)
+      job = steal_top(&pool->deques[(arg->id + i) % pool->num_workers]);
+
+    pthread_mutex_lock(&pool->lock);
+    if (job >= 0) {
+      pool->queued--;
+      pthread_mutex_unlock(&pool->lock);
+      run_job(pool, &pool->jobs[job], &grid);
+      continue;
+    }
+    while (pool->queued == 0 && pool->loaders > 0)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    int finished = pool->queued == 0 && pool->loaders == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (finished)
+      break;
+  }
+  cleanup_grid(&grid);
+  return NULL;
+}
+
+/**
+ * splits the manifest into jobs; the strings point into text
+ * returns the number of jobs, or -1 on a malformed line
+ */
+int parse_manifest(char *text, job_t **jobs) {
+  int count = 0, cap = 0, line = 0;
+  char *save, *row = text;
+  *jobs = NULL;
+  while (row != NULL && *row != '\0') {
+    char *next = strchr(row, '\n');
+    if (next != NULL)
+      *next++ = '\0';
+    line++;
+
+    char *fields[8];
+    int n = 0;
+    char *field = strtok_r(row, " \t\r", &save);
+    while (field != NULL && n < 8) {
+      fields[n++] = field;
+      field = strtok_r(NULL, " \t\r", &save);
+    }
+    row = next;
+    if (n == 0 || fields[0][0] == '#')
+      continue;
+
+    enum Mode mode = MODE_PRUNED;
+    if (n == 7 && strcmp(fields[6], "full") == 0)
+      mode = MODE_FULL;
+    else if (n == 7 && strcmp(fields[6], "weighted") == 0)
+      mode = MODE_WEIGHTED;
+    else if (n != 6 && !(n == 7 && strcmp(fields[6], "pruned") == 0)) {
+      printf("%d: Could not parse manifest line\n", line);
+      return -1;
+    }
+
+    if (count == cap) {
+      cap = cap ? 2 * cap : 64;
+      job_t *grown = (job_t *) realloc(*jobs, (size_t) cap * sizeof(job_t));
+      if (grown == NULL)
+	return -1;
+      *jobs = grown;
+    }
+    job_t *job = &(*jobs)[count++];
+    job->line = line;
+    job->input = fields[0];
+    job->output = fields[1];
+    memcpy(job->coords, fields + 2, sizeof(job->coords));
+    job->mode = mode;
+    job->missing = 0;
+    job->buffer = -1;
+  }
+  return count;
+}
+
+int main(int argc, char **argv) {
+  pool_t pool;
+  int opt, i, num_prefetch = DEFAULT_PREFETCH, num_workers = 0;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((opt = getopt(argc, argv, "j:p:")) != -1) {
+    switch (opt) {
+    case 'j':
+      num_workers = atoi(optarg);
+      break;
+    case 'p':
+      num_prefetch = atoi(optarg);
+      break;
+    default:
+      optind = argc + 1;
+    }
+  }
+  if (optind != argc - 1 || num_workers < 0 || num_prefetch <= 0) {
+    printf("Usage: %s [-j <workers>] [-p <prefetch threads>] <manifest>\n", argv[0]);
+    return 0;
+  }
+  if (num_workers == 0)
+    num_workers = ncpu > 1 ? (int) ncpu : 1;
+
+  FILE *manifest = fopen(argv[optind], "r");
+  if (manifest == NULL) {
+    printf("Could not open manifest: No such file or directory\n");
+    return 0;
+  }
+  unsigned char *text = NULL;
+  size_t len = 0, cap = 0;
+  int error = read_file(manifest, &text, &len, &cap); // always leaves room for a '\0'
+  fclose(manifest);
+  if (error) {
+    printf("Could not read manifest\n");
+    free(text);
+    return 0;
+  }
+  text[len] = '\0';
+
+  memset(&pool, 0, sizeof(pool));
+  pool.num_jobs = parse_manifest((char *) text, &pool.jobs);
+  if (pool.num_jobs <= 0) {
+    free(pool.jobs);
+    free(text);
+    return 0;
+  }
+
+  int num_buffers = BUFFERS_PER_WORKER * num_workers;
+  pool.num_workers = num_workers;
+  pool.deques = (deque_t *) calloc((size_t) num_workers, sizeof(deque_t));
+  pool.buffers = (buffer_t *) calloc((size_t) num_buffers, sizeof(buffer_t));
+  pool.free_buffers = (int *) malloc((size_t) num_buffers * sizeof(int));
+  for (i = 0; pool.deques != NULL && i < num_workers; ++i) {
+    pool.deques[i].jobs = (int *) malloc((size_t) pool.num_jobs * sizeof(int));
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    if (pool.deques[i].jobs == NULL)
+      error = 1;
+  }
+  if (error || pool.deques == NULL || pool.buffers == NULL || pool.free_buffers == NULL) {
+    printf("Could not allocate worker pool\n");
+    return 0;
+  }
+  for (i = 0; i < num_buffers; ++i)
+    pool.free_buffers[i] = i;
+  pool.num_free = num_buffers;
+  pool.loaders = num_prefetch;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_mutex_init(&pool.print_lock, NULL);
+  pthread_cond_init(&pool.work, NULL);
+  pthread_cond_init(&pool.buffer_freed, NULL);
+
+  pthread_t loaders[num_prefetch], workers[num_workers];
+  worker_arg_t args[num_workers];
+  for (i = 0; i < num_prefetch; ++i) {
+    if (pthread_create(&loaders[i], NULL, prefetch, &pool)) {
+      printf("Could not start prefetch thread\n");
+      return 0;
+    }
+  }
+  for (i = 0; i < num_workers; ++i) {
+    args[i].pool = &pool;
+    args[i].id = i;
+    if (pthread_create(&workers[i], NULL, worker, &args[i])) {
+      printf("Could not start worker thread\n");
+      return 0;
+    }
+  }
+  for (i = 0; i < num_prefetch; ++i)
+    pthread_join(loaders[i], NULL);
+  for (i = 0; i < num_workers; ++i)
+    pthread_join(workers[i], NULL);
+
+  for (i = 0; i < num_workers; ++i) {
+    free(pool.deques[i].jobs);
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  }
+  for (i = 0; i < num_buffers; ++i)
+    free(pool.buffers[i].data);
+  free(pool.deques);
+  free(pool.buffers);
+  free(pool.free_buffers);
+  free(pool.jobs);
+  free(text);
+  return 0;
+}
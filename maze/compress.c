@@ -0,0 +1,644 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "compress.h"
+
+#define PROB_BITS 11
+#define PROB_INIT (1 << (PROB_BITS - 1))
+#define MOVE_BITS 5
+#define TOP (1u << 24)
+
+// cell symbols are coded with frequencies out of 1 << SYM_BITS, each symbol
+// keeping at least SYM_MIN of them so that one byte always renormalizes
+#define SYM_BITS 15
+#define SYM_MIN 128
+#define SYM_SPAN ((1u << SYM_BITS) - 4 * SYM_MIN)
+
+// mazes smaller than this are decoded on the calling thread
+#define PARALLEL_CELLS (1 << 18)
+
+/**
+ * adaptive models indexed by context, built from walls that both the encoder
+ * and the decoder already know when a wall is coded. the west and south walls
+ * are single bits; the north and east walls of a cell are coded together as
+ * the symbol n | e << 1, whose distribution holds the cumulative frequencies
+ * of symbols 1 to 3 over SYM_SPAN, not counting the SYM_MIN each one is given
+ */
+typedef struct {
+  uint16_t west[1];
+  uint16_t south[16];
+  uint16_t cell[128][3];
+} model_t;
+
+typedef struct {
+  uint64_t low;
+  uint32_t range;
+  unsigned char cache;
+  uint64_t cache_size;
+  unsigned char *buf;
+  size_t len;
+  size_t cap;
+  int error;
+} encoder_t;
+
+typedef struct {
+  uint32_t range;
+  uint32_t code;
+  const unsigned char *buf;
+  size_t len;
+  size_t pos;
+  size_t over; // bytes asked for past the end of buf
+} decoder_t;
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table(void) {
+  uint32_t i, k;
+  for (i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (k = 0; k < 8; ++k)
+      c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    crc_table[0][i] = c;
+  }
+  for (i = 0; i < 256; ++i)
+    for (k = 1; k < 8; ++k)
+      crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+}
+
+/**
+ * returns the CRC-32 of the n bytes at p, eight bytes per step
+ * (slicing-by-8), so that checking a band costs little next to decoding it
+ */
+static uint32_t crc32(const unsigned char *p, size_t n) {
+  uint32_t c = 0xFFFFFFFFu;
+  pthread_once(&crc_once, init_crc_table);
+  for (; n >= 8; n -= 8, p += 8) {
+    uint32_t lo = c ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+    c = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF]
+      ^ crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24]
+      ^ crc_table[3][p[4]] ^ crc_table[2][p[5]] ^ crc_table[1][p[6]] ^ crc_table[0][p[7]];
+  }
+  while (n-- > 0)
+    c = crc_table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+  return c ^ 0xFFFFFFFFu;
+}
+
+static void init_model(model_t *m) {
+  int i, k;
+  m->west[0] = PROB_INIT;
+  for (i = 0; i < 16; ++i)
+    m->south[i] = PROB_INIT;
+  for (i = 0; i < 128; ++i)
+    for (k = 0; k < 3; ++k)
+      m->cell[i][k] = (uint16_t) (SYM_SPAN * (k + 1) / 4);
+}
+
+/**
+ * context helpers, shared by the encoder and decoder so that both sides
+ * always agree on the model used for a bit
+ *
+ * up is the row above within the same block, or NULL on the first row of a block
+ */
+static int cell_ctx(const unsigned char *cur, const unsigned char *up, int x, int w, int y, int cols) {
+  int nl = x > 0 ? (cur[x - 1] & CODE_NORTH) != 0 : 1;
+  int eu = up ? (up[x] & CODE_EAST) != 0 : 0;
+  int wu = up ? (up[x] & CODE_WEST) != 0 : 0;
+  return w | nl << 1 | eu << 2 | wu << 3 | (up == NULL) << 4 | (y == 0) << 5 | (x == cols - 1) << 6;
+}
+
+static int south_ctx(unsigned char code, int y, int rows) {
+  return ((code & CODE_EAST) != 0) | ((code & CODE_WEST) != 0) << 1
+    | ((code & CODE_NORTH) != 0) << 2 | (y == rows - 1) << 3;
+}
+
+static void put_byte(encoder_t *e, unsigned char b) {
+  if (e->len == e->cap) {
+    size_t cap = e->cap ? e->cap * 2 : 4096;
+    unsigned char *buf = (unsigned char *) realloc(e->buf, cap);
+    if (buf == NULL) {
+      e->error = 1;
+      return;
+    }
+    e->buf = buf;
+    e->cap = cap;
+  }
+  e->buf[e->len++] = b;
+}
+
+static void shift_low(encoder_t *e) {
+  if ((uint32_t) e->low < 0xFF000000u || (e->low >> 32) != 0) {
+    unsigned char carry = (unsigned char) (e->low >> 32);
+    unsigned char temp = e->cache;
+    do {
+      put_byte(e, (unsigned char) (temp + carry));
+      temp = 0xFF;
+    } while (--e->cache_size != 0);
+    e->cache = (unsigned char) (e->low >> 24);
+  }
+  e->cache_size++;
+  e->low = (e->low & 0x00FFFFFFu) << 8;
+}
+
+static void encode_bit(encoder_t *e, uint16_t *p, int bit) {
+  uint32_t bound = (e->range >> PROB_BITS) * *p;
+  if (!bit) {
+    e->range = bound;
+    *p = (uint16_t) (*p + (((1 << PROB_BITS) - *p) >> MOVE_BITS));
+  } else {
+    e->low += bound;
+    e->range -= bound;
+    *p = (uint16_t) (*p - (*p >> MOVE_BITS));
+  }
+  while (e->range < TOP) {
+    e->range <<= 8;
+    shift_low(e);
+  }
+}
+
+/**
+ * moves the distribution f towards symbol s: each cumulative frequency goes
+ * the same fraction of the way to 0 or SYM_SPAN, so they stay in order. the
+ * difference is shifted as a signed number, which gcc shifts arithmetically
+ */
+static void update_sym(uint16_t *f, int s) {
+  int k;
+  for (k = 0; k < 3; ++k)
+    f[k] = (uint16_t) (f[k] + ((int32_t) ((s > k ? 0 : SYM_SPAN) - f[k]) >> MOVE_BITS));
+}
+
+/**
+ * returns where symbol s starts in the range split by r = range >> SYM_BITS;
+ * symbol 4 starts where the range ends
+ */
+static uint32_t sym_start(const uint16_t *f, int s, uint32_t r, uint32_t range) {
+  if (s == 0)
+    return 0;
+  return s < 4 ? r * (f[s - 1] + SYM_MIN * (uint32_t) s) : range;
+}
+
+static void encode_sym(encoder_t *e, uint16_t *f, int s) {
+  uint32_t r = e->range >> SYM_BITS;
+  uint32_t lo = sym_start(f, s, r, e->range);
+  e->low += lo;
+  e->range = sym_start(f, s + 1, r, e->range) - lo;
+  update_sym(f, s);
+  while (e->range < TOP) {
+    e->range <<= 8;
+    shift_low(e);
+  }
+}
+
+static unsigned char next_byte(decoder_t *d) {
+  if (d->pos < d->len)
+    return d->buf[d->pos++];
+  d->over++;
+  return 0;
+}
+
+static void init_decoder(decoder_t *d, const unsigned char *buf, size_t len) {
+  int i;
+  d->buf = buf;
+  d->len = len;
+  d->pos = 0;
+  d->over = 0;
+  d->range = 0xFFFFFFFFu;
+  d->code = 0;
+  for (i = 0; i < 5; ++i)
+    d->code = (d->code << 8) | next_byte(d);
+}
+
+static int decode_bit(decoder_t *d, uint16_t *p) {
+  int bit;
+  uint32_t bound = (d->range >> PROB_BITS) * *p;
+  if (d->code < bound) {
+    d->range = bound;
+    *p = (uint16_t) (*p + (((1 << PROB_BITS) - *p) >> MOVE_BITS));
+    bit = 0;
+  } else {
+    d->code -= bound;
+    d->range -= bound;
+    *p = (uint16_t) (*p - (*p >> MOVE_BITS));
+    bit = 1;
+  }
+  if (d->range < TOP) {
+    d->range <<= 8;
+    d->code = (d->code << 8) | next_byte(d);
+  }
+  return bit;
+}
+
+static int decode_sym(decoder_t *d, uint16_t *f) {
+  uint32_t r = d->range >> SYM_BITS;
+  int s = 0;
+  while (s < 3 && d->code >= sym_start(f, s + 1, r, d->range))
+    s++;
+  uint32_t lo = sym_start(f, s, r, d->range);
+  d->code -= lo;
+  d->range = sym_start(f, s + 1, r, d->range) - lo;
+  update_sym(f, s);
+  if (d->range < TOP) {
+    d->range <<= 8;
+    d->code = (d->code << 8) | next_byte(d);
+  }
+  return s;
+}
+
+// update_sym() for one cumulative frequency, moved towards 0 where mask is set
+#define FAST_MOVE(f, mask)						\
+  (uint16_t) ((f) + ((int32_t) ((SYM_SPAN & ~(mask)) - (f)) >> MOVE_BITS))
+
+/**
+ * decode_sym() for the fast path of decode_row(), on the range, code and input
+ * pointer held in its locals. the caller makes sure that src has a byte left.
+ * the symbol is worked out with masks rather than branches: walls are close to
+ * random, so a branch on them would be mispredicted much of the time
+ */
+#define FAST_SYM(f, s) do {						\
+    uint32_t r_ = range >> SYM_BITS;					\
+    uint32_t b1_ = r_ * ((f)[0] + SYM_MIN);				\
+    uint32_t b2_ = r_ * ((f)[1] + 2 * SYM_MIN);				\
+    uint32_t b3_ = r_ * ((f)[2] + 3 * SYM_MIN);				\
+    uint32_t m1_ = 0u - (uint32_t) (code >= b1_);			\
+    uint32_t m2_ = 0u - (uint32_t) (code >= b2_);			\
+    uint32_t m3_ = 0u - (uint32_t) (code >= b3_);			\
+    uint32_t lo_ = (b1_ & m1_) + ((b2_ - b1_) & m2_) + ((b3_ - b2_) & m3_); \
+    uint32_t hi_ = b1_ + ((b2_ - b1_) & m1_) + ((b3_ - b2_) & m2_) + ((range - b3_) & m3_); \
+    code -= lo_;							\
+    range = hi_ - lo_;							\
+    (s) = (int) ((m1_ & 1) + (m2_ & 1) + (m3_ & 1));			\
+    (f)[0] = FAST_MOVE((f)[0], m1_);					\
+    (f)[1] = FAST_MOVE((f)[1], m2_);					\
+    (f)[2] = FAST_MOVE((f)[2], m3_);					\
+    uint32_t norm_ = 0u - (uint32_t) (range < TOP);			\
+    code = (code << (norm_ & 8)) | (*src & norm_);			\
+    range <<= norm_ & 8;						\
+    src += norm_ & 1;							\
+  } while (0)
+
+/**
+ * decodes the cells of row y, the first of which has the west wall w0, for as
+ * long as the block has a byte left: the most a cell can use, since every
+ * symbol leaves a range of at least 2^16. this takes the bounds checks of
+ * next_byte() out of the inner loop; the rest of the row goes through
+ * decode_sym(). the context of each cell is that of cell_ctx(), built up
+ * along the row
+ * returns the first cell not decoded
+ */
+static int decode_row(decoder_t *d, model_t *m, unsigned char *cur, unsigned char *up,
+		      int w0, int y, int cols) {
+  uint32_t range = d->range, code = d->code;
+  const unsigned char *src = d->buf + d->pos;
+  const unsigned char *end = d->buf + d->len;
+  int base = (up == NULL) << 4 | (y == 0) << 5;
+  // the walls of the cell to the left are carried in locals rather than read
+  // back from cur, which would put a store and a load on the critical path
+  int x, w = w0, nl = 1;
+  for (x = 0; x < cols && src < end; ++x) {
+    int above = up ? up[x] : 0;
+    int s;
+    int ctx = w | nl << 1 | ((above & CODE_EAST) != 0) << 2 | ((above & CODE_WEST) != 0) << 3
+      | base | (x == cols - 1) << 6;
+    FAST_SYM(m->cell[ctx], s);
+    cur[x] = (unsigned char) ((s >> 1) * CODE_EAST + w * CODE_WEST + (s & 1) * CODE_NORTH);
+    if (up)
+      up[x] = (unsigned char) (above | (s & 1) * CODE_SOUTH); // north wall of this cell is the south wall above
+    w = s >> 1;
+    nl = s & 1;
+  }
+  d->range = range;
+  d->code = code;
+  d->pos = (size_t) (src - d->buf);
+  return x;
+}
+
+/**
+ * encodes one band of rows, appending it to the buffer of e
+ * each row stores the west wall of its first cell and the north and east walls
+ * of every cell, as one symbol per cell; the last row of the band also stores
+ * its south walls, so that no cell depends on a row outside the band
+ */
+static void encode_block(encoder_t *e, const unsigned char *codes, int first_row, int band, int rows, int cols) {
+  model_t m;
+  int r, x;
+  init_model(&m);
+  e->low = 0;
+  e->range = 0xFFFFFFFFu;
+  e->cache = 0;
+  e->cache_size = 1;
+
+  for (r = 0; r < band; ++r) {
+    const unsigned char *cur = codes + (size_t) r * cols;
+    const unsigned char *up = r > 0 ? cur - cols : NULL;
+    for (x = 0; x < cols; ++x) {
+      int w = (cur[x] & CODE_WEST) != 0;
+      int s = ((cur[x] & CODE_NORTH) != 0) | ((cur[x] & CODE_EAST) != 0) << 1;
+      if (x == 0)
+        encode_bit(e, &m.west[0], w);
+      encode_sym(e, m.cell[cell_ctx(cur, up, x, w, first_row + r, cols)], s);
+    }
+  }
+  const unsigned char *last = codes + (size_t) (band - 1) * cols;
+  for (x = 0; x < cols; ++x)
+    encode_bit(e, &m.south[south_ctx(last[x], first_row + band - 1, rows)], (last[x] & CODE_SOUTH) != 0);
+
+  for (x = 0; x < 5; ++x)
+    shift_low(e);
+}
+
+int mzc_decode_block(const unsigned char *data, size_t len, unsigned char *codes,
+                     int first_row, int band, int rows, int cols, uint32_t crc) {
+  model_t m;
+  decoder_t d;
+  int r, x;
+  init_model(&m);
+  init_decoder(&d, data, len);
+
+  for (r = 0; r < band; ++r) {
+    unsigned char *cur = codes + (size_t) r * cols;
+    unsigned char *up = r > 0 ? cur - cols : NULL;
+    int w0 = decode_bit(&d, &m.west[0]);
+    for (x = decode_row(&d, &m, cur, up, w0, first_row + r, cols); x < cols; ++x) {
+      int w = x == 0 ? w0 : (cur[x - 1] & CODE_EAST) != 0;
+      int s = decode_sym(&d, m.cell[cell_ctx(cur, up, x, w, first_row + r, cols)]);
+      cur[x] = (unsigned char) ((s >> 1) * CODE_EAST + w * CODE_WEST + (s & 1) * CODE_NORTH);
+      if (up && (s & 1))
+        up[x] |= CODE_SOUTH;
+    }
+  }
+  unsigned char *last = codes + (size_t) (band - 1) * cols;
+  for (x = 0; x < cols; ++x)
+    if (decode_bit(&d, &m.south[south_ctx(last[x], first_row + band - 1, rows)]))
+      last[x] |= CODE_SOUTH;
+
+  // a block never needs more bytes than the encoder wrote, flush included,
+  // and any other damage shows up in the checksum of the band
+  if (d.over > 5 || crc32(codes, (size_t) band * cols) != crc)
+    return -1;
+  return 0;
+}
+
+/**
+ * checks that every shared wall is recorded the same way from both sides,
+ * since the container only stores one side of each wall
+ */
+static int symmetric(const unsigned char *codes, int rows, int cols) {
+  int x, y;
+  for (y = 0; y < rows; ++y) {
+    for (x = 0; x < cols; ++x) {
+      unsigned char c = codes[(size_t) y * cols + x];
+      if (x > 0 && !(c & CODE_WEST) != !(codes[(size_t) y * cols + x - 1] & CODE_EAST))
+        return 0;
+      if (y > 0 && !(c & CODE_NORTH) != !(codes[(size_t) (y - 1) * cols + x] & CODE_SOUTH))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char) v;
+  p[1] = (unsigned char) (v >> 8);
+  p[2] = (unsigned char) (v >> 16);
+  p[3] = (unsigned char) (v >> 24);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+int mzc_encode(const unsigned char *codes, int rows, int cols,
+               unsigned char **buf, size_t *len, size_t *cap) {
+  if (rows <= 0 || cols <= 0 || !symmetric(codes, rows, cols))
+    return -1;
+
+  int num_blocks = (rows + MZC_BAND_ROWS - 1) / MZC_BAND_ROWS;
+  size_t header_len = 24 + 8 * (size_t) num_blocks;
+  encoder_t e;
+  int i;
+  e.buf = *buf;
+  e.len = 0;
+  e.cap = *cap;
+  e.error = 0;
+
+  // reserve the header, then fill it in once the block sizes are known
+  for (i = 0; i < (int) header_len; ++i)
+    put_byte(&e, 0);
+  for (i = 0; !e.error && i < num_blocks; ++i) {
+    int first_row = i * MZC_BAND_ROWS;
+    int band = rows - first_row < MZC_BAND_ROWS ? rows - first_row : MZC_BAND_ROWS;
+    size_t start = e.len;
+    const unsigned char *first = codes + (size_t) first_row * cols;
+    encode_block(&e, first, first_row, band, rows, cols);
+    if (!e.error) {
+      put_u32(e.buf + 24 + 8 * i, (uint32_t) (e.len - start));
+      put_u32(e.buf + 28 + 8 * i, crc32(first, (size_t) band * cols));
+    }
+  }
+
+  *buf = e.buf;
+  *cap = e.cap;
+  if (e.error)
+    return -1;
+  memcpy(e.buf, MZC_MAGIC, 4);
+  put_u32(e.buf + 4, (uint32_t) rows);
+  put_u32(e.buf + 8, (uint32_t) cols);
+  put_u32(e.buf + 12, MZC_BAND_ROWS);
+  put_u32(e.buf + 16, 0);
+  put_u32(e.buf + 20, (uint32_t) num_blocks);
+  *len = e.len;
+  return 0;
+}
+
+int mzc_write(FILE *file, const unsigned char *codes, int rows, int cols) {
+  unsigned char *buf = NULL;
+  size_t len = 0, cap = 0;
+  int error = mzc_encode(codes, rows, cols, &buf, &len, &cap)
+    || fwrite(buf, 1, len, file) != len;
+  free(buf);
+  return error ? -1 : 0;
+}
+
+int mzc_detect(FILE *file) {
+  char magic[4];
+  long pos = ftell(file);
+  size_t n = fread(magic, 1, 4, file);
+  fseek(file, pos, SEEK_SET);
+  return n == 4 && memcmp(magic, MZC_MAGIC, 4) == 0;
+}
+
+/**
+ * parses the fixed part of the header in the first 24 bytes of buf and
+ * allocates the block table of header; offsets are filled in by parse_table
+ * returns 0 on success, -1 on failure
+ */
+static int parse_header(const unsigned char *buf, mzc_header_t *header) {
+  header->sizes = NULL;
+  header->crcs = NULL;
+  header->offsets = NULL;
+  if (memcmp(buf, MZC_MAGIC, 4) != 0)
+    return -1;
+  uint32_t rows = get_u32(buf + 4);
+  uint32_t cols = get_u32(buf + 8);
+  uint32_t band_rows = get_u32(buf + 12);
+  uint32_t flags = get_u32(buf + 16);
+  uint32_t num_blocks = get_u32(buf + 20);
+  if (rows == 0 || cols == 0 || band_rows == 0 || rows > 0x7FFFFFFF || cols > 0x7FFFFFFF
+      || flags != 0 || num_blocks != rows / band_rows + (rows % band_rows != 0))
+    return -1;
+
+  header->rows = (int) rows;
+  header->cols = (int) cols;
+  header->band_rows = (int) band_rows;
+  header->flags = (int) flags;
+  header->num_blocks = (int) num_blocks;
+  header->sizes = (size_t *) malloc(num_blocks * sizeof(size_t));
+  header->crcs = (uint32_t *) malloc(num_blocks * sizeof(uint32_t));
+  header->offsets = (long *) malloc(num_blocks * sizeof(long));
+  if (header->sizes == NULL || header->crcs == NULL || header->offsets == NULL) {
+    mzc_free_header(header);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * fills in the block sizes and checksums from the block table and the block
+ * offsets, counting from offset for the first block
+ */
+static void parse_table(const unsigned char *table, mzc_header_t *header, long offset) {
+  int i;
+  for (i = 0; i < header->num_blocks; ++i) {
+    header->sizes[i] = get_u32(table + 8 * i);
+    header->crcs[i] = get_u32(table + 8 * i + 4);
+    header->offsets[i] = offset;
+    offset += (long) header->sizes[i];
+  }
+}
+
+int mzc_read_header(FILE *file, mzc_header_t *header) {
+  unsigned char buf[24];
+  header->sizes = NULL;
+  header->crcs = NULL;
+  header->offsets = NULL;
+  if (fread(buf, 1, 24, file) != 24 || parse_header(buf, header))
+    return -1;
+
+  size_t len = 8 * (size_t) header->num_blocks;
+  unsigned char *table = (unsigned char *) malloc(len);
+  if (table == NULL || fread(table, 1, len, file) != len) {
+    free(table);
+    mzc_free_header(header);
+    return -1;
+  }
+  parse_table(table, header, ftell(file));
+  free(table);
+  return 0;
+}
+
+void mzc_free_header(mzc_header_t *header) {
+  free(header->sizes);
+  free(header->crcs);
+  free(header->offsets);
+  header->sizes = NULL;
+  header->crcs = NULL;
+  header->offsets = NULL;
+}
+
+/**
+ * state shared by the decoding threads; thread t decodes blocks
+ * t, t + stride, t + 2 * stride, ...
+ */
+typedef struct {
+  const mzc_header_t *header;
+  const unsigned char *data;
+  unsigned char *codes;
+  int stride;
+} decode_job_t;
+
+/* each thread has its own error flag, read once it has been joined */
+typedef struct {
+  decode_job_t *job;
+  int first;
+  int error;
+} decode_arg_t;
+
+static void *decode_blocks(void *ptr) {
+  decode_arg_t *arg = (decode_arg_t *) ptr;
+  decode_job_t *job = arg->job;
+  const mzc_header_t *h = job->header;
+  int i;
+  for (i = arg->first; i < h->num_blocks; i += job->stride) {
+    int first_row = i * h->band_rows;
+    int band = h->rows - first_row < h->band_rows ? h->rows - first_row : h->band_rows;
+    const unsigned char *data = job->data + h->offsets[i];
+    if (mzc_decode_block(data, h->sizes[i], job->codes + (size_t) first_row * h->cols,
+                         first_row, band, h->rows, h->cols, h->crcs[i]))
+      arg->error = 1;
+  }
+  return NULL;
+}
+
+int mzc_decode(const unsigned char *buf, size_t len, unsigned char **codes, size_t *cap,
+               int *rows, int *cols) {
+  mzc_header_t h;
+  int i;
+  if (len < 24 || parse_header(buf, &h))
+    return -1;
+
+  size_t total = 24 + 8 * (size_t) h.num_blocks;
+  if (len >= total)
+    parse_table(buf + 24, &h, (long) total);
+  for (i = 0; len >= total && i < h.num_blocks; ++i)
+    total += h.sizes[i];
+  size_t cells = (size_t) h.rows * h.cols;
+  if (total > len) {
+    mzc_free_header(&h);
+    return -1;
+  }
+  if (*cap < cells) {
+    unsigned char *grown = (unsigned char *) realloc(*codes, cells);
+    if (grown == NULL) {
+      mzc_free_header(&h);
+      return -1;
+    }
+    *codes = grown;
+    *cap = cells;
+  }
+
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int nthreads = ncpu > 1 ? (int) ncpu : 1;
+  if (nthreads > h.num_blocks)
+    nthreads = h.num_blocks;
+  if (cells < PARALLEL_CELLS)
+    nthreads = 1;
+
+  decode_job_t job = {&h, buf, *codes, nthreads};
+  decode_arg_t args[nthreads];
+  pthread_t threads[nthreads];
+  int started[nthreads];
+  for (i = 0; i < nthreads; ++i) {
+    args[i].job = &job;
+    args[i].first = i;
+    args[i].error = 0;
+    // the first stripe always runs on this thread
+    started[i] = i > 0 && pthread_create(&threads[i], NULL, decode_blocks, &args[i]) == 0;
+  }
+  int error = 0;
+  for (i = 0; i < nthreads; ++i) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      decode_blocks(&args[i]);
+    error |= args[i].error;
+  }
+
+  *rows = h.rows;
+  *cols = h.cols;
+  mzc_free_header(&h);
+  return error ? -1 : 0;
+}
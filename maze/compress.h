@@ -0,0 +1,92 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "maze.h"
+
+/*
+ * compressed maze container (.mzc)
+ *
+ * all integers are 32-bit little-endian
+ *   magic       "MZC1"
+ *   rows, cols  maze dimensions
+ *   band_rows   number of maze rows stored in each block
+ *   flags       reserved, must be 0
+ *   num_blocks  ceil(rows / band_rows)
+ *   table       num_blocks entries of the compressed size of a block in bytes
+ *               and the CRC-32 of the cell codes of its band
+ *   data        the blocks, back to back
+ *
+ * each block is an independent adaptive range coder stream, so blocks
+ * can be decoded separately (and in parallel) into their band of rows. a
+ * block whose band does not match its CRC-32 once decoded is rejected.
+ */
+#define MZC_MAGIC "MZC1"
+#define MZC_BAND_ROWS 64
+
+/**
+ * header of a compressed maze, as read by mzc_read_header
+ * sizes, crcs and offsets are malloced and released with mzc_free_header
+ */
+typedef struct {
+  int rows;
+  int cols;
+  int band_rows;
+  int flags;
+  int num_blocks;
+  size_t *sizes;   // compressed size of each block
+  uint32_t *crcs;  // CRC-32 of the decoded band of each block
+  long *offsets;   // file offset of each block
+} mzc_header_t;
+
+/**
+ * compresses the rows x cols array of cell codes into file
+ * returns 0 on success, -1 if the walls are not symmetric or on a write error
+ */
+int mzc_write(FILE *file, const unsigned char *codes, int rows, int cols);
+
+/**
+ * compresses the rows x cols array of cell codes into memory
+ * *buf is a malloced buffer of capacity *cap (may be NULL and 0), grown as
+ * needed so that it can be reused from one maze to the next
+ * returns 0 and sets *len to the container size on success, -1 on failure
+ */
+int mzc_encode(const unsigned char *codes, int rows, int cols,
+               unsigned char **buf, size_t *len, size_t *cap);
+
+/**
+ * returns 1 if the file starts with the compressed container magic, 0 otherwise
+ * the file position is restored before returning
+ */
+int mzc_detect(FILE *file);
+
+/**
+ * reads the container header and block table from the current position of file
+ * returns 0 on success, -1 on failure
+ */
+int mzc_read_header(FILE *file, mzc_header_t *header);
+
+void mzc_free_header(mzc_header_t *header);
+
+/**
+ * decodes one block of len bytes into the codes of its band of rows
+ * first_row is the maze row the band starts at and band is the number of rows
+ * crc is the CRC-32 of the band from the block table
+ * returns 0 on success, -1 if the block is corrupt
+ */
+int mzc_decode_block(const unsigned char *data, size_t len, unsigned char *codes,
+                     int first_row, int band, int rows, int cols, uint32_t crc);
+
+/**
+ * decodes a whole compressed maze held in the len bytes at buf, decoding the
+ * blocks on several threads
+ * *codes is a malloced buffer of capacity *cap (may be NULL and 0), grown as
+ * needed so that it can be reused from one maze to the next
+ * returns 0 on success, -1 on failure
+ */
+int mzc_decode(const unsigned char *buf, size_t len, unsigned char **codes, size_t *cap,
+               int *rows, int *cols);
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include "maze.h"
+#include "dijkstra.h"
+
+/**
+ * monotone radix heap. every key in bucket i differs from last (the most
+ * recently extracted minimum) first in bit i - 1, and bucket 0 holds keys
+ * equal to last. since Dijkstra never inserts a key below last, an item only
+ * ever moves to lower buckets, so each item is moved at most 64 times no
+ * matter how many items the heap holds
+ */
+typedef struct {
+  buckets_t *b;
+  size_t len[NUM_BUCKETS];
+  uint64_t last;
+  size_t size;
+} radix_heap_t;
+
+void free_buckets(buckets_t *b) {
+  int i;
+  for (i = 0; i < NUM_BUCKETS; ++i)
+    free(b->items[i]);
+  memset(b, 0, sizeof(buckets_t));
+}
+
+static int bucket_of(uint64_t key, uint64_t last) {
+  uint64_t diff = key ^ last;
+  return diff ? 64 - __builtin_clzll(diff) : 0;
+}
+
+static int push_bucket(radix_heap_t *h, int b, uint64_t key, int room) {
+  buckets_t *bk = h->b;
+  if (h->len[b] == bk->cap[b]) {
+    size_t cap = bk->cap[b] ? 2 * bk->cap[b] : 64;
+    item_t *items = (item_t *) realloc(bk->items[b], cap * sizeof(item_t));
+    if (items == NULL)
+      return -1;
+    bk->items[b] = items;
+    bk->cap[b] = cap;
+  }
+  bk->items[b][h->len[b]].key = key;
+  bk->items[b][h->len[b]].room = room;
+  h->len[b]++;
+  return 0;
+}
+
+static int heap_push(radix_heap_t *h, uint64_t key, int room) {
+  h->size++;
+  return push_bucket(h, bucket_of(key, h->last), key, room);
+}
+
+/**
+ * removes an item with the smallest key into *it; the heap must not be empty
+ * returns 0 on success, -1 on allocation failure
+ */
+static int heap_pop(radix_heap_t *h, item_t *it) {
+  if (h->len[0] == 0) {
+    int b = 1, error = 0;
+    size_t i;
+    while (h->len[b] == 0)
+      b++;
+    // the new minimum is in the first non-empty bucket; every item in that
+    // bucket moves to a lower one once last is raised to it
+    item_t *items = h->b->items[b];
+    uint64_t min = items[0].key;
+    for (i = 1; i < h->len[b]; ++i)
+      if (items[i].key < min)
+	min = items[i].key;
+    h->last = min;
+    // push_bucket() only grows lower buckets, so items stays valid
+    for (i = 0; i < h->len[b] && !error; ++i)
+      error = push_bucket(h, bucket_of(items[i].key, min), items[i].key, items[i].room);
+    h->len[b] = 0;
+    if (error)
+      return -1;
+  }
+  h->size--;
+  *it = h->b->items[0][--h->len[0]];
+  return 0;
+}
+
+int64_t dijkstra(const unsigned char *codes, const unsigned *costs, int rows, int cols,
+                 int start, int goal, int *prev, uint64_t *dist, buckets_t *buckets) {
+  size_t cells = (size_t) rows * cols;
+  radix_heap_t h = {buckets, {0}, 0, 0};
+  int64_t result = -1;
+  size_t i;
+  int dir, error;
+
+  for (i = 0; i < cells; ++i) {
+    dist[i] = UINT64_MAX;
+    prev[i] = -1;
+  }
+  dist[start] = 0;
+  error = heap_push(&h, 0, start);
+
+  while (!error && h.size > 0) {
+    item_t it;
+    if ((error = heap_pop(&h, &it)))
+      break;
+    if (it.key != dist[it.room])
+      continue; // stale entry left behind by a cheaper push
+    if (it.room == goal) {
+      result = (int64_t) it.key;
+      break;
+    }
+    int x = it.room % cols;
+    int y = it.room / cols;
+    for (dir = 0; dir < 4 && !error; ++dir) {
+      int neighbor_x = x + calculate_offset(dir, 'x');
+      int neighbor_y = y + calculate_offset(dir, 'y');
+      if ((codes[it.room] & direction_codes[dir]) || out_of_bounds(neighbor_x, neighbor_y, rows, cols))
+	continue;
+      int neighbor = neighbor_y * cols + neighbor_x;
+      uint64_t d = it.key + costs[neighbor];
+      if (d < dist[neighbor]) {
+	dist[neighbor] = d;
+	prev[neighbor] = it.room;
+	error = heap_push(&h, d, neighbor);
+      }
+    }
+  }
+
+  return error ? -1 : result;
+}
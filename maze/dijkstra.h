@@ -0,0 +1,46 @@
+#ifndef DIJKSTRA_H
+#define DIJKSTRA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * marker line that starts the optional cost plane of a hex maze file. it is
+ * followed by one line per row of rooms holding the decimal cost of entering
+ * each room, separated by spaces. files without it cost 1 per room
+ */
+#define COST_MARKER "costs"
+#define MAX_COST 1000000
+
+#define NUM_BUCKETS 65
+
+typedef struct {
+  uint64_t key;
+  int room;
+} item_t;
+
+/**
+ * the buckets of the frontier of dijkstra(), kept by the caller so that they
+ * are reused from one call to the next. they start zeroed and only grow
+ */
+typedef struct {
+  item_t *items[NUM_BUCKETS];
+  size_t cap[NUM_BUCKETS];
+} buckets_t;
+
+void free_buckets(buckets_t *b);
+
+/**
+ * finds the cheapest route from start to goal (room indices y * cols + x) in a
+ * rows x cols maze of wall codes, where moving into a room costs costs[room]
+ * prev - rows * cols entries, set to the room each room was reached from
+ *     (-1 for the start and unreached rooms)
+ * dist - rows * cols entries of scratch space for the cost of reaching each room
+ * buckets - the buckets of the frontier, grown as needed
+ * returns the cost of the route, or -1 if the goal cannot be reached or on
+ * allocation failure
+ */
+int64_t dijkstra(const unsigned char *codes, const unsigned *costs, int rows, int cols,
+                 int start, int goal, int *prev, uint64_t *dist, buckets_t *buckets);
+
+#endif /* DIJKSTRA_H */
@@ -1,24 +1,50 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
-#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "maze.h"
+#include "compress.h"
+#include "dijkstra.h"
 
-Room maze[NUM_ROWS][NUM_COLS];
+// number of mazes a batch worker claims at a time
+#define BATCH_CHUNK 16
 
 /**
- * given an array, performs an in-place shuffle using the Fisher-
- * Yates algorithm
+ * archive of batch output (generator -n <count> -a)
+ * all integers are little-endian
+ *   magic         "MZA1"
+ *   count         32-bit number of mazes
+ *   reserved      32-bit, 0
+ *   index_offset  64-bit file offset of the index
+ *   members       the mazes, hex text or compressed, in completion order
+ *   index         count pairs of 64-bit (offset, length), in maze order
  */
-void shuffle_array(int arr[]) {
-  int i;
-  for (i = 3; i > 0; --i) {
-    int r = rand() % (i + 1);
-    int temp = arr[i];
-    arr[i] = arr[r];
-    arr[r] = temp;
-  }
-}
+#define ARCHIVE_MAGIC "MZA1"
+#define ARCHIVE_HEADER 20
+
+/**
+ * state for generating one maze at a time. each batch worker owns one of
+ * these, so the grid, stack and output buffers are reused from one maze to the
+ * next and the random number stream is private to the worker
+ * codes - the wall code of each room in row-major order, the same 4-bit
+ *     values that are written to the hex file
+ */
+typedef struct {
+  int rows;
+  int cols;
+  unsigned char *codes;
+  unsigned char *visited;
+  int *stack;
+  uint64_t rng;
+  unsigned char *out;   // serialized maze
+  size_t out_len;
+  size_t out_cap;
+} generator_t;
 
 /**
  * given a direction, returns the opposite direction
@@ -37,80 +63,376 @@ int opposite(int direction) {
   return 0;
 }
 
+/**
+ * seeds the random number stream of g. every maze in a batch gets its own
+ * stream derived from the base seed and its number, so the output does not
+ * depend on which worker happens to generate it
+ */
+void seed_random(generator_t *g, uint64_t seed, uint64_t number) {
+  g->rng = seed + number * 0x9E3779B97F4A7C15ull;
+}
 
 /**
- * given starting x- and y-coordinates, recursively constructs a 
- * maze by visiting each room and randomly choosing connections 
- * for that room by visiting adjacent rooms
+ * splitmix64 step, returns a random integer in [0, n)
  */
-void drunken_walk(int x, int y) {
-  Room *r = &maze[y][x]; // pointer to room at (x, y) in maze
-  r->visited = 1; // set visited to true
-  
-  // set connections to -1 to indicate that they do not exist yet
-  int i;
-  for(i = 0; i < 4; ++i) {
-    r->connections[i] = -1;
+int next_random(generator_t *g, int n) {
+  uint64_t z = (g->rng += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  z ^= z >> 31;
+  return (int) ((z >> 32) % (uint64_t) n);
+}
+
+/**
+ * allocates the buffers of g for rows x cols mazes
+ * returns 0 on success, -1 on failure
+ */
+int init_generator(generator_t *g, int rows, int cols) {
+  size_t cells = (size_t) rows * cols;
+  g->rows = rows;
+  g->cols = cols;
+  g->codes = (unsigned char *) malloc(cells);
+  g->visited = (unsigned char *) malloc(cells);
+  g->stack = (int *) malloc(cells * sizeof(int));
+  g->out = NULL;
+  g->out_len = 0;
+  g->out_cap = 0;
+  if (g->codes == NULL || g->visited == NULL || g->stack == NULL)
+    return -1;
+  return 0;
+}
+
+void cleanup_generator(generator_t *g) {
+  free(g->codes);
+  free(g->visited);
+  free(g->stack);
+  free(g->out);
+}
+
+/**
+ * starting from the room at (0, 0), constructs a maze by visiting each room
+ * and randomly choosing connections for that room by visiting adjacent rooms.
+ * the walk keeps its own stack of rooms rather than recursing, so that large
+ * mazes do not overflow the (thread) stack. every room starts with four walls
+ * and a door is opened whenever the walk moves into an unvisited room; picking
+ * uniformly among the unvisited neighbors at each step gives the same
+ * distribution as shuffling the four directions once per room
+ */
+void drunken_walk(generator_t *g) {
+  int cols = g->cols;
+  size_t cells = (size_t) g->rows * cols;
+  memset(g->codes, CODE_EAST | CODE_WEST | CODE_SOUTH | CODE_NORTH, cells);
+  memset(g->visited, 0, cells);
+
+  int top = 0;
+  g->stack[top++] = 0;
+  g->visited[0] = 1;
+  while (top > 0) {
+    int room = g->stack[top - 1];
+    int x = room % cols;
+    int y = room / cols;
+
+    int dirs[4], count = 0, dir;
+    for (dir = 0; dir < 4; ++dir) { // collect the unvisited neighbors
+      int neighbor_x = x + calculate_offset(dir, 'x');
+      int neighbor_y = y + calculate_offset(dir, 'y');
+      if (!out_of_bounds(neighbor_x, neighbor_y, g->rows, cols)
+	  && !g->visited[neighbor_y * cols + neighbor_x])
+	dirs[count++] = dir;
+    }
+    if (count == 0) { // dead end, backtrack
+      top--;
+      continue;
+    }
+
+    dir = dirs[next_random(g, count)];
+    int neighbor = (y + calculate_offset(dir, 'y')) * cols + x + calculate_offset(dir, 'x');
+    g->codes[room] &= (unsigned char) ~direction_codes[dir];
+    g->codes[neighbor] &= (unsigned char) ~direction_codes[opposite(dir)];
+    g->visited[neighbor] = 1;
+    g->stack[top++] = neighbor;
   }
+}
 
-  // randomize the order of the directions
-  int directions[4] = {EAST, WEST, SOUTH, NORTH};
-  shuffle_array(directions);
-
-  for (i = 0; i < 4; ++i) { // for each direction in random order
-    int dir = directions[i];
-    int neighbor_x = x + calculate_offset(dir, 'x');
-    int neighbor_y = y + calculate_offset(dir, 'y');
-    
-    if (out_of_bounds(neighbor_x, neighbor_y)) {
-      r->connections[dir] = 1;
-    } else {
-      Room *neighbor = &maze[neighbor_y][neighbor_x];
-      if (neighbor->visited != 1) {
-	r->connections[dir] = 0;
-	drunken_walk(neighbor_x, neighbor_y);
-      } else {
-	int opposite_dir = opposite(dir);
-	if (neighbor->connections[opposite_dir] != -1) {
-	  r->connections[dir] = neighbor->connections[opposite_dir];
-	}
-	else {
-	  r->connections[dir] = 1;
-	}
-      }
+/**
+ * serializes the current maze of g into g->out, as hex text or compressed.
+ * if max_cost is positive, the hex text is followed by a cost plane of random
+ * costs between 1 and max_cost
+ * returns 0 on success, -1 on failure
+ */
+int serialize(generator_t *g, int compressed, int max_cost) {
+  if (compressed)
+    return mzc_encode(g->codes, g->rows, g->cols, &g->out, &g->out_len, &g->out_cap);
+
+  static const char hex[] = "0123456789abcdef";
+  size_t len = (size_t) g->rows * (g->cols + 1);
+  size_t cap = len;
+  if (max_cost > 0) // marker line, then at most 7 digits and a separator per room
+    cap += sizeof(COST_MARKER) + (size_t) g->rows * g->cols * 8;
+  if (g->out_cap < cap) {
+    unsigned char *out = (unsigned char *) realloc(g->out, cap);
+    if (out == NULL)
+      return -1;
+    g->out = out;
+    g->out_cap = cap;
+  }
+  unsigned char *p = g->out;
+  const unsigned char *code = g->codes;
+  int i, j;
+  for (i = 0; i < g->rows; ++i) {
+    for (j = 0; j < g->cols; ++j)
+      *p++ = (unsigned char) hex[*code++];
+    *p++ = '\n';
+  }
+
+  if (max_cost > 0) {
+    p += sprintf((char *) p, "%s\n", COST_MARKER);
+    for (i = 0; i < g->rows; ++i) {
+      for (j = 0; j < g->cols; ++j)
+	p += sprintf((char *) p, j ? " %d" : "%d", 1 + next_random(g, max_cost));
+      *p++ = '\n';
     }
+    len = (size_t) (p - g->out);
   }
+  g->out_len = len;
+  return 0;
 }
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-      printf("Usage: %s <output>\n", argv[0]);
-  } else {
-    FILE *file = fopen(argv[1], "w"); // open output file
-    
+/**
+ * settings and shared state of a batch run
+ */
+typedef struct {
+  int count;
+  int rows;
+  int cols;
+  uint64_t seed;
+  int compressed;
+  int max_cost;         // 0 for unweighted mazes
+  int use_archive;
+  const char *output;   // archive path, or prefix of the numbered files
+  int digits;           // width of the numbers in the file names
+  FILE *archive;        // NULL when writing numbered files
+  unsigned char *index; // archive index, 16 bytes per maze
+  pthread_mutex_t lock;
+  int next;             // next maze number to hand out
+  int error;
+} batch_t;
+
+static void put_u64(unsigned char *p, uint64_t v) {
+  int i;
+  for (i = 0; i < 8; ++i)
+    p[i] = (unsigned char) (v >> (8 * i));
+}
+
+/**
+ * writes maze number n, already serialized in g, to its numbered file or
+ * appends it to the archive
+ * returns 0 on success, -1 on failure
+ */
+int store_maze(batch_t *b, generator_t *g, int n) {
+  if (b->archive == NULL) {
+    char path[strlen(b->output) + 16];
+    sprintf(path, "%s%0*d", b->output, b->digits, n);
+    FILE *file = fopen(path, "wb");
     if (file == NULL) {
-      printf("Could not write to file %s\n", argv[1]);
-    } else {
-      
-      srand(time(NULL)); // change seed value to ensure randomness
-
-      drunken_walk(0, 0); // generate random maze
-
-      int i, j, k;
-      for(i = 0; i < NUM_ROWS; ++i) {
-	for(j = 0; j < NUM_COLS; ++j) {
-	  int decimal = 0;
-	  for(k = 0; k < 4; ++k) {
-	    // convert bits to integer
-	    decimal += maze[i][j].connections[k] * pow(2, (3 - k));
-	  }
-	  fprintf(file, "%x", decimal); // convert integer to hexadecimal
-	}
-	fprintf(file, "\n");
-      }
-      fclose(file);
+      printf("Could not write to file %s\n", path);
+      return -1;
     }
+    int error = fwrite(g->out, 1, g->out_len, file) != g->out_len;
+    if (fclose(file) || error) {
+      printf("Could not write to file %s\n", path);
+      return -1;
+    }
+    return 0;
+  }
+
+  pthread_mutex_lock(&b->lock);
+  long offset = ftell(b->archive);
+  int error = offset < 0 || fwrite(g->out, 1, g->out_len, b->archive) != g->out_len;
+  pthread_mutex_unlock(&b->lock);
+  put_u64(b->index + 16 * (size_t) n, (uint64_t) offset);
+  put_u64(b->index + 16 * (size_t) n + 8, g->out_len);
+  if (error) {
+    printf("Could not write to file %s\n", b->output);
+    return -1;
   }
   return 0;
 }
 
+/**
+ * batch worker: claims BATCH_CHUNK maze numbers at a time and generates,
+ * serializes and stores each of them with its own generator state
+ */
+void *batch_worker(void *ptr) {
+  batch_t *b = (batch_t *) ptr;
+  generator_t g;
+  int error = init_generator(&g, b->rows, b->cols);
+
+  while (!error) {
+    pthread_mutex_lock(&b->lock);
+    int first = b->next;
+    b->next += BATCH_CHUNK;
+    error = b->error;
+    pthread_mutex_unlock(&b->lock);
+    if (first >= b->count || error)
+      break;
+
+    int n;
+    int last = first + BATCH_CHUNK < b->count ? first + BATCH_CHUNK : b->count;
+    for (n = first; n < last && !error; ++n) {
+      seed_random(&g, b->seed, (uint64_t) n);
+      drunken_walk(&g);
+      error = serialize(&g, b->compressed, b->max_cost) || store_maze(b, &g, n);
+    }
+  }
+
+  if (error) {
+    pthread_mutex_lock(&b->lock);
+    b->error = 1;
+    pthread_mutex_unlock(&b->lock);
+  }
+  cleanup_generator(&g);
+  return NULL;
+}
+
+/**
+ * generates b->count mazes on a pool of nthreads workers
+ * returns 0 on success, -1 on failure
+ */
+int run_batch(batch_t *b, int nthreads) {
+  int i;
+  b->archive = NULL;
+  b->index = NULL;
+  b->next = 0;
+  b->error = 0;
+  for (b->digits = 1, i = b->count - 1; i >= 10; i /= 10)
+    b->digits++;
+
+  if (b->use_archive) {
+    unsigned char header[ARCHIVE_HEADER] = ARCHIVE_MAGIC;
+    b->archive = fopen(b->output, "wb");
+    b->index = (unsigned char *) malloc(16 * (size_t) b->count);
+    if (b->archive == NULL || b->index == NULL) {
+      printf("Could not write to file %s\n", b->output);
+      if (b->archive != NULL)
+	fclose(b->archive);
+      free(b->index);
+      return -1;
+    }
+    // placeholder, rewritten once the index offset is known
+    fwrite(header, 1, ARCHIVE_HEADER, b->archive);
+  }
+
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_t threads[nthreads];
+  int started[nthreads];
+  for (i = 0; i < nthreads; ++i)
+    started[i] = i > 0 && pthread_create(&threads[i], NULL, batch_worker, b) == 0;
+  batch_worker(b); // the main thread is a worker too
+  for (i = 1; i < nthreads; ++i)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&b->lock);
+
+  if (b->archive != NULL) {
+    unsigned char header[ARCHIVE_HEADER];
+    long index_offset = ftell(b->archive);
+    memcpy(header, ARCHIVE_MAGIC, 4);
+    put_u64(header + 4, (uint64_t) b->count); // count and reserved
+    put_u64(header + 12, (uint64_t) index_offset);
+    if (!b->error)
+      b->error = index_offset < 0
+	|| fwrite(b->index, 16, (size_t) b->count, b->archive) != (size_t) b->count
+	|| fseek(b->archive, 0, SEEK_SET)
+	|| fwrite(header, 1, ARCHIVE_HEADER, b->archive) != ARCHIVE_HEADER;
+    if (fclose(b->archive))
+      b->error = 1;
+    free(b->index);
+    if (b->error)
+      printf("Could not write to file %s\n", b->output);
+  }
+  return b->error ? -1 : 0;
+}
+
+void usage(char *name) {
+  printf("Usage: %s [-z | -w <max_cost>] [-r <rows>] [-c <cols>] [-s <seed>] <output>\n", name);
+  printf("       %s -n <count> [-a] [-z | -w <max_cost>] [-r <rows>] [-c <cols>] [-s <seed>] [-j <threads>] <output>\n", name);
+}
+
+int main(int argc, char **argv) {
+  batch_t b;
+  int opt, nthreads = 0;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  b.count = 0;
+  b.rows = NUM_ROWS;
+  b.cols = NUM_COLS;
+  b.seed = (uint64_t) time(NULL); // change seed value to ensure randomness
+  b.compressed = 0;
+  b.max_cost = 0;
+  b.use_archive = 0;
+
+  while ((opt = getopt(argc, argv, "n:r:c:s:j:w:az")) != -1) {
+    switch (opt) {
+    case 'n':
+      b.count = atoi(optarg);
+      break;
+    case 'r':
+      b.rows = atoi(optarg);
+      break;
+    case 'c':
+      b.cols = atoi(optarg);
+      break;
+    case 's':
+      b.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'j':
+      nthreads = atoi(optarg);
+      break;
+    case 'w':
+      b.max_cost = atoi(optarg);
+      break;
+    case 'a':
+      b.use_archive = 1;
+      break;
+    case 'z':
+      b.compressed = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 0;
+    }
+  }
+  if (optind != argc - 1 || b.rows <= 0 || b.cols <= 0 || nthreads < 0
+      || b.max_cost < 0 || b.max_cost > MAX_COST || (b.max_cost && b.compressed)
+      || (b.count <= 0 && (b.use_archive || nthreads))) {
+    usage(argv[0]);
+    return 0;
+  }
+  b.output = argv[optind];
+
+  if (b.count > 0) {
+    if (nthreads == 0)
+      nthreads = ncpu > 1 ? (int) ncpu : 1;
+    if (nthreads > b.count)
+      nthreads = b.count;
+    return run_batch(&b, nthreads) ? 1 : 0;
+  }
+
+  FILE *file = fopen(b.output, "wb"); // open output file
+  generator_t g;
+  if (file == NULL) {
+    printf("Could not write to file %s\n", b.output);
+  } else if (init_generator(&g, b.rows, b.cols)) {
+    printf("Could not allocate a %d x %d maze\n", b.rows, b.cols);
+    fclose(file);
+  } else {
+    seed_random(&g, b.seed, 0);
+    drunken_walk(&g); // generate random maze
+    if (serialize(&g, b.compressed, b.max_cost)
+	|| fwrite(g.out, 1, g.out_len, file) != g.out_len)
+      printf("Could not write to file %s\n", b.output);
+    fclose(file);
+    cleanup_generator(&g);
+  }
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "maze.h"
 
+const unsigned char direction_codes[4] = {CODE_EAST, CODE_WEST, CODE_SOUTH, CODE_NORTH};
+
 /**
  * calculates the offset in a given direction along a given axis
  */
@@ -27,11 +29,11 @@ int calculate_offset(int direction, char type) {
 }
 
 /**
- * given x- and y-coordinates, returns 1 if (x, y) is out of 
- * bounds, 0 otherwise
+ * given x- and y-coordinates and the dimensions of a maze, returns 1 if
+ * (x, y) is out of bounds, 0 otherwise
  */
-int out_of_bounds(int x, int y) {
-  if ((x < 0 || x > NUM_COLS - 1) || (y < 0 || y > NUM_ROWS - 1))
+int out_of_bounds(int x, int y, int rows, int cols) {
+  if ((x < 0 || x > cols - 1) || (y < 0 || y > rows - 1))
     return 1;
   else return 0;
 }
@@ -5,21 +5,24 @@
 #define NUM_COLS 25
 
 /**
- * struct representing a room in the maze
- * visited - 0 if the room has not been visited; 1 if the room has been visited
- * connections - each index represents the type of connection in one of the cardinal directions (in the order east, west, south, north)
- *             - 0 if there is a door; 1 if there is a wall
+ * enumerated type for the cardinal directions
+ * in the order the walls of a room are written as bits of its hex digit
  */
-typedef struct {
-  int visited;
-  int connections[4];
-} Room;
+enum Direction {EAST, WEST, SOUTH, NORTH};
 
 /**
- * enumerated type for the cardinal directions
- * sets each direction to the corresponding index of the connections array in a Room structure
+ * a room is stored as the same 4-bit wall code that is written to the hex
+ * file, one bit per direction: 1 if there is a wall, 0 if there is a door
  */
-enum Direction {EAST, WEST, SOUTH, NORTH};
+#define CODE_EAST 8
+#define CODE_WEST 4
+#define CODE_SOUTH 2
+#define CODE_NORTH 1
+
+/**
+ * wall code bit of each direction, indexed by enum Direction
+ */
+extern const unsigned char direction_codes[4];
 
 /**
  * calculates the offset in a given direction along a given axis
@@ -27,9 +30,9 @@ enum Direction {EAST, WEST, SOUTH, NORTH};
 int calculate_offset(int direction, char type);
 
 /**
- * given x- and y-coordinates, returns 1 if (x, y) is out of 
- * bounds, 0 otherwise
+ * given x- and y-coordinates and the dimensions of a maze, returns 1 if
+ * (x, y) is out of bounds, 0 otherwise
  */
-int out_of_bounds(int x, int y);
+int out_of_bounds(int x, int y, int rows, int cols);
 
 #endif /* MAZE_H */
@@ -0,0 +1,354 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "maze.h"
+#include "compress.h"
+#include "dijkstra.h"
+
+// rows of rooms rendered per band when reading hex text
+#define BAND_ROWS 64
+
+/**
+ * the maze is drawn on a (2 * cols + 1) x (2 * rows + 1) pixel grid. the room
+ * at (x, y) owns pixels (2x, 2y) to (2x + 1, 2y + 1): its top-left corner, its
+ * north wall, its west wall and its interior. the last pixel column and row
+ * hold the east and south walls of the rooms along the border.
+ *
+ * each room therefore contributes two pixels to each of its two pixel rows,
+ * which the tables below map straight from its wall code:
+ *   top_pair / mid_pair - the four PBM bits of two adjacent rooms, indexed by
+ *       (left code << 4) | right code
+ *   top_chars / mid_chars - the two ASCII characters of one room
+ */
+static unsigned char top_pair[256];
+static unsigned char mid_pair[256];
+static char top_chars[16][2];
+static char mid_chars[16][2];
+
+/**
+ * state of a render
+ * stride - rooms per row in the band buffer, padded so that a PBM row can be
+ *     blitted four rooms (one byte) at a time
+ * path - one bit per room on the overlaid path, or NULL
+ */
+typedef struct {
+  int rows;
+  int cols;
+  int ascii;
+  int stride;
+  unsigned char *band;
+  unsigned char *path;
+  unsigned char *out;
+  size_t out_len;
+  size_t row_len;
+  FILE *file;
+} render_t;
+
+void init_tables() {
+  int i;
+  for (i = 0; i < 256; ++i) {
+    int left = i >> 4, right = i & 15;
+    top_pair[i] = (unsigned char) (8 | ((left & CODE_NORTH) ? 4 : 0) | 2 | ((right & CODE_NORTH) ? 1 : 0));
+    mid_pair[i] = (unsigned char) (((left & CODE_WEST) ? 8 : 0) | ((right & CODE_WEST) ? 2 : 0));
+  }
+  for (i = 0; i < 16; ++i) {
+    top_chars[i][0] = '+';
+    top_chars[i][1] = (i & CODE_NORTH) ? '-' : ' ';
+    mid_chars[i][0] = (i & CODE_WEST) ? '|' : ' ';
+    mid_chars[i][1] = ' ';
+  }
+}
+
+int on_path(render_t *r, int x, int y) {
+  size_t i = (size_t) y * r->cols + x;
+  return (r->path[i >> 3] >> (i & 7)) & 1;
+}
+
+/**
+ * reads the rooms of a solver output file into the path bitmap
+ * returns 0 on success, -1 on failure
+ */
+int load_path(render_t *r, const char *name) {
+  FILE *file = fopen(name, "r");
+  if (file == NULL)
+    return -1;
+  r->path = (unsigned char *) calloc(((size_t) r->rows * r->cols + 7) / 8, 1);
+  if (r->path == NULL) {
+    fclose(file);
+    return -1;
+  }
+
+  int c, x, y;
+  while ((c = fgetc(file)) != EOF && c != '\n') // skip the PRUNED or FULL line
+    ;
+  while (fscanf(file, "%d, %d", &x, &y) == 2) {
+    if (x >= 0 && x < r->cols && y >= 0 && y < r->rows) {
+      size_t i = (size_t) y * r->cols + x;
+      r->path[i >> 3] |= (unsigned char) (1 << (i & 7));
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
+/**
+ * renders one pixel row from a row of room codes into dst
+ * mid - 0 for the row of corners and north walls, 1 for the row of west walls
+ *     and interiors
+ * y - maze row of the codes, used for the path overlay (-1 for none)
+ */
+void render_row(render_t *r, unsigned char *dst, const unsigned char *codes, int mid, int y) {
+  int x;
+  if (r->ascii) {
+    const char (*table)[2] = mid ? mid_chars : top_chars;
+    for (x = 0; x < r->cols; ++x)
+      memcpy(dst + 2 * x, table[codes[x]], 2);
+    dst[2 * r->cols] = mid ? table[codes[r->cols]][0] : '+';
+    dst[2 * r->cols + 1] = '\n';
+  } else {
+    const unsigned char *table = mid ? mid_pair : top_pair;
+    size_t i;
+    for (i = 0; i < r->row_len; ++i) {
+      const unsigned char *c = codes + 4 * i;
+      dst[i] = (unsigned char) (table[c[0] << 4 | c[1]] << 4 | table[c[2] << 4 | c[3]]);
+    }
+  }
+
+  if (r->path == NULL || y < 0)
+    return;
+  size_t base = (size_t) y * r->cols;
+  for (x = 0; x < r->cols; ++x) {
+    size_t i = base + x;
+    if ((i & 7) == 0 && x + 8 <= r->cols && r->path[i >> 3] == 0) {
+      x += 7; // skip a byte of the bitmap with nothing on the path
+      continue;
+    }
+    if (!on_path(r, x, y))
+      continue;
+    int pixel = -1, door = -1;
+    if (mid) {
+      pixel = 2 * x + 1;
+      if (x > 0 && !(codes[x] & CODE_WEST) && on_path(r, x - 1, y))
+	door = 2 * x;
+    } else if (y > 0 && !(codes[x] & CODE_NORTH) && on_path(r, x, y - 1)) {
+      pixel = 2 * x + 1;
+    }
+    if (r->ascii) {
+      if (pixel >= 0)
+	dst[pixel] = '.';
+      if (door >= 0)
+	dst[door] = '.';
+    } else {
+      if (pixel >= 0)
+	dst[pixel >> 3] |= (unsigned char) (0x80 >> (pixel & 7));
+      if (door >= 0)
+	dst[door >> 3] |= (unsigned char) (0x80 >> (door & 7));
+    }
+  }
+}
+
+/**
+ * renders the n rows of rooms in r->band, the first of which is maze row
+ * first_row, and writes them out with a single fwrite
+ * returns 0 on success, -1 on failure
+ */
+int render_band(render_t *r, int first_row, int n) {
+  int i, x;
+  unsigned char *dst = r->out;
+  for (i = 0; i < n; ++i) {
+    unsigned char *codes = r->band + (size_t) i * r->stride;
+    // the first padding room draws the east border as its west wall
+    codes[r->cols] = (codes[r->cols - 1] & CODE_EAST) ? CODE_WEST : 0;
+    render_row(r, dst, codes, 0, first_row + i);
+    dst += r->out_len;
+    render_row(r, dst, codes, 1, first_row + i);
+    dst += r->out_len;
+  }
+
+  if (first_row + n == r->rows) { // bottom border, from the south walls of the last row
+    unsigned char *last = r->band + (size_t) (n - 1) * r->stride;
+    for (x = 0; x < r->cols; ++x)
+      last[x] = (last[x] & CODE_SOUTH) ? CODE_NORTH : 0;
+    render_row(r, dst, last, 0, -1);
+    dst += r->out_len;
+  }
+
+  size_t len = (size_t) (dst - r->out);
+  return fwrite(r->out, 1, len, r->file) == len ? 0 : -1;
+}
+
+/**
+ * allocates the band and output buffers for bands of up to band_rows rows
+ * returns 0 on success, -1 on failure
+ */
+int init_render(render_t *r, int band_rows) {
+  if (r->ascii) {
+    r->out_len = 2 * (size_t) r->cols + 2;
+    r->row_len = 0;
+    r->stride = r->cols + 1;
+  } else {
+    r->out_len = (2 * (size_t) r->cols + 1 + 7) / 8;
+    r->row_len = r->out_len;
+    r->stride = (int) (4 * r->row_len);
+  }
+  r->band = (unsigned char *) calloc((size_t) band_rows * r->stride, 1);
+  r->out = (unsigned char *) malloc((2 * (size_t) band_rows + 1) * r->out_len);
+  if (r->band == NULL || r->out == NULL)
+    return -1;
+  if (!r->ascii)
+    fprintf(r->file, "P4\n%d %d\n", 2 * r->cols + 1, 2 * r->rows + 1);
+  return 0;
+}
+
+/**
+ * streams a compressed maze, one block (band) at a time
+ * returns 0 on success, -1 on failure
+ */
+int render_compressed(render_t *r, FILE *in, const char *path) {
+  mzc_header_t h;
+  int i, error = 0;
+  if (mzc_read_header(in, &h))
+    return -1;
+  r->rows = h.rows;
+  r->cols = h.cols;
+
+  size_t max_size = 0;
+  for (i = 0; i < h.num_blocks; ++i)
+    if (h.sizes[i] > max_size)
+      max_size = h.sizes[i];
+  unsigned char *data = (unsigned char *) malloc(max_size ? max_size : 1);
+  unsigned char *codes = (unsigned char *) malloc((size_t) h.band_rows * h.cols);
+  error = data == NULL || codes == NULL || (path && load_path(r, path))
+    || init_render(r, h.band_rows);
+
+  for (i = 0; !error && i < h.num_blocks; ++i) {
+    int first_row = i * h.band_rows;
+    int band = h.rows - first_row < h.band_rows ? h.rows - first_row : h.band_rows;
+    int j;
+    error = fseek(in, h.offsets[i], SEEK_SET)
+      || fread(data, 1, h.sizes[i], in) != h.sizes[i]
+      || mzc_decode_block(data, h.sizes[i], codes, first_row, band, h.rows, h.cols, h.crcs[i]);
+    for (j = 0; !error && j < band; ++j)
+      memcpy(r->band + (size_t) j * r->stride, codes + (size_t) j * h.cols, (size_t) h.cols);
+    if (!error)
+      error = render_band(r, first_row, band);
+  }
+  free(data);
+  free(codes);
+  mzc_free_header(&h);
+  return error ? -1 : 0;
+}
+
+/**
+ * streams a hex text maze, BAND_ROWS rows at a time. the number of columns is
+ * the length of the first line and the number of rows follows from the size of
+ * the file, so the PBM header can be written before the maze is read
+ * returns 0 on success, -1 on failure
+ */
+int render_hex(render_t *r, FILE *in, const char *path) {
+  static signed char value[256];
+  struct stat st;
+  int c, i, j;
+
+  memset(value, -1, sizeof(value));
+  for (i = 0; i < 16; ++i) {
+    value[(unsigned char) "0123456789abcdef"[i]] = (signed char) i;
+    value[(unsigned char) "0123456789ABCDEF"[i]] = (signed char) i;
+  }
+
+  r->cols = 0;
+  while ((c = fgetc(in)) != EOF && c != '\n')
+    r->cols++;
+  if (r->cols == 0 || fstat(fileno(in), &st) || fseek(in, 0, SEEK_SET))
+    return -1;
+  size_t line = (size_t) r->cols + 1;
+  r->rows = (int) (((size_t) st.st_size + 1) / line); // last newline may be missing
+  for (i = 1; i < r->rows; ++i) { // stop at the cost plane of a weighted maze
+    char marker[sizeof(COST_MARKER)];
+    if (pread(fileno(in), marker, sizeof(marker), (off_t) (i * line)) == (ssize_t) sizeof(marker)
+	&& memcmp(marker, COST_MARKER "\n", sizeof(marker)) == 0) {
+      r->rows = i;
+      break;
+    }
+  }
+  if (r->rows == 0 || (path && load_path(r, path)) || init_render(r, BAND_ROWS))
+    return -1;
+
+  char *text = (char *) malloc(BAND_ROWS * line);
+  if (text == NULL)
+    return -1;
+  int first_row, error = 0;
+  for (first_row = 0; !error && first_row < r->rows; first_row += BAND_ROWS) {
+    int band = r->rows - first_row < BAND_ROWS ? r->rows - first_row : BAND_ROWS;
+    size_t want = band * line;
+    size_t got = fread(text, 1, want, in);
+    if (got + 1 == want && first_row + band == r->rows)
+      text[got++] = '\n';
+    error = got != want;
+    for (i = 0; !error && i < band; ++i) {
+      const unsigned char *src = (const unsigned char *) text + i * line;
+      unsigned char *dst = r->band + (size_t) i * r->stride;
+      for (j = 0; j < r->cols; ++j) {
+	if (value[src[j]] < 0) {
+	  error = 1;
+	  break;
+	}
+	dst[j] = (unsigned char) value[src[j]];
+      }
+    }
+    if (!error)
+      error = render_band(r, first_row, band);
+  }
+  free(text);
+  return error ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+  render_t r;
+  char *path = NULL;
+  int opt;
+  memset(&r, 0, sizeof(r));
+
+  while ((opt = getopt(argc, argv, "ap:")) != -1) {
+    switch (opt) {
+    case 'a':
+      r.ascii = 1;
+      break;
+    case 'p':
+      path = optarg;
+      break;
+    default:
+      optind = argc + 1;
+    }
+  }
+  if (optind != argc - 2) {
+    printf("Usage: %s [-a] [-p <path>] <input> <output>\n", argv[0]);
+    return 0;
+  }
+
+  FILE *in = fopen(argv[optind], "rb"); // open input file
+  r.file = fopen(argv[optind + 1], "wb"); // open output file
+  if (in == NULL) {
+    printf("Could not open input file: No such file or directory\n");
+  } else if (r.file == NULL) {
+    printf("Could not open output file\n");
+  } else {
+    init_tables();
+    int error = mzc_detect(in) ? render_compressed(&r, in, path) : render_hex(&r, in, path);
+    if (error)
+      printf("Could not render maze from input file\n");
+  }
+
+  if (in != NULL)
+    fclose(in);
+  if (r.file != NULL)
+    fclose(r.file);
+  free(r.band);
+  free(r.path);
+  free(r.out);
+  return 0;
+}
@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <string.h>
+#include "maze.h"
+#include "compress.h"
+#include "dijkstra.h"
+#include "solve.h"
+
+void init_grid(grid_t *g) {
+  memset(g, 0, sizeof(grid_t));
+}
+
+void cleanup_grid(grid_t *g) {
+  free(g->codes);
+  free(g->visited);
+  free(g->costs);
+  free(g->stack);
+  free(g->prev);
+  free(g->dist);
+  free_buckets(&g->buckets);
+  init_grid(g);
+}
+
+/**
+ * grows *buf to hold at least n elements of the given size, keeping its
+ * contents. returns 0 on success, -1 on failure
+ */
+static int grow(void **buf, size_t *cap, size_t n, size_t size) {
+  if (*cap >= n)
+    return 0;
+  if (n < 2 * *cap)
+    n = 2 * *cap;
+  void *grown = realloc(*buf, n * size);
+  if (grown == NULL)
+    return -1;
+  *buf = grown;
+  *cap = n;
+  return 0;
+}
+
+int read_file(FILE *file, unsigned char **data, size_t *len, size_t *cap) {
+  *len = 0;
+  for (;;) {
+    if (grow((void **) data, cap, *len + 65536, 1))
+      return -1;
+    size_t n = fread(*data + *len, 1, *cap - *len, file);
+    *len += n;
+    if (n == 0)
+      return ferror(file) ? -1 : 0;
+  }
+}
+
+/**
+ * returns the length of the line starting at p, not counting a trailing
+ * carriage return
+ */
+static size_t line_length(const unsigned char *p, const unsigned char *end) {
+  const unsigned char *nl = (const unsigned char *) memchr(p, '\n', (size_t) (end - p));
+  size_t n = (size_t) ((nl ? nl : end) - p);
+  if (n > 0 && p[n - 1] == '\r')
+    n--;
+  return n;
+}
+
+static const unsigned char *next_line(const unsigned char *p, const unsigned char *end) {
+  const unsigned char *nl = (const unsigned char *) memchr(p, '\n', (size_t) (end - p));
+  return nl ? nl + 1 : end;
+}
+
+/**
+ * returns the value of a hex digit, or -1 if c is not one
+ */
+static int hex_value(unsigned char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * parses the cost plane that follows the marker line, rows * cols decimal
+ * costs separated by whitespace. returns 0 on success, -1 if it is malformed
+ */
+static int parse_costs(grid_t *g, const unsigned char *p, const unsigned char *end) {
+  size_t i, cells = (size_t) g->rows * g->cols;
+  for (i = 0; i < cells; ++i) {
+    unsigned long cost = 0;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+      p++;
+    if (p == end || *p < '0' || *p > '9')
+      return -1;
+    while (p < end && *p >= '0' && *p <= '9' && cost <= MAX_COST)
+      cost = cost * 10 + (unsigned long) (*p++ - '0');
+    if (cost > MAX_COST)
+      return -1;
+    g->costs[i] = (unsigned) cost;
+  }
+  return 0;
+}
+
+int load_grid(grid_t *g, const unsigned char *data, size_t len, int with_costs) {
+  const unsigned char *p = data, *end = data + len;
+  const unsigned char *costs = NULL;
+
+  if (len >= 4 && memcmp(data, MZC_MAGIC, 4) == 0) {
+    if (mzc_decode(data, len, &g->codes, &g->codes_cap, &g->rows, &g->cols))
+      return -1;
+  } else {
+    size_t cols = line_length(p, end), rows = 0, j;
+    if (cols == 0 || cols > 0x7FFFFFFF)
+      return -1;
+    while (p < end) {
+      size_t n = line_length(p, end);
+      if (n == sizeof(COST_MARKER) - 1 && memcmp(p, COST_MARKER, n) == 0) {
+	costs = next_line(p, end);
+	break;
+      }
+      if (n == 0) { // only blank lines may follow the maze
+	p = next_line(p, end);
+	continue;
+      }
+      if (n != cols || grow((void **) &g->codes, &g->codes_cap, (rows + 1) * cols, 1))
+	return -1;
+      for (j = 0; j < cols; ++j) {
+	int code = hex_value(p[j]);
+	if (code < 0)
+	  return -1;
+	g->codes[rows * cols + j] = (unsigned char) code;
+      }
+      rows++;
+      p = next_line(p, end);
+    }
+    if (rows == 0 || rows > 0x7FFFFFFF || rows * cols > 0x7FFFFFFF)
+      return -1;
+    g->rows = (int) rows;
+    g->cols = (int) cols;
+  }
+
+  size_t cells = (size_t) g->rows * g->cols;
+  if (grow((void **) &g->visited, &g->visited_cap, cells, 1))
+    return -1;
+  if (with_costs) {
+    size_t i;
+    if (grow((void **) &g->costs, &g->costs_cap, cells, sizeof(unsigned)))
+      return -1;
+    if (costs)
+      return parse_costs(g, costs, end);
+    for (i = 0; i < cells; ++i)
+      g->costs[i] = 1;
+  }
+  return 0;
+}
+
+int parseable(char **input, int length) {
+  int i;
+  for (i = 0; i < length; ++i) {
+    if ((strcmp(input[i], "0") != 0) && !atoi(input[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void print_room(grid_t *g, int room, FILE *file) {
+  fprintf(file, "%d, %d\n", room % g->cols, room / g->cols);
+}
+
+/**
+ * depth-first search begins at start and explores adjacent, accessible rooms
+ * until goal is found. in FULL mode, prints out the entire path traversed,
+ * including backtracking; otherwise, prints the rooms that are part of the
+ * final route in reverse.
+ *
+ * the search keeps its own stack instead of recursing, so large mazes do not
+ * overflow the stack, but prints exactly what the recursive search did: a room
+ * when it is entered (FULL) and again each time a search from one of its
+ * neighbors comes back empty-handed (FULL), and the route once the goal is
+ * found (PRUNED). visited holds 0 for unvisited rooms and otherwise one more
+ * than the next direction to try from the room
+ */
+static int dfs(grid_t *g, int start, int goal, int full, FILE *file) {
+  if (grow((void **) &g->stack, &g->stack_cap, (size_t) g->rows * g->cols, sizeof(int)))
+    return -1;
+  memset(g->visited, 0, (size_t) g->rows * g->cols);
+
+  int top = 0, room = start;
+  for (;;) {
+    // enter room
+    if (room == goal) {
+      print_room(g, room, file);
+      while (!full && top > 0)
+	print_room(g, g->stack[--top], file);
+      return 0;
+    }
+    if (full)
+      print_room(g, room, file);
+    g->visited[room] = 1;
+    g->stack[top++] = room;
+
+    // find the next unvisited neighbor behind a door, backtracking from
+    // rooms that have none left
+    int next = -1;
+    while (next < 0 && top > 0) {
+      room = g->stack[top - 1];
+      int x = room % g->cols, y = room / g->cols;
+      int dir = g->visited[room] - 1;
+      for (; dir < 4 && next < 0; ++dir) {
+	int neighbor_x = x + calculate_offset(dir, 'x');
+	int neighbor_y = y + calculate_offset(dir, 'y');
+	int neighbor = neighbor_y * g->cols + neighbor_x;
+	if (!(g->codes[room] & direction_codes[dir])
+	    && !out_of_bounds(neighbor_x, neighbor_y, g->rows, g->cols) && !g->visited[neighbor])
+	  next = neighbor;
+      }
+      g->visited[room] = (unsigned char) (dir + 1);
+      if (next < 0) { // dead end, return to the previous room
+	top--;
+	if (full && top > 0)
+	  print_room(g, g->stack[top - 1], file);
+      }
+    }
+    if (next < 0)
+      return 0;
+    room = next;
+  }
+}
+
+/**
+ * finds the cheapest route from start to goal with dijkstra(), where entering
+ * a room costs the value in its cost plane. prints the cost of the route after
+ * the WEIGHTED header, followed by the rooms of the route in reverse like the
+ * pruned depth-first search
+ */
+static int solve_weighted(grid_t *g, int start, int goal, FILE *file) {
+  size_t cells = (size_t) g->rows * g->cols;
+  if (grow((void **) &g->prev, &g->prev_cap, cells, sizeof(int))
+      || grow((void **) &g->dist, &g->dist_cap, cells, sizeof(uint64_t)))
+    return -1;
+  int64_t cost = dijkstra(g->codes, g->costs, g->rows, g->cols, start, goal, g->prev,
+			  g->dist, &g->buckets);
+  if (cost < 0) {
+    fprintf(file, "WEIGHTED\n");
+    return 0;
+  }
+  fprintf(file, "WEIGHTED %lld\n", (long long) cost);
+  int room;
+  for (room = goal; room >= 0; room = g->prev[room])
+    print_room(g, room, file);
+  return 0;
+}
+
+int solve(grid_t *g, enum Mode mode, int x, int y, int goal_x, int goal_y, FILE *file) {
+  int start = y * g->cols + x, goal = goal_y * g->cols + goal_x;
+  switch (mode) {
+  case MODE_WEIGHTED:
+    return solve_weighted(g, start, goal, file);
+  case MODE_FULL:
+    fprintf(file, "FULL\n");
+    return dfs(g, start, goal, 1, file);
+  default:
+    fprintf(file, "PRUNED\n");
+    return dfs(g, start, goal, 0, file);
+  }
+}
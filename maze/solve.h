@@ -0,0 +1,73 @@
+#ifndef SOLVE_H
+#define SOLVE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "dijkstra.h"
+
+/**
+ * what a solve prints after its PRUNED, FULL or WEIGHTED header line
+ * MODE_PRUNED - the rooms of the route found by depth-first search, in reverse
+ * MODE_FULL - every room the depth-first search passes through, including backtracking
+ * MODE_WEIGHTED - the cheapest route through the cost plane, in reverse
+ */
+enum Mode {MODE_PRUNED, MODE_FULL, MODE_WEIGHTED};
+
+/**
+ * a maze loaded for solving. the buffers only ever grow, so a grid can be
+ * reused for any number of mazes without allocating again
+ * codes - the wall code of each room in row-major order
+ * costs - the cost of entering each room, only loaded for weighted solves
+ * stack - rooms on the current path of the depth-first search
+ * dist, buckets - scratch space of dijkstra() for weighted solves
+ */
+typedef struct {
+  int rows;
+  int cols;
+  unsigned char *codes;
+  unsigned char *visited;
+  unsigned *costs;
+  int *stack;
+  int *prev;
+  uint64_t *dist;
+  buckets_t buckets;
+  size_t codes_cap;
+  size_t visited_cap;
+  size_t costs_cap;
+  size_t stack_cap;
+  size_t prev_cap;
+  size_t dist_cap;
+} grid_t;
+
+void init_grid(grid_t *g);
+void cleanup_grid(grid_t *g);
+
+/**
+ * reads the rest of file into *data, a malloced buffer of capacity *cap (may
+ * be NULL and 0) that is grown as needed, and sets *len to the number of bytes
+ * returns 0 on success, -1 on failure
+ */
+int read_file(FILE *file, unsigned char **data, size_t *len, size_t *cap);
+
+/**
+ * loads the maze held in the len bytes at data, either hex text (with an
+ * optional cost plane, loaded if with_costs is set) or the compressed container
+ * returns 0 on success, -1 if the data is not a valid maze
+ */
+int load_grid(grid_t *g, const unsigned char *data, size_t len, int with_costs);
+
+/**
+ * given an a pointer to a string in an array and the length of the
+ * array, determines if the strings in the array are integers
+ */
+int parseable(char **input, int length);
+
+/**
+ * writes the header line for mode followed by the solution from (x, y) to
+ * (goal_x, goal_y), which must be in bounds
+ * returns 0 on success, -1 on allocation failure
+ */
+int solve(grid_t *g, enum Mode mode, int x, int y, int goal_x, int goal_y, FILE *file);
+
+#endif /* SOLVE_H */
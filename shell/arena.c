@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// size of the first chunk, enough for most command lines
+#define MIN_CHUNK 4096
+
+struct arena_chunk {
+  arena_chunk_t *next;
+  size_t size;
+  size_t used;
+  void *data[];  // void * so that the data is aligned for any pointer
+};
+
+/* initializes an empty arena */
+void init_arena(arena_t *arena) {
+  arena->chunks = NULL;
+  arena->total = 0;
+}
+
+/* frees every chunk of the arena */
+void cleanup_arena(arena_t *arena) {
+  while (arena->chunks != NULL) {
+    arena_chunk_t *next = arena->chunks->next;
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+  arena->total = 0;
+}
+
+/* adds a chunk of at least size bytes in front of the others, returns 0 on success, -1 on failure */
+static int add_chunk(arena_t *arena, size_t size) {
+  if (size < MIN_CHUNK)
+    size = MIN_CHUNK;
+  if (size < arena->total)
+    size = arena->total; // double the arena each time it runs out
+  arena_chunk_t *chunk = (arena_chunk_t *) malloc(sizeof(arena_chunk_t) + size);
+  if (chunk == NULL)
+    return -1;
+  chunk->next = arena->chunks;
+  chunk->size = size;
+  chunk->used = 0;
+  arena->chunks = chunk;
+  arena->total += size;
+  return 0;
+}
+
+/* returns size bytes from the arena, suitably aligned for any pointer, or NULL on failure */
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  arena_chunk_t *chunk = arena->chunks;
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    if (add_chunk(arena, size) < 0)
+      return NULL;
+    chunk = arena->chunks;
+  }
+  void *ptr = (char *) chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+/* copies the len bytes at str into the arena as a null-terminated string, returns NULL on failure */
+char *arena_strndup(arena_t *arena, const char *str, size_t len) {
+  char *copy = (char *) arena_alloc(arena, len + 1);
+  if (copy != NULL) {
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+/*
+ * releases everything allocated from the arena
+ * if the line needed more than one chunk they are replaced by a single chunk of their
+ * combined size, so the arena settles on one chunk big enough for the longest line
+ */
+void reset_arena(arena_t *arena) {
+  if (arena->chunks != NULL && arena->chunks->next != NULL) {
+    size_t total = arena->total;
+    cleanup_arena(arena);
+    add_chunk(arena, total);
+  }
+  if (arena->chunks != NULL)
+    arena->chunks->used = 0;
+}
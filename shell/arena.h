@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena_chunk arena_chunk_t;
+
+/*
+ * arena of memory for the things that only live as long as one command line
+ * everything is released at once by reset_arena, which keeps the memory for the next
+ * line, so that lines that fit in what earlier lines needed do not allocate at all
+ */
+typedef struct {
+  arena_chunk_t *chunks;  // the chunk being allocated from is first
+  size_t total;           // combined size of the chunks
+} arena_t;
+
+/* initializes an empty arena */
+void init_arena(arena_t *arena);
+/* frees every chunk of the arena */
+void cleanup_arena(arena_t *arena);
+
+/* returns size bytes from the arena, suitably aligned for any pointer, or NULL on failure */
+void *arena_alloc(arena_t *arena, size_t size);
+/* copies the len bytes at str into the arena as a null-terminated string, returns NULL on failure */
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/*
+ * releases everything allocated from the arena
+ * if the line needed more than one chunk they are replaced by a single chunk of their
+ * combined size, so the arena settles on one chunk big enough for the longest line
+ */
+void reset_arena(arena_t *arena);
+
+#endif
@@ -0,0 +1,330 @@
+/*
+ * shbench drives the noprompt build of the shell with generated workloads and prints one JSON
+ * object per line for each measurement, so that runs can be compared by a script
+ *
+ * usage: shbench [-n <iterations>] [-j <background jobs>] <shell>
+ *
+ * every latency is measured by writing a command line followed by echo @@ and timing how long the
+ * shell takes to print @@, which it only reads once the command before it is done
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MARKER "@@\n"
+// milliseconds to wait for the shell before giving up
+#define TIMEOUT 30000
+
+/* a shell being driven, and the output it has printed that has not been looked at yet */
+typedef struct {
+  pid_t pid;
+  int in;
+  int out;
+  char buf[8192];
+  size_t len;
+} shell_t;
+
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+/* starts the shell at path with pipes to its standard input and output, or with a pseudo-terminal
+ * as its controlling terminal if tty is set, so that it hands the terminal over to every
+ * foreground job with reassign_tc(). returns 0 on success, -1 on failure */
+static int start_shell(shell_t *shell, const char *path, int tty) {
+  int to_shell[2], from_shell[2], master = -1;
+  char *slave_name = NULL;
+  if (tty) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || (slave_name = ptsname(master)) == NULL) {
+      perror("shbench: pty");
+      return -1;
+    }
+  } else if (pipe(to_shell) < 0 || pipe(from_shell) < 0) {
+    perror("shbench: pipe");
+    return -1;
+  }
+
+  shell->pid = fork();
+  if (shell->pid < 0) {
+    perror("shbench: fork");
+    return -1;
+  }
+  if (shell->pid == 0) {
+    if (tty) {
+      // a new session whose controlling terminal is the slave, in raw mode so that nothing
+      // typed is echoed and the output comes back as it was written
+      setsid();
+      int slave = open(slave_name, O_RDWR);
+      if (slave < 0)
+	_exit(127);
+      struct termios attr;
+      tcgetattr(slave, &attr);
+      cfmakeraw(&attr);
+      tcsetattr(slave, TCSANOW, &attr);
+      dup2(slave, STDIN_FILENO);
+      dup2(slave, STDOUT_FILENO);
+      close(slave);
+      close(master);
+    } else {
+      dup2(to_shell[0], STDIN_FILENO);
+      dup2(from_shell[1], STDOUT_FILENO);
+      close(to_shell[0]);
+      close(to_shell[1]);
+      close(from_shell[0]);
+      close(from_shell[1]);
+    }
+    execl(path, path, (char *) NULL);
+    perror(path);
+    _exit(127);
+  }
+
+  if (tty) {
+    shell->in = master;
+    shell->out = master;
+  } else {
+    close(to_shell[0]);
+    close(from_shell[1]);
+    shell->in = to_shell[1];
+    shell->out = from_shell[0];
+  }
+  shell->len = 0;
+  return 0;
+}
+
+static int send(shell_t *shell, const char *text) {
+  size_t len = strlen(text);
+  while (len > 0) {
+    ssize_t n = write(shell->in, text, len);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      perror("shbench: write");
+      return -1;
+    }
+    text += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+/* waits until the shell prints the marker and drops everything up to it, returns 0 on success,
+ * -1 if the shell exited or did not print it in time */
+static int wait_marker(shell_t *shell) {
+  size_t marker_len = strlen(MARKER);
+  for (;;) {
+    char *found = shell->len >= marker_len ? (char *) memmem(shell->buf, shell->len, MARKER, marker_len) : NULL;
+    if (found != NULL) {
+      size_t used = (size_t) (found - shell->buf) + marker_len;
+      memmove(shell->buf, shell->buf + used, shell->len - used);
+      shell->len -= used;
+      return 0;
+    }
+    // keep the end of the output, which may be the start of the marker
+    if (shell->len == sizeof(shell->buf)) {
+      memmove(shell->buf, shell->buf + shell->len - marker_len, marker_len);
+      shell->len = marker_len;
+    }
+
+    struct pollfd pfd = {shell->out, POLLIN, 0};
+    int ready = poll(&pfd, 1, TIMEOUT);
+    if (ready <= 0) {
+      fprintf(stderr, "shbench: the shell did not answer\n");
+      return -1;
+    }
+    ssize_t n = read(shell->out, shell->buf + shell->len, sizeof(shell->buf) - shell->len);
+    if (n <= 0) {
+      fprintf(stderr, "shbench: the shell exited\n");
+      return -1;
+    }
+    shell->len += (size_t) n;
+  }
+}
+
+/* sends command followed by the marker and returns the microseconds until the marker came back,
+ * or a negative number on failure */
+static double round_trip(shell_t *shell, const char *command) {
+  char line[256];
+  snprintf(line, sizeof(line), "%s\necho %s", command, MARKER);
+  double start = now_us();
+  if (send(shell, line) < 0 || wait_marker(shell) < 0)
+    return -1;
+  return now_us() - start;
+}
+
+/* tells the shell to exit and waits for it, returns the microseconds it took */
+static double stop_shell(shell_t *shell) {
+  double start = now_us();
+  send(shell, "exit\n");
+  if (shell->in != shell->out)
+    close(shell->in);
+  waitpid(shell->pid, NULL, 0);
+  double elapsed = now_us() - start;
+  close(shell->out);
+  return elapsed;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* prints the percentiles of the n samples of the named measurement */
+static void report_latency(const char *name, double *samples, size_t n) {
+  if (n == 0)
+    return;
+  size_t i;
+  double sum = 0;
+  qsort(samples, n, sizeof(double), compare_doubles);
+  for (i = 0; i < n; i++)
+    sum += samples[i];
+  printf("{\"bench\": \"%s\", \"unit\": \"us\", \"n\": %lu, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+	 "\"p99\": %.1f, \"max\": %.1f}\n", name, (unsigned long) n, sum / (double) n, samples[n / 2],
+	 samples[n * 90 / 100], samples[n * 99 / 100], samples[n - 1]);
+  fflush(stdout);
+}
+
+static void report_value(const char *name, const char *unit, size_t n, double value) {
+  printf("{\"bench\": \"%s\", \"unit\": \"%s\", \"n\": %lu, \"value\": %.1f}\n", name, unit, (unsigned long) n, value);
+  fflush(stdout);
+}
+
+/* measures the round trip of command n times in a new shell, returns 0 on success, -1 on failure */
+static int bench_latency(const char *name, const char *shell_path, int tty, const char *command, size_t n, double *samples) {
+  shell_t shell;
+  size_t i;
+  if (start_shell(&shell, shell_path, tty) < 0)
+    return -1;
+  round_trip(&shell, "true"); // the shell has started once it answers
+  for (i = 0; i < n; i++) {
+    if ((samples[i] = round_trip(&shell, command)) < 0) {
+      stop_shell(&shell);
+      return -1;
+    }
+  }
+  stop_shell(&shell);
+  report_latency(name, samples, n);
+  return 0;
+}
+
+/* sends n copies of command at once and reports how many the shell ran per second */
+static int bench_throughput(const char *name, const char *shell_path, const char *command, size_t n) {
+  shell_t shell;
+  size_t i, len = strlen(command) + 1;
+  char *script = (char *) malloc(n * len + strlen(MARKER) + 6);
+  if (script == NULL || start_shell(&shell, shell_path, 0) < 0) {
+    free(script);
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    memcpy(script + i * len, command, len - 1);
+    script[i * len + len - 1] = '\n';
+  }
+  sprintf(script + n * len, "echo %s", MARKER);
+  round_trip(&shell, "true");
+
+  // the script is written by a child so that the shell's output cannot fill up while the script
+  // is still being written
+  double start = now_us();
+  pid_t writer = fork();
+  if (writer == 0) {
+    send(&shell, script);
+    _exit(0);
+  }
+  int error = wait_marker(&shell);
+  double elapsed = now_us() - start;
+  waitpid(writer, NULL, 0);
+  stop_shell(&shell);
+  free(script);
+  if (error)
+    return -1;
+  report_value(name, "cmd/s", n, (double) n / (elapsed / 1e6));
+  return 0;
+}
+
+/* starts num_jobs background jobs, timing each launch, then times listing them, looking them up by
+ * job id, and the exit of the shell, which kills them all */
+static int bench_jobs(const char *shell_path, size_t num_jobs, size_t n, double *samples) {
+  shell_t shell;
+  size_t i;
+  if (start_shell(&shell, shell_path, 0) < 0)
+    return -1;
+  round_trip(&shell, "true");
+
+  for (i = 0; i < num_jobs; i++) {
+    if ((samples[i] = round_trip(&shell, "/bin/sleep 300 &")) < 0)
+      goto fail;
+  }
+  report_latency("bg_launch", samples, num_jobs);
+
+  for (i = 0; i < n; i++) {
+    if ((samples[i] = round_trip(&shell, "jobs > /dev/null")) < 0)
+      goto fail;
+  }
+  report_latency("jobs_list", samples, n);
+
+  char command[32];
+  srand(1);
+  for (i = 0; i < n; i++) {
+    sprintf(command, "bg %%%lu", (unsigned long) (rand() % (int) num_jobs) + 1);
+    if ((samples[i] = round_trip(&shell, command)) < 0)
+      goto fail;
+  }
+  report_latency("job_lookup", samples, n);
+
+  report_value("exit_with_jobs", "us", num_jobs, stop_shell(&shell));
+  return 0;
+
+fail:
+  kill(shell.pid, SIGKILL);
+  stop_shell(&shell);
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  size_t n = 1000, num_jobs = 1000;
+  const char *shell_path = NULL;
+  int i, usage = 0;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      n = (size_t) atol(argv[++i]);
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      num_jobs = (size_t) atol(argv[++i]);
+    else if (shell_path == NULL)
+      shell_path = argv[i];
+    else
+      usage = 1;
+  }
+  if (usage || shell_path == NULL || n == 0 || num_jobs == 0) {
+    fprintf(stderr, "usage: shbench [-n <iterations>] [-j <background jobs>] <shell>\n");
+    return EXIT_FAILURE;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  // the command lines sent to the shell must not end up in the user's history
+  setenv("HISTFILE", "/dev/null", 1);
+
+  double *samples = (double *) malloc((n > num_jobs ? n : num_jobs) * sizeof(double));
+  if (samples == NULL)
+    return EXIT_FAILURE;
+  int error = 0;
+  error |= bench_latency("launch_exit", shell_path, 0, "/bin/true", n, samples);
+  error |= bench_latency("builtin", shell_path, 0, "true", n, samples);
+  error |= bench_latency("fg_handoff_tty", shell_path, 1, "/bin/true", n, samples);
+  error |= bench_latency("pipeline", shell_path, 0, "/bin/true | /bin/true", n, samples);
+  error |= bench_throughput("throughput_extern", shell_path, "/bin/true", n);
+  error |= bench_throughput("throughput_builtin", shell_path, "true", n * 10);
+  error |= bench_jobs(shell_path, num_jobs, n, samples);
+  free(samples);
+  return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "history.h"
+
+// number of entries newer than the index that are searched one by one before they are added to it
+#define INDEX_TAIL 1024
+
+/* an entry of the history, a line of the file without its newline */
+struct history_entry {
+  size_t offset;
+  size_t len;
+};
+
+// the history file is only ever appended to, by this shell and by any other shell using it, and is
+// mapped into memory to be read. entries holds every line of the first scanned bytes of the file, in
+// the order they were added. sorted holds the numbers of the first indexed entries sorted by text
+// and, for the same text, newest first, and tree is a segment tree over sorted that gives the newest
+// entry in any range of it. the entries after the first indexed ones are searched one by one
+// output is the buffer the history commands format their output into
+struct history {
+  int fd;
+  char *map;
+  size_t mapped;
+  size_t scanned;
+  struct history_entry *entries;
+  size_t count;
+  size_t cap;
+  size_t *sorted;
+  size_t *tree;
+  size_t indexed;
+  char *output;
+  size_t output_cap;
+};
+
+/* opens the history file at path, creating it if it does not exist, returns pointer or NULL
+ * on failure. the file is only read when the history is first searched
+ */
+history_t *init_history(const char *path) {
+  history_t *history = (history_t *) calloc(1, sizeof(history_t));
+  if (history == NULL)
+    return NULL;
+  history->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (history->fd < 0) {
+    free(history);
+    return NULL;
+  }
+  return history;
+}
+
+/*
+ * closes the history file and cleans up the history
+ * Note: this function will free the history pointer
+ */
+void cleanup_history(history_t *history) {
+  if (history == NULL)
+    return;
+  if (history->map != NULL)
+    munmap(history->map, history->mapped);
+  close(history->fd);
+  free(history->entries);
+  free(history->sorted);
+  free(history->tree);
+  free(history->output);
+  free(history);
+}
+
+/* forgets every entry, for a history file that has been truncated */
+static void reset_history(history_t *history) {
+  if (history->map != NULL)
+    munmap(history->map, history->mapped);
+  history->map = NULL;
+  history->mapped = 0;
+  history->scanned = 0;
+  history->count = 0;
+  history->indexed = 0;
+}
+
+/* maps whatever has been appended to the history file since it was last looked at and adds the
+ * complete lines in it to the entries, returns 0 on success, -1 on failure */
+static int refresh(history_t *history) {
+  struct stat st;
+  if (fstat(history->fd, &st) < 0)
+    return -1;
+  size_t size = (size_t) st.st_size;
+  if (size < history->scanned)
+    reset_history(history);
+  if (size == history->mapped)
+    return 0;
+
+  char *map;
+  if (history->map == NULL)
+    map = (char *) mmap(NULL, size, PROT_READ, MAP_SHARED, history->fd, 0);
+  else
+    map = (char *) mremap(history->map, history->mapped, size, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED)
+    return -1;
+  history->map = map;
+  history->mapped = size;
+
+  // a line that another shell is still writing is left for later
+  char *line = map + history->scanned, *end = map + size, *newline;
+  while (line < end && (newline = (char *) memchr(line, '\n', (size_t) (end - line))) != NULL) {
+    if (history->count == history->cap) {
+      size_t cap = history->cap ? history->cap * 2 : 1024;
+      struct history_entry *entries = (struct history_entry *) realloc(history->entries, cap * sizeof(struct history_entry));
+      if (entries == NULL)
+	return -1;
+      history->entries = entries;
+      history->cap = cap;
+    }
+    history->entries[history->count].offset = (size_t) (line - map);
+    history->entries[history->count].len = (size_t) (newline - line);
+    history->count++;
+    line = newline + 1;
+  }
+  history->scanned = (size_t) (line - map);
+  return 0;
+}
+
+/* compares the text of entries a and b, and their numbers (the newest first) if it is the same */
+static int compare_entries(history_t *history, size_t a, size_t b) {
+  struct history_entry *x = &history->entries[a], *y = &history->entries[b];
+  int cmp = memcmp(history->map + x->offset, history->map + y->offset, x->len < y->len ? x->len : y->len);
+  if (cmp != 0)
+    return cmp;
+  if (x->len != y->len)
+    return x->len < y->len ? -1 : 1;
+  return a > b ? -1 : a < b;
+}
+
+/* an entry being sorted, with its first 8 bytes as a number that sorts the same way as the text,
+ * so that most comparisons do not have to look at the text itself */
+struct sort_key {
+  uint64_t key;
+  size_t entry;
+};
+
+// qsort() cannot pass the history to the comparison function
+static history_t *sorting;
+
+/* sorts the n keys by their number, one byte at a time starting with the last (a radix sort), which
+ * takes linear time however many entries there are, using tmp as a second array of n keys. The
+ * entries that have the same number are left in the order they were in */
+static void radix_sort(struct sort_key *keys, struct sort_key *tmp, size_t n) {
+  int shift;
+  size_t i;
+  for (shift = 0; shift < 64; shift += 8) {
+    size_t counts[256] = {0};
+    for (i = 0; i < n; i++)
+      counts[(keys[i].key >> shift) & 0xff]++;
+    if (counts[(keys[0].key >> shift) & 0xff] == n)
+      continue; // every key has the same byte here
+    size_t total = 0, b;
+    for (b = 0; b < 256; b++) {
+      size_t count = counts[b];
+      counts[b] = total;
+      total += count;
+    }
+    for (i = 0; i < n; i++)
+      tmp[counts[(keys[i].key >> shift) & 0xff]++] = keys[i];
+    memcpy(keys, tmp, n * sizeof(struct sort_key));
+  }
+}
+
+static int compare_keys(const void *a, const void *b) {
+  const struct sort_key *x = (const struct sort_key *) a, *y = (const struct sort_key *) b;
+  if (x->key != y->key)
+    return x->key < y->key ? -1 : 1;
+  return compare_entries(sorting, x->entry, y->entry);
+}
+
+/* compares the start of the text of entry with prefix: 0 if the entry starts with prefix, or else
+ * whether the entry sorts before or after every entry that does */
+static int compare_prefix(history_t *history, size_t entry, const char *prefix, size_t prefix_len) {
+  struct history_entry *e = &history->entries[entry];
+  int cmp = memcmp(history->map + e->offset, prefix, e->len < prefix_len ? e->len : prefix_len);
+  if (cmp != 0)
+    return cmp;
+  return e->len < prefix_len ? -1 : 0;
+}
+
+/* adds the entries after the indexed ones to the index: they are sorted on their own and merged
+ * with the sorted entries, and the tree is built again. returns 0 on success, -1 on failure */
+static int update_index(history_t *history) {
+  size_t n = history->count, old = history->indexed, tail = n - old, i, j, k;
+  size_t *sorted = (size_t *) malloc(n * sizeof(size_t));
+  size_t *tree = (size_t *) malloc(2 * n * sizeof(size_t));
+  struct sort_key *keys = (struct sort_key *) malloc(2 * tail * sizeof(struct sort_key));
+  if (sorted == NULL || tree == NULL || keys == NULL) {
+    free(sorted);
+    free(tree);
+    free(keys);
+    return -1;
+  }
+  // the new entries are sorted at the end of the new array and then merged in front of it
+  for (i = 0; i < tail; i++) {
+    struct history_entry *entry = &history->entries[old + i];
+    const unsigned char *text = (const unsigned char *) history->map + entry->offset;
+    uint64_t key = 0;
+    for (j = 0; j < 8; j++)
+      key = key << 8 | (j < entry->len ? text[j] : 0);
+    keys[i].key = key;
+    keys[i].entry = old + i;
+  }
+  // only the entries whose first 8 bytes are the same have to be compared as text
+  radix_sort(keys, keys + tail, tail);
+  sorting = history;
+  for (i = 0; i < tail; i = j) {
+    for (j = i + 1; j < tail && keys[j].key == keys[i].key; j++)
+      ;
+    if (j - i > 1)
+      qsort(keys + i, j - i, sizeof(struct sort_key), compare_keys);
+  }
+  for (i = 0; i < tail; i++)
+    sorted[old + i] = keys[i].entry;
+  free(keys);
+  for (i = 0, j = old, k = 0; k < n; k++) {
+    if (j == n || (i < old && compare_entries(history, history->sorted[i], sorted[j]) < 0))
+      sorted[k] = history->sorted[i++];
+    else
+      sorted[k] = sorted[j++];
+  }
+
+  // leaf k of the tree is tree[n + k], and node i is the newest of its children
+  for (k = 0; k < n; k++)
+    tree[n + k] = sorted[k];
+  for (k = n - 1; k > 0; k--)
+    tree[k] = tree[2 * k] > tree[2 * k + 1] ? tree[2 * k] : tree[2 * k + 1];
+
+  free(history->sorted);
+  free(history->tree);
+  history->sorted = sorted;
+  history->tree = tree;
+  history->indexed = n;
+  return 0;
+}
+
+/* finds the range [*lo, *hi) of the sorted entries that start with prefix */
+static void find_range(history_t *history, const char *prefix, size_t prefix_len, size_t *lo, size_t *hi) {
+  size_t l = 0, h = history->indexed;
+  while (l < h) {
+    size_t mid = l + (h - l) / 2;
+    if (compare_prefix(history, history->sorted[mid], prefix, prefix_len) < 0)
+      l = mid + 1;
+    else
+      h = mid;
+  }
+  *lo = l;
+  h = history->indexed;
+  while (l < h) {
+    size_t mid = l + (h - l) / 2;
+    if (compare_prefix(history, history->sorted[mid], prefix, prefix_len) <= 0)
+      l = mid + 1;
+    else
+      h = mid;
+  }
+  *hi = l;
+}
+
+/* brings the history up to date with the file and indexes the entries that are not yet indexed
+ * if there are too many of them to search one by one, returns 0 on success, -1 on failure */
+static int prepare(history_t *history) {
+  if (refresh(history))
+    return -1;
+  if (history->count - history->indexed > INDEX_TAIL && update_index(history))
+    return -1;
+  return 0;
+}
+
+/*
+ * gets entry n of the history, counting from 1 for the oldest, or the newest if n is 0
+ * returns the entry, which is not null-terminated and stays valid until the next call, and sets
+ * len to its length, or returns NULL if there is no such entry
+ */
+const char *get_history(history_t *history, size_t n, size_t *len) {
+  if (refresh(history) || history->count == 0 || n > history->count)
+    return NULL;
+  struct history_entry *entry = &history->entries[n == 0 ? history->count - 1 : n - 1];
+  *len = entry->len;
+  return history->map + entry->offset;
+}
+
+/*
+ * finds the newest entry of the history that starts with the prefix of prefix_len bytes
+ * the entries that are not indexed yet are the newest, so they are searched first, and otherwise
+ * the entries that start with prefix are a range of the sorted entries, of which the tree gives
+ * the newest in logarithmic time, however many entries there are
+ * returns the entry, which is not null-terminated and stays valid until the next call, and sets
+ * len to its length, or returns NULL if there is none
+ */
+const char *search_history(history_t *history, const char *prefix, size_t prefix_len, size_t *len) {
+  if (prepare(history))
+    return NULL;
+  size_t i, found = history->count;
+  for (i = history->count; i > history->indexed; i--) {
+    if (compare_prefix(history, i - 1, prefix, prefix_len) == 0) {
+      found = i - 1;
+      break;
+    }
+  }
+
+  if (found == history->count) {
+    size_t lo, hi, n = history->indexed;
+    find_range(history, prefix, prefix_len, &lo, &hi);
+    if (lo == hi)
+      return NULL;
+    found = 0;
+    for (lo += n, hi += n; lo < hi; lo /= 2, hi /= 2) {
+      if (lo & 1) {
+	if (history->tree[lo] > found)
+	  found = history->tree[lo];
+	lo++;
+      }
+      if (hi & 1) {
+	hi--;
+	if (history->tree[hi] > found)
+	  found = history->tree[hi];
+      }
+    }
+  }
+  *len = history->entries[found].len;
+  return history->map + history->entries[found].offset;
+}
+
+/* makes room for len more bytes after the first used bytes of the output buffer, returns 0 on
+ * success, -1 on failure */
+static int reserve_output(history_t *history, size_t used, size_t len) {
+  if (history->output_cap >= used + len)
+    return 0;
+  size_t cap = history->output_cap * 2 > used + len ? history->output_cap * 2 : used + len;
+  char *output = (char *) realloc(history->output, cap);
+  if (output == NULL)
+    return -1;
+  history->output = output;
+  history->output_cap = cap;
+  return 0;
+}
+
+/* formats entry n as a line of output after the first used bytes of the output buffer, returns the
+ * new number of bytes used, which is the same on failure */
+static size_t format_entry(history_t *history, size_t used, size_t n) {
+  struct history_entry *entry = &history->entries[n];
+  if (reserve_output(history, used, entry->len + 24))
+    return used;
+  used += (size_t) sprintf(history->output + used, "%5lu  ", (unsigned long) n + 1);
+  memcpy(history->output + used, history->map + entry->offset, entry->len);
+  used += entry->len;
+  history->output[used++] = '\n';
+  return used;
+}
+
+/* appends the command line of len bytes to the history file with a single write(), returns 0 on
+ * success, -1 on failure */
+int add_history(history_t *history, const char *line, size_t len) {
+  // a single write() to a file opened with O_APPEND is not interleaved with the lines that other
+  // shells append at the same time
+  if (reserve_output(history, 0, len + 1))
+    return -1;
+  memcpy(history->output, line, len);
+  history->output[len] = '\n';
+  ssize_t n;
+  do {
+    n = write(history->fd, history->output, len + 1);
+  } while (n < 0 && errno == EINTR);
+  return n == (ssize_t) len + 1 ? 0 : -1;
+}
+
+static void write_output(history_t *history, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t n = write(STDOUT_FILENO, history->output + written, len - written);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      return;
+    }
+    written += (size_t) n;
+  }
+}
+
+/* history command, prints out the last count entries (all of them if count is 0) with their
+ * numbers */
+void print_history(history_t *history, size_t count) {
+  if (refresh(history))
+    return;
+  size_t first = count == 0 || count > history->count ? 0 : history->count - count, i, len = 0;
+  for (i = first; i < history->count; i++)
+    len = format_entry(history, len, i);
+  write_output(history, len);
+}
+
+/* whether entry n has the same text as any of the count entries in shown */
+static int already_shown(history_t *history, size_t n, size_t *shown, size_t count) {
+  size_t i;
+  struct history_entry *entry = &history->entries[n];
+  for (i = 0; i < count; i++) {
+    struct history_entry *other = &history->entries[shown[i]];
+    if (other->len == entry->len && memcmp(history->map + other->offset, history->map + entry->offset, entry->len) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static int compare_newest(const void *a, const void *b) {
+  size_t x = *(const size_t *) a, y = *(const size_t *) b;
+  return x > y ? -1 : x < y;
+}
+
+/* history -r command, prints out up to count different entries that start with prefix, the
+ * newest first */
+void print_history_matches(history_t *history, const char *prefix, size_t prefix_len, size_t count) {
+  if (prepare(history) || count == 0)
+    return;
+
+  // the newest entry of each text that starts with prefix is the first of its run in the sorted
+  // entries, and the entries that are not indexed yet are candidates too
+  size_t lo, hi, i, num_candidates = 0;
+  find_range(history, prefix, prefix_len, &lo, &hi);
+  size_t *candidates = (size_t *) malloc((hi - lo + history->count - history->indexed + 1) * sizeof(size_t));
+  size_t *shown = (size_t *) malloc(count * sizeof(size_t));
+  if (candidates == NULL || shown == NULL) {
+    free(candidates);
+    free(shown);
+    return;
+  }
+  for (i = lo; i < hi; i++) {
+    struct history_entry *entry = &history->entries[history->sorted[i]];
+    struct history_entry *prev = i > lo ? &history->entries[history->sorted[i - 1]] : NULL;
+    if (prev == NULL || prev->len != entry->len || memcmp(history->map + prev->offset, history->map + entry->offset, entry->len) != 0)
+      candidates[num_candidates++] = history->sorted[i];
+  }
+  for (i = history->indexed; i < history->count; i++) {
+    if (compare_prefix(history, i, prefix, prefix_len) == 0)
+      candidates[num_candidates++] = i;
+  }
+  qsort(candidates, num_candidates, sizeof(size_t), compare_newest);
+
+  size_t num_shown = 0, len = 0;
+  for (i = 0; i < num_candidates && num_shown < count; i++) {
+    if (!already_shown(history, candidates[i], shown, num_shown)) {
+      shown[num_shown++] = candidates[i];
+      len = format_entry(history, len, candidates[i]);
+    }
+  }
+  write_output(history, len);
+  free(candidates);
+  free(shown);
+}
@@ -0,0 +1,44 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+typedef struct history history_t;
+
+/*
+ * opens the history file at path, creating it if it does not exist, returns pointer or NULL
+ * on failure. the file is only read when the history is first searched
+ */
+history_t *init_history(const char *path);
+/*
+ * closes the history file and cleans up the history
+ * Note: this function will free the history pointer
+ */
+void cleanup_history(history_t *history);
+
+/* appends the command line of len bytes to the history file with a single write(), returns 0 on
+ * success, -1 on failure */
+int add_history(history_t *history, const char *line, size_t len);
+
+/*
+ * gets entry n of the history, counting from 1 for the oldest, or the newest if n is 0
+ * returns the entry, which is not null-terminated and stays valid until the next call, and sets
+ * len to its length, or returns NULL if there is no such entry
+ */
+const char *get_history(history_t *history, size_t n, size_t *len);
+
+/*
+ * finds the newest entry of the history that starts with the prefix of prefix_len bytes
+ * returns the entry, which is not null-terminated and stays valid until the next call, and sets
+ * len to its length, or returns NULL if there is none
+ */
+const char *search_history(history_t *history, const char *prefix, size_t prefix_len, size_t *len);
+
+/* history command, prints out the last count entries (all of them if count is 0) with their
+ * numbers */
+void print_history(history_t *history, size_t count);
+/* history -r command, prints out up to count different entries that start with prefix, the
+ * newest first */
+void print_history_matches(history_t *history, const char *prefix, size_t prefix_len, size_t count);
+
+#endif
@@ -1,34 +1,277 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "jobs.h"
 
+//number of buckets in each hash table when the list is created
+#define INITIAL_BUCKETS 64
+//number of job records allocated at once when the pool runs dry
+#define POOL_CHUNK 64
+
 struct job_element {
 	int jid;
 	pid_t pid;
 	process_state_t state;
 	char *command;
+	size_t commandCap;
+	//neighbors in the list, in the order the jobs were added
 	struct job_element *next;
+	struct job_element *prev;
+	//next job in the same bucket of the pid and jid hash tables
+	struct job_element *nextPid;
+	struct job_element *nextJid;
+	//processes of the job that have not exited yet, and how many there are
+	struct job_process *processList;
+	int processes;
+	//resources used by the processes that have exited
+	job_usage_t usage;
 };
 typedef struct job_element job_element_t;
 
-//head is the head of the list
+//one process of a job. every job has at least its leader, whose pid is the pid of the
+//job and its process group, and the other stages of a pipeline are added to it
+struct job_process {
+	pid_t pid;
+	job_element_t *job;
+	//next process in the same bucket of the process table, or in the free list
+	struct job_process *next;
+	//next process of the same job
+	struct job_process *nextInJob;
+};
+
+//job records are allocated POOL_CHUNK at a time and never freed until cleanup,
+//removed jobs go back on the free list together with their command buffer
+struct job_chunk {
+	struct job_chunk *next;
+	job_element_t elements[POOL_CHUNK];
+};
+struct process_chunk {
+	struct process_chunk *next;
+	struct job_process processes[POOL_CHUNK];
+};
+
+//head and tail are the ends of the list
 //current is the current element being iterated over
+//pidBuckets and jidBuckets are the hash tables, both with numBuckets buckets
+//procBuckets is the hash table of processes by pid, with numProcBuckets buckets
+//output is the buffer the jobs command formats the whole list into
 struct job_list {
 	job_element_t *head;
+	job_element_t *tail;
 	job_element_t *current;
+	job_element_t **pidBuckets;
+	job_element_t **jidBuckets;
+	size_t numBuckets;
+	size_t count;
+	job_element_t *freeList;
+	struct job_chunk *chunks;
+	struct job_process **procBuckets;
+	size_t numProcBuckets;
+	size_t procCount;
+	struct job_process *freeProcesses;
+	struct process_chunk *processChunks;
+	char *output;
+	size_t outputCap;
+};
+
+static const char *state_names[] = {
+	"Running",
+	"Stopped"
 };
 
+/* returns the bucket of key in a table of numBuckets buckets (a power of two) */
+static size_t bucket(int key, size_t numBuckets){
+	return ((unsigned) key * 2654435761u) & (numBuckets - 1);
+}
+
+static job_element_t *find_pid(job_list_t *job_list, pid_t pid){
+	job_element_t *currElement = job_list->pidBuckets[bucket(pid, job_list->numBuckets)];
+	while(currElement != NULL && currElement->pid != pid){
+		currElement = currElement->nextPid;
+	}
+	return currElement;
+}
+
+static struct job_process *find_process(job_list_t *job_list, pid_t pid){
+	struct job_process *process = job_list->procBuckets[bucket(pid, job_list->numProcBuckets)];
+	while(process != NULL && process->pid != pid){
+		process = process->next;
+	}
+	return process;
+}
+
+/* finds the job with the given pid, or else the job that a process with the given pid belongs to */
+static job_element_t *find_job(job_list_t *job_list, pid_t pid){
+	job_element_t *job = find_pid(job_list, pid);
+	if(job == NULL){
+		struct job_process *process = find_process(job_list, pid);
+		if(process != NULL){
+			job = process->job;
+		}
+	}
+	return job;
+}
+
+static job_element_t *find_jid(job_list_t *job_list, int jid){
+	job_element_t *currElement = job_list->jidBuckets[bucket(jid, job_list->numBuckets)];
+	while(currElement != NULL && currElement->jid != jid){
+		currElement = currElement->nextJid;
+	}
+	return currElement;
+}
+
+/* doubles the number of buckets and rehashes every job, returns 0 on success, -1 on failure */
+static int grow_tables(job_list_t *job_list){
+	size_t numBuckets = job_list->numBuckets * 2;
+	job_element_t **pidBuckets = (job_element_t **) calloc(numBuckets, sizeof(job_element_t *));
+	job_element_t **jidBuckets = (job_element_t **) calloc(numBuckets, sizeof(job_element_t *));
+	if(pidBuckets == NULL || jidBuckets == NULL){
+		free(pidBuckets);
+		free(jidBuckets);
+		return -1;
+	}
+
+	job_element_t *currElement;
+	for(currElement = job_list->head; currElement != NULL; currElement = currElement->next){
+		size_t b = bucket(currElement->pid, numBuckets);
+		currElement->nextPid = pidBuckets[b];
+		pidBuckets[b] = currElement;
+		b = bucket(currElement->jid, numBuckets);
+		currElement->nextJid = jidBuckets[b];
+		jidBuckets[b] = currElement;
+	}
+
+	free(job_list->pidBuckets);
+	free(job_list->jidBuckets);
+	job_list->pidBuckets = pidBuckets;
+	job_list->jidBuckets = jidBuckets;
+	job_list->numBuckets = numBuckets;
+	return 0;
+}
+
+/* doubles the number of buckets of the process table and rehashes every process,
+ * returns 0 on success, -1 on failure */
+static int grow_process_table(job_list_t *job_list){
+	size_t numBuckets = job_list->numProcBuckets * 2;
+	struct job_process **buckets = (struct job_process **) calloc(numBuckets, sizeof(struct job_process *));
+	if(buckets == NULL){
+		return -1;
+	}
+
+	job_element_t *currElement;
+	struct job_process *process;
+	for(currElement = job_list->head; currElement != NULL; currElement = currElement->next){
+		for(process = currElement->processList; process != NULL; process = process->nextInJob){
+			size_t b = bucket(process->pid, numBuckets);
+			process->next = buckets[b];
+			buckets[b] = process;
+		}
+	}
+
+	free(job_list->procBuckets);
+	job_list->procBuckets = buckets;
+	job_list->numProcBuckets = numBuckets;
+	return 0;
+}
+
+/* adds a process to job, returns 0 on success, -1 on failure */
+static int add_process(job_list_t *job_list, job_element_t *job, pid_t pid){
+	if(job_list->procCount >= job_list->numProcBuckets && grow_process_table(job_list) < 0){
+		return -1;
+	}
+	if(job_list->freeProcesses == NULL){
+		struct process_chunk *chunk = (struct process_chunk *) malloc(sizeof(struct process_chunk));
+		if(chunk == NULL){
+			return -1;
+		}
+		int i;
+		for(i = 0; i < POOL_CHUNK; i++){
+			chunk->processes[i].next = job_list->freeProcesses;
+			job_list->freeProcesses = &chunk->processes[i];
+		}
+		chunk->next = job_list->processChunks;
+		job_list->processChunks = chunk;
+	}
+
+	struct job_process *process = job_list->freeProcesses;
+	job_list->freeProcesses = process->next;
+	process->pid = pid;
+	process->job = job;
+	size_t b = bucket(pid, job_list->numProcBuckets);
+	process->next = job_list->procBuckets[b];
+	job_list->procBuckets[b] = process;
+	process->nextInJob = job->processList;
+	job->processList = process;
+	job->processes++;
+	job_list->procCount++;
+	return 0;
+}
+
+/* unlinks process from the process table and the list of its job and returns it to the pool */
+static void remove_process(job_list_t *job_list, struct job_process *process){
+	struct job_process **link = &job_list->procBuckets[bucket(process->pid, job_list->numProcBuckets)];
+	while(*link != process){
+		link = &(*link)->next;
+	}
+	*link = process->next;
+	link = &process->job->processList;
+	while(*link != process){
+		link = &(*link)->nextInJob;
+	}
+	*link = process->nextInJob;
+
+	process->job->processes--;
+	process->next = job_list->freeProcesses;
+	job_list->freeProcesses = process;
+	job_list->procCount--;
+}
+
+/* takes a record from the pool, allocating a new chunk if it is empty */
+static job_element_t *alloc_element(job_list_t *job_list){
+	if(job_list->freeList == NULL){
+		struct job_chunk *chunk = (struct job_chunk *) malloc(sizeof(struct job_chunk));
+		if(chunk == NULL){
+			return NULL;
+		}
+		int i;
+		for(i = 0; i < POOL_CHUNK; i++){
+			chunk->elements[i].command = NULL;
+			chunk->elements[i].commandCap = 0;
+			chunk->elements[i].next = job_list->freeList;
+			job_list->freeList = &chunk->elements[i];
+		}
+		chunk->next = job_list->chunks;
+		job_list->chunks = chunk;
+	}
+
+	job_element_t *element = job_list->freeList;
+	job_list->freeList = element->next;
+	return element;
+}
+
 /* initializes job list, returns pointer */
 job_list_t *init_job_list(){
 	job_list_t *job_list = (job_list_t *) malloc(sizeof(job_list_t));
-	job_list->head = NULL;
-	job_list->current = NULL;
+	if(job_list == NULL){
+		return NULL;
+	}
+	memset(job_list, 0, sizeof(job_list_t));
+	job_list->numBuckets = INITIAL_BUCKETS;
+	job_list->pidBuckets = (job_element_t **) calloc(INITIAL_BUCKETS, sizeof(job_element_t *));
+	job_list->jidBuckets = (job_element_t **) calloc(INITIAL_BUCKETS, sizeof(job_element_t *));
+	job_list->numProcBuckets = INITIAL_BUCKETS;
+	job_list->procBuckets = (struct job_process **) calloc(INITIAL_BUCKETS, sizeof(struct job_process *));
+	if(job_list->pidBuckets == NULL || job_list->jidBuckets == NULL || job_list->procBuckets == NULL){
+		cleanup_job_list(job_list);
+		return NULL;
+	}
 	return job_list;
 }
 
-/* 
+/*
  * cleans up jobs list
  * Note: this function will free the job_list pointer
  * DO NOT use the pointer after this function is called
@@ -37,105 +280,156 @@ void cleanup_job_list(job_list_t *job_list){
 	if(job_list == NULL){
 		return;
 	}
-	
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		job_element_t *nextElement = currElement->next;
-		
-		//free char*'s
-		if(currElement->state != NULL){
-			free(currElement->state);
-			currElement->state = NULL;
-		}
-		if(currElement->command != NULL){
-			free(currElement->command);
-			currElement->command = NULL;
+
+	//every record, in use or not, lives in one of the chunks
+	struct job_chunk *chunk = job_list->chunks;
+	while(chunk != NULL){
+		struct job_chunk *nextChunk = chunk->next;
+		int i;
+		for(i = 0; i < POOL_CHUNK; i++){
+			free(chunk->elements[i].command);
 		}
-		free(currElement);
-		currElement = NULL;
-		
-		currElement = nextElement;
-	}
-	
-	job_list->head = NULL;
-	job_list->current = NULL;
-	
+		free(chunk);
+		chunk = nextChunk;
+	}
+
+	struct process_chunk *processChunk = job_list->processChunks;
+	while(processChunk != NULL){
+		struct process_chunk *nextChunk = processChunk->next;
+		free(processChunk);
+		processChunk = nextChunk;
+	}
+
+	free(job_list->pidBuckets);
+	free(job_list->jidBuckets);
+	free(job_list->procBuckets);
+	free(job_list->output);
 	free(job_list);
 }
 
 /* adds new job to list, returns 0 on success, -1 on failure */
 int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state, char *command){
-	if(job_list == NULL || state == NULL || command == NULL){
+	if(job_list == NULL || command == NULL){
+		return -1;
+	}
+	if(job_list->count >= job_list->numBuckets && grow_tables(job_list) < 0){
+		return -1;
+	}
+
+	job_element_t *newJob = alloc_element(job_list);
+	if(newJob == NULL){
 		return -1;
 	}
-	
-	job_element_t *newJob = (job_element_t *) malloc(sizeof(job_element_t));
+
+	//copy the command in to protect our code, reusing the record's buffer if it is big enough
+	size_t commandLen = strlen(command) + 1;
+	if(newJob->commandCap < commandLen){
+		char *newCommand = (char *) realloc(newJob->command, commandLen);
+		if(newCommand == NULL){
+			newJob->next = job_list->freeList;
+			job_list->freeList = newJob;
+			return -1;
+		}
+		newJob->command = newCommand;
+		newJob->commandCap = commandLen;
+	}
+	memcpy(newJob->command, command, commandLen);
 	newJob->jid = jid;
 	newJob->pid = pid;
-	
-	//allocate new char*'s and copy buffers in to protect our code
-	newJob->state = (char *) malloc(sizeof(char) * (strlen(state) + 1));
-	memcpy(newJob->state, state, strlen(state) + 1);
-	newJob->command = (char *) malloc(sizeof(char) * (strlen(command) + 1));
-	memcpy(newJob->command, command, strlen(command) + 1);
+	newJob->state = state;
+	newJob->processList = NULL;
+	newJob->processes = 0;
+	memset(&newJob->usage, 0, sizeof(job_usage_t));
+	if(add_process(job_list, newJob, pid) < 0){
+		newJob->next = job_list->freeList;
+		job_list->freeList = newJob;
+		return -1;
+	}
+
+	//add to tail
 	newJob->next = NULL;
-	
-	if(job_list->head == NULL){
-		//add to head
+	newJob->prev = job_list->tail;
+	if(job_list->tail == NULL){
 		job_list->head = newJob;
 		job_list->current = newJob;
 	} else {
-		//add to tail
-		job_element_t *currElement = job_list->head;
-		while(currElement->next != NULL){
-			currElement = currElement->next;
-		}
-		currElement->next = newJob;
+		job_list->tail->next = newJob;
 	}
-	
+	job_list->tail = newJob;
+
+	size_t b = bucket(pid, job_list->numBuckets);
+	newJob->nextPid = job_list->pidBuckets[b];
+	job_list->pidBuckets[b] = newJob;
+	b = bucket(jid, job_list->numBuckets);
+	newJob->nextJid = job_list->jidBuckets[b];
+	job_list->jidBuckets[b] = newJob;
+
+	job_list->count++;
 	return 0;
 }
 
+/* adds another process to the job with the given JID, such as a later stage of a pipeline,
+ * returns 0 on success, -1 on failure */
+int add_job_process(job_list_t *job_list, int jid, pid_t pid){
+	if(job_list == NULL){
+		return -1;
+	}
+
+	job_element_t *job = find_jid(job_list, jid);
+	if(job == NULL){
+		return -1;
+	}
+	return add_process(job_list, job, pid);
+}
+
+/* unlinks job from the list and both hash tables and returns its record to the pool */
+static void remove_element(job_list_t *job_list, job_element_t *job){
+	while(job->processList != NULL){
+		remove_process(job_list, job->processList);
+	}
+
+	job_element_t **link = &job_list->pidBuckets[bucket(job->pid, job_list->numBuckets)];
+	while(*link != job){
+		link = &(*link)->nextPid;
+	}
+	*link = job->nextPid;
+	link = &job_list->jidBuckets[bucket(job->jid, job_list->numBuckets)];
+	while(*link != job){
+		link = &(*link)->nextJid;
+	}
+	*link = job->nextJid;
+
+	if(job->prev != NULL){
+		job->prev->next = job->next;
+	} else {
+		job_list->head = job->next;
+	}
+	if(job->next != NULL){
+		job->next->prev = job->prev;
+	} else {
+		job_list->tail = job->prev;
+	}
+	if(job_list->current == job){
+		job_list->current = job->next;
+	}
+
+	job->next = job_list->freeList;
+	job_list->freeList = job;
+	job_list->count--;
+}
+
 /* removes job from list, given job's JID, returns 0 on success, -1 on failure */
 int remove_job_jid(job_list_t *job_list, int jid){
 	if(job_list == NULL){
 		return -1;
 	}
-	
-	job_element_t *prevElement = NULL;
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		if(currElement->jid == jid){
-			if(prevElement != NULL){
-				prevElement->next = currElement->next;
-			}
-			if(job_list->head == currElement){
-				job_list->head = currElement->next;
-			}
-			if(job_list->current == currElement){
-				job_list->current = currElement->next;
-			}
-			
-			//free char*'s
-			if(currElement->state != NULL){
-				free(currElement->state);
-				currElement->state = NULL;
-			}
-			if(currElement->command != NULL){
-				free(currElement->command);
-				currElement->command = NULL;
-			}
-			free(currElement);
-			currElement = NULL;
-			
-			return 0;
-		}
-		
-		prevElement = currElement;
-		currElement = currElement->next;
+
+	job_element_t *job = find_jid(job_list, jid);
+	if(job == NULL){
+		return -1;
 	}
-	
-	return -1;
+	remove_element(job_list, job);
+	return 0;
 }
 
 /* removes job from list, given job's PID, returns 0 on success, -1 on failure */
@@ -143,41 +437,55 @@ int remove_job_pid(job_list_t *job_list, pid_t pid){
 	if(job_list == NULL){
 		return -1;
 	}
-	
-	job_element_t *prevElement = NULL;
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		if(currElement->pid == pid){
-			if(prevElement != NULL){
-				prevElement->next = currElement->next;
-			}
-			if(job_list->head == currElement){
-				job_list->head = currElement->next;
-			}
-			if(job_list->current == currElement){
-				job_list->current = currElement->next;
-			}
-			
-			//free char*'s
-			if(currElement->state != NULL){
-				free(currElement->state);
-				currElement->state = NULL;
-			}
-			if(currElement->command != NULL){
-				free(currElement->command);
-				currElement->command = NULL;
-			}
-			free(currElement);
-			currElement = NULL;
-			
-			return 0;
+
+	job_element_t *job = find_pid(job_list, pid);
+	if(job == NULL){
+		return -1;
+	}
+	remove_element(job_list, job);
+	return 0;
+}
+
+/* adds the time in seconds and microseconds to total */
+static void add_time(struct timeval *total, long sec, long usec){
+	total->tv_sec += sec + (total->tv_usec + usec) / 1000000;
+	total->tv_usec = (total->tv_usec + usec) % 1000000;
+}
+
+/*
+ * records that the process with the given PID has exited, adding usage (unless NULL) to the
+ * resources used by its job, and removes its job once all of the job's processes have exited,
+ * in which case jobUsage (unless NULL) is set to everything the job used
+ * returns the PID of the job if it was removed, 0 if it still has other processes,
+ * -1 if the process is not part of any job
+ */
+pid_t remove_job_process(job_list_t *job_list, pid_t pid, const struct rusage *usage, job_usage_t *jobUsage){
+	if(job_list == NULL){
+		return -1;
+	}
+
+	struct job_process *process = find_process(job_list, pid);
+	if(process == NULL){
+		return -1;
+	}
+	job_element_t *job = process->job;
+	remove_process(job_list, process);
+	if(usage != NULL){
+		add_time(&job->usage.userTime, usage->ru_utime.tv_sec, usage->ru_utime.tv_usec);
+		add_time(&job->usage.sysTime, usage->ru_stime.tv_sec, usage->ru_stime.tv_usec);
+		if(usage->ru_maxrss > job->usage.maxRss){
+			job->usage.maxRss = usage->ru_maxrss;
 		}
-		
-		prevElement = currElement;
-		currElement = currElement->next;
 	}
-	
-	return -1;
+	if(job->processes > 0){
+		return 0;
+	}
+	if(jobUsage != NULL){
+		*jobUsage = job->usage;
+	}
+	pid_t jobPid = job->pid;
+	remove_element(job_list, job);
+	return jobPid;
 }
 
 /* updates job's state, given job's JID, returns 0 on success, -1 on failure */
@@ -185,24 +493,13 @@ int update_job_jid(job_list_t *job_list, int jid, process_state_t state){
 	if(job_list == NULL){
 		return -1;
 	}
-	
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		if(currElement->jid == jid){
-			//free char * and allocate new char * to protect our code
-			if(currElement->state != NULL){
-				free(currElement->state);
-				currElement->state = NULL;
-			}
-			currElement->state = (char *) malloc(sizeof(char) * (strlen(state) + 1));
-			memcpy(currElement->state, state, strlen(state) + 1);
-			return 0;
-		}
-		
-		currElement = currElement->next;
+
+	job_element_t *job = find_jid(job_list, jid);
+	if(job == NULL){
+		return -1;
 	}
-	
-	return -1;
+	job->state = state;
+	return 0;
 }
 
 /* updates job's state, given job's PID, returns 0 on success, -1 on failure */
@@ -210,24 +507,13 @@ int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state){
 	if(job_list == NULL){
 		return -1;
 	}
-	
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		if(currElement->pid == pid){
-			//free char * and allocate new char * to protect our code
-			if(currElement->state != NULL){
-				free(currElement->state);
-				currElement->state = NULL;
-			}
-			currElement->state = (char *) malloc(sizeof(char) * (strlen(state) + 1));
-			memcpy(currElement->state, state, strlen(state) + 1);
-			return 0;
-		}
-		
-		currElement = currElement->next;
+
+	job_element_t *job = find_job(job_list, pid);
+	if(job == NULL){
+		return -1;
 	}
-	
-	return -1;
+	job->state = state;
+	return 0;
 }
 
 /* gets PID of job, given job's JID, returns PID on success, -1 on failure */
@@ -235,17 +521,9 @@ pid_t get_job_pid(job_list_t *job_list, int jid){
 	if(job_list == NULL){
 		return -1;
 	}
-	
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		if(currElement->jid == jid){
-			return currElement->pid;
-		}
-		
-		currElement = currElement->next;
-	}
-	
-	return -1;
+
+	job_element_t *job = find_jid(job_list, jid);
+	return job != NULL ? job->pid : -1;
 }
 
 /* gets JID of job, given job's PID, returns JID on success, -1 on failure */
@@ -253,20 +531,12 @@ int get_job_jid(job_list_t *job_list, pid_t pid){
 	if(job_list == NULL){
 		return -1;
 	}
-	
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		if(currElement->pid == pid){
-			return currElement->jid;
-		}
-		
-		currElement = currElement->next;
-	}
-	
-	return -1;
+
+	job_element_t *job = find_job(job_list, pid);
+	return job != NULL ? job->jid : -1;
 }
 
-/* 
+/*
  * gets next PID in list
  * call this in a loop to get the PID of the next job in the list
  * returns the PID if there is one, -1 if the end of the list has been reached,
@@ -276,7 +546,7 @@ pid_t get_next_pid(job_list_t *job_list){
 	if(job_list == NULL){
 		return -1;
 	}
-	
+
 	if(job_list->current == NULL){
 		job_list->current = job_list->head;
 		return -1;
@@ -287,20 +557,110 @@ pid_t get_next_pid(job_list_t *job_list){
 	}
 }
 
-/* jobs command, prints out the jobs list */
-void jobs(job_list_t *job_list){
+/* reads the file at path into buf, returns the number of bytes read or -1 on failure */
+static ssize_t read_file(const char *path, char *buf, size_t size){
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0){
+		return -1;
+	}
+	ssize_t n = read(fd, buf, size - 1);
+	close(fd);
+	if(n >= 0){
+		buf[n] = '\0';
+	}
+	return n;
+}
+
+/* adds the CPU time used so far by the running process with the given PID to usage, and raises
+ * its peak memory to that of the process, as found in /proc */
+static void add_running_usage(pid_t pid, job_usage_t *usage){
+	static long ticks = 0;
+	if(ticks == 0){
+		ticks = sysconf(_SC_CLK_TCK);
+	}
+	char path[64], buf[1024];
+	unsigned long userTicks, sysTicks;
+
+	//the command name in parentheses may contain spaces, so the fields are counted from the last ')'
+	sprintf(path, "/proc/%d/stat", pid);
+	if(read_file(path, buf, sizeof(buf)) > 0){
+		char *fields = strrchr(buf, ')');
+		if(fields != NULL && sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+				&userTicks, &sysTicks) == 2){
+			add_time(&usage->userTime, (long) userTicks / ticks, (long) userTicks % ticks * 1000000 / ticks);
+			add_time(&usage->sysTime, (long) sysTicks / ticks, (long) sysTicks % ticks * 1000000 / ticks);
+		}
+	}
+	sprintf(path, "/proc/%d/status", pid);
+	if(read_file(path, buf, sizeof(buf)) > 0){
+		char *hwm = strstr(buf, "VmHWM:");
+		long rss;
+		if(hwm != NULL && sscanf(hwm + 6, "%ld", &rss) == 1 && rss > usage->maxRss){
+			usage->maxRss = rss;
+		}
+	}
+}
+
+/* formats the jobs list into the output buffer, with the resources used by each job if
+ * longFormat is set, and prints it with a single write */
+static void print_jobs(job_list_t *job_list, int longFormat){
 	if(job_list == NULL){
 		return;
 	}
-	
-	job_element_t *currElement = job_list->head;
-	while(currElement != NULL){
-		char buffer[1024];
-		memset(buffer, 0, 1024);
-		sprintf(buffer, "[%d] (%d) %s %s\n", currElement->jid, currElement->pid, currElement->state, currElement->command);
-		
-		write(1, buffer, 1024);
-		
-		currElement = currElement->next;
+
+	size_t len = 0;
+	job_element_t *currElement;
+	for(currElement = job_list->head; currElement != NULL; currElement = currElement->next){
+		//room for the brackets, two ints, the state, the usage and the newline
+		size_t need = len + strlen(currElement->command) + 128;
+		if(job_list->outputCap < need){
+			size_t cap = job_list->outputCap * 2 > need ? job_list->outputCap * 2 : need;
+			char *output = (char *) realloc(job_list->output, cap);
+			if(output == NULL){
+				break;
+			}
+			job_list->output = output;
+			job_list->outputCap = cap;
+		}
+		int n;
+		if(longFormat){
+			job_usage_t usage = currElement->usage;
+			struct job_process *process;
+			for(process = currElement->processList; process != NULL; process = process->nextInJob){
+				add_running_usage(process->pid, &usage);
+			}
+			n = sprintf(job_list->output + len, "[%d] (%d) %s user %ld.%03lds sys %ld.%03lds rss %ldKB %s\n",
+					currElement->jid, currElement->pid, state_names[currElement->state],
+					(long) usage.userTime.tv_sec, (long) usage.userTime.tv_usec / 1000,
+					(long) usage.sysTime.tv_sec, (long) usage.sysTime.tv_usec / 1000,
+					usage.maxRss, currElement->command);
+		} else {
+			n = sprintf(job_list->output + len, "[%d] (%d) %s %s\n", currElement->jid, currElement->pid,
+					state_names[currElement->state], currElement->command);
+		}
+		len += (size_t) n;
+	}
+
+	size_t written = 0;
+	while(written < len){
+		ssize_t n = write(STDOUT_FILENO, job_list->output + written, len - written);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return;
+		}
+		written += (size_t) n;
 	}
 }
+
+/* jobs command, prints out the jobs list with a single write */
+void jobs(job_list_t *job_list){
+	print_jobs(job_list, 0);
+}
+
+/* jobs -l command, prints out the jobs list with the CPU time and peak memory of each job,
+ * counting both its exited processes and the ones still running, with a single write */
+void jobs_long(job_list_t *job_list){
+	print_jobs(job_list, 1);
+}
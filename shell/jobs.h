@@ -3,12 +3,22 @@
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
-#define _STATE_RUNNING "Running"
-#define _STATE_STOPPED "Stopped"
+typedef enum {
+	STATE_RUNNING,
+	STATE_STOPPED
+} process_state_t;
 
 typedef struct job_list job_list_t;
-typedef char *process_state_t;
+
+/* resources used by the processes of a job */
+typedef struct {
+	struct timeval userTime;
+	struct timeval sysTime;
+	long maxRss; //largest resident set size of any one process, in kilobytes
+} job_usage_t;
 
 /* initializes job list, returns pointer */
 job_list_t *init_job_list();
@@ -22,19 +32,34 @@ void cleanup_job_list(job_list_t *job_list);
 /* adds new job to list, returns 0 on success, -1 on failure */
 int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state, char *command);
 
+/* adds another process to the job with the given JID, such as a later stage of a pipeline,
+ * returns 0 on success, -1 on failure */
+int add_job_process(job_list_t *job_list, int jid, pid_t pid);
+
 /* removes job from list, given job's JID, returns 0 on success, -1 on failure */
 int remove_job_jid(job_list_t *job_list, int jid);
 /* removes job from list, given job's PID, returns 0 on success, -1 on failure */
 int remove_job_pid(job_list_t *job_list, pid_t pid);
 
+/*
+ * records that the process with the given PID has exited, adding usage (unless NULL) to the
+ * resources used by its job, and removes its job once all of the job's processes have exited,
+ * in which case jobUsage (unless NULL) is set to everything the job used
+ * returns the PID of the job if it was removed, 0 if it still has other processes,
+ * -1 if the process is not part of any job
+ */
+pid_t remove_job_process(job_list_t *job_list, pid_t pid, const struct rusage *usage, job_usage_t *jobUsage);
+
 /* updates job's state, given job's JID, returns 0 on success, -1 on failure */
 int update_job_jid(job_list_t *job_list, int jid, process_state_t state);
-/* updates job's state, given job's PID, returns 0 on success, -1 on failure */
+/* updates job's state, given the PID of the job or of one of its processes,
+ * returns 0 on success, -1 on failure */
 int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state);
 
 /* gets PID of job, given job's JID, returns PID on success, -1 on failure */
 pid_t get_job_pid(job_list_t *job_list, int jid);
-/* gets JID of job, given job's PID, returns JID on success, -1 on failure */
+/* gets JID of job, given the PID of the job or of one of its processes,
+ * returns JID on success, -1 on failure */
 int get_job_jid(job_list_t *job_list, pid_t pid);
 
 /* 
@@ -45,7 +70,10 @@ int get_job_jid(job_list_t *job_list, pid_t pid);
  */
 pid_t get_next_pid(job_list_t *job_list);
 
-/* jobs command, prints out the jobs list */
+/* jobs command, prints out the jobs list with a single write */
 void jobs(job_list_t *job_list);
+/* jobs -l command, prints out the jobs list with the CPU time and peak memory of each job,
+ * counting both its exited processes and the ones still running, with a single write */
+void jobs_long(job_list_t *job_list);
 
 #endif
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parse.h"
+#include "wildcard.h"
+
+/* a word of a command, kept in a list until the whole command has been read */
+typedef struct word {
+  char *text;
+  struct word *next;
+} word_t;
+
+/* a command being parsed */
+typedef struct stage {
+  command_t command;
+  word_t *words;
+  word_t **last_word;
+  output_t **last_output;
+  struct stage *next;
+} stage_t;
+
+static int is_space(char c) {
+  return c == ' ' || c == '\t';
+}
+
+static int is_special(char c) {
+  return c == '<' || c == '>' || c == '|';
+}
+
+// set while parse_line_raw() runs, so that a malformed line is not reported
+static int quiet;
+
+static void syntax_error(const char *err_msg) {
+  if (quiet)
+    return;
+  write(STDERR_FILENO, err_msg, strlen(err_msg));
+}
+
+static int out_of_memory() {
+  syntax_error("sh: Out of memory\n");
+  return -1;
+}
+
+/* returns the length of the word at the start of str, which is len bytes long */
+static size_t word_length(const char *str, size_t len) {
+  size_t n = 0;
+  while (n < len && !is_space(str[n]) && !is_special(str[n]))
+    n++;
+  return n;
+}
+
+/*
+ * finds the variable reference at the start of str, which is len bytes long and starts with $
+ * returns the length of the reference, 0 if str is not one, and sets name and name_len to
+ * the name of the variable
+ */
+static size_t var_reference(const char *str, size_t len, const char **name, size_t *name_len) {
+  size_t n;
+  if (len > 1 && str[1] == '{') {
+    const char *close = (const char *) memchr(str + 2, '}', len - 2);
+    if (close == NULL || !valid_var_name(str + 2, (size_t) (close - str - 2)))
+      return 0;
+    *name = str + 2;
+    *name_len = (size_t) (close - str - 2);
+    return *name_len + 3;
+  }
+  if (len < 2 || !valid_var_name(str + 1, 1))
+    return 0;
+  for (n = 2; n < len && (valid_var_name(str + n, 1) || (str[n] >= '0' && str[n] <= '9')); n++)
+    ;
+  *name = str + 1;
+  *name_len = n - 1;
+  return n;
+}
+
+/*
+ * copies the word of len bytes at str into arena, replacing variable references by their values
+ * in two passes: the first to size the copy and the second to fill it in
+ * returns the copy, or NULL on failure, and sets empty if the word expanded to nothing
+ */
+char *expand_word(arena_t *arena, var_store_t *vars, const char *str, size_t len, int *empty) {
+  *empty = 0;
+  if (vars == NULL || memchr(str, '$', len) == NULL)
+    return arena_strndup(arena, str, len);
+
+  size_t i, ref, name_len, size = 0;
+  const char *name, *value;
+  char *copy = NULL;
+  int pass;
+  for (pass = 0; pass < 2; pass++) {
+    size_t n = 0;
+    for (i = 0; i < len; i++) {
+      if (str[i] == '$' && (ref = var_reference(str + i, len - i, &name, &name_len)) > 0) {
+	if ((value = get_var(vars, name, name_len)) != NULL) {
+	  size_t value_len = strlen(value);
+	  if (copy != NULL)
+	    memcpy(copy + n, value, value_len);
+	  n += value_len;
+	}
+	i += ref - 1;
+      } else {
+	if (copy != NULL)
+	  copy[n] = str[i];
+	n++;
+      }
+    }
+    if (copy == NULL) {
+      size = n;
+      copy = (char *) arena_alloc(arena, size + 1);
+      if (copy == NULL)
+	return NULL;
+    }
+  }
+  copy[size] = '\0';
+  *empty = size == 0;
+  return copy;
+}
+
+/*
+ * expands word into the sorted paths of the files its wildcards match, allocated from arena,
+ * keeping the listings of the directories read if SH_GLOB_CACHE is set in vars
+ * returns the number of paths and sets paths to them, 0 if word has no wildcard or nothing
+ * matched, -1 on failure
+ */
+int expand_glob(arena_t *arena, var_store_t *vars, const char *word, char ***paths) {
+  if (!has_wildcard(word))
+    return 0;
+  const char *cache = get_var(vars, "SH_GLOB_CACHE", 13);
+  return expand_wildcard(arena, word, cache != NULL && cache[0] != '\0', paths);
+}
+
+static stage_t *new_stage(arena_t *arena) {
+  stage_t *stage = (stage_t *) arena_alloc(arena, sizeof(stage_t));
+  if (stage != NULL) {
+    memset(stage, 0, sizeof(stage_t));
+    stage->last_word = &stage->words;
+    stage->last_output = &stage->command.outputs;
+  }
+  return stage;
+}
+
+/* turns the list of words of stage into its argv array, returns 0 on success, -1 on failure */
+static int finish_stage(arena_t *arena, stage_t *stage) {
+  word_t *word;
+  int argc = 0;
+  for (word = stage->words; word != NULL; word = word->next)
+    argc++;
+  char **argv = (char **) arena_alloc(arena, (size_t) (argc + 1) * sizeof(char *));
+  if (argv == NULL)
+    return -1;
+  argc = 0;
+  for (word = stage->words; word != NULL; word = word->next)
+    argv[argc++] = word->text;
+  argv[argc] = NULL;
+  stage->command.argc = argc;
+  stage->command.argv = argv;
+  return 0;
+}
+
+/*
+ * parses a command line into pipeline in a single pass, with every string and array
+ * allocated from arena, so the pipeline lives until the arena is reset
+ * returns 0 on success, -1 if the line is malformed, after printing an error message
+ */
+int parse_line(arena_t *arena, var_store_t *vars, const char *line, pipeline_t *pipeline) {
+  // a trailing & runs the pipeline in the background
+  size_t end = strlen(line);
+  while (end > 0 && is_space(line[end - 1]))
+    end--;
+  pipeline->bg = end > 0 && line[end - 1] == '&';
+  if (pipeline->bg)
+    end--;
+
+  stage_t *first = new_stage(arena), *stage = first;
+  int num_stages = 1, empty;
+  size_t i = 0;
+  if (first == NULL)
+    return out_of_memory();
+  for (;;) {
+    while (i < end && is_space(line[i]))
+      i++;
+
+    if (i == end || line[i] == '|') {
+      if (finish_stage(arena, stage) < 0)
+	return out_of_memory();
+      if (i == end)
+	break;
+      i++;
+      stage->next = new_stage(arena);
+      stage = stage->next;
+      if (stage == NULL)
+	return out_of_memory();
+      num_stages++;
+      continue;
+    }
+
+    if (line[i] == '<' || line[i] == '>') {
+      // a command may write to several files, but read from one
+      char **file = &stage->command.file_in;
+      if (line[i] == '<' && *file != NULL) {
+	syntax_error("sh: Multiple input redirects\n");
+	return -1;
+      }
+      if (line[i] == '>') {
+	output_t *output = (output_t *) arena_alloc(arena, sizeof(output_t));
+	if (output == NULL)
+	  return out_of_memory();
+	output->trunc = i + 1 >= end || line[i + 1] != '>'; // check if >> rather than >
+	if (!output->trunc)
+	  i++;
+	output->next = NULL;
+	*stage->last_output = output;
+	stage->last_output = &output->next;
+	stage->command.num_outputs++;
+	file = &output->file;
+      }
+      i++;
+      while (i < end && is_space(line[i]))
+	i++;
+      size_t len = word_length(line + i, end - i);
+      if (len == 0) { // no file after redirection symbol
+	syntax_error("sh: No redirection file specified\n");
+	return -1;
+      }
+      *file = expand_word(arena, vars, line + i, len, &empty);
+      if (*file == NULL)
+	return out_of_memory();
+      if (empty) {
+	syntax_error("sh: Ambiguous redirect\n");
+	return -1;
+      }
+      i += len;
+      continue;
+    }
+
+    size_t len = word_length(line + i, end - i);
+    word_t *word = (word_t *) arena_alloc(arena, sizeof(word_t));
+    if (word == NULL || (word->text = expand_word(arena, vars, line + i, len, &empty)) == NULL)
+      return out_of_memory();
+    i += len;
+    if (empty)
+      continue;
+
+    // a word with wildcards is replaced by the paths it matches, or kept if it matches nothing
+    char **paths;
+    int num_paths = vars != NULL ? expand_glob(arena, vars, word->text, &paths) : 0, j;
+    if (num_paths < 0)
+      return out_of_memory();
+    if (num_paths > 0) {
+      word = (word_t *) arena_alloc(arena, (size_t) num_paths * sizeof(word_t));
+      if (word == NULL)
+	return out_of_memory();
+      for (j = 0; j < num_paths - 1; j++) {
+	word[j].text = paths[j];
+	word[j].next = &word[j + 1];
+      }
+      *stage->last_word = word;
+      word = &word[j];
+      word->text = paths[j];
+    } else {
+      *stage->last_word = word;
+    }
+    word->next = NULL;
+    stage->last_word = &word->next;
+  }
+
+  // a line with nothing on it is blank, but every command of a pipeline needs a program
+  if (num_stages == 1 && first->command.argc == 0 && first->command.file_in == NULL
+      && first->command.outputs == NULL) {
+    pipeline->commands = NULL;
+    pipeline->num_commands = 0;
+    return 0;
+  }
+  pipeline->commands = (command_t *) arena_alloc(arena, (size_t) num_stages * sizeof(command_t));
+  if (pipeline->commands == NULL)
+    return out_of_memory();
+  pipeline->num_commands = num_stages;
+  for (i = 0, stage = first; stage != NULL; i++, stage = stage->next) {
+    if (stage->command.argc == 0) {
+      syntax_error("sh: Invalid null command\n");
+      return -1;
+    }
+    pipeline->commands[i] = stage->command;
+  }
+  return 0;
+}
+
+/*
+ * parses a command line like parse_line(), but leaves the variable references in words and file
+ * names as they are and does not print an error message if the line is malformed
+ */
+int parse_line_raw(arena_t *arena, const char *line, pipeline_t *pipeline) {
+  quiet = 1;
+  int result = parse_line(arena, NULL, line, pipeline);
+  quiet = 0;
+  return result;
+}
@@ -0,0 +1,59 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include "arena.h"
+#include "vars.h"
+
+/* an output redirection file of a command */
+typedef struct output {
+  char *file;
+  int trunc;         // whether the file is truncated (>) rather than appended to (>>)
+  struct output *next;
+} output_t;
+
+/* one command of a pipeline */
+typedef struct {
+  int argc;          // number of words, the command and its arguments
+  char **argv;       // the command and its arguments, followed by NULL
+  char *file_in;     // input redirection file, or NULL
+  output_t *outputs; // output redirection files in the order they were given, or NULL
+  int num_outputs;
+} command_t;
+
+/* a command line: one or more commands connected by pipes */
+typedef struct {
+  command_t *commands;
+  int num_commands;  // 0 for a blank line
+  int bg;            // whether the line ended with &
+} pipeline_t;
+
+/*
+ * parses a command line into pipeline in a single pass, with every string and array
+ * allocated from arena, so the pipeline lives until the arena is reset
+ * $NAME and ${NAME} in words and file names are replaced by the value of the variable in vars,
+ * unless vars is NULL, and a word that only held unset or empty variables is dropped. a word
+ * with wildcards is then replaced by the paths it matches, see expand_glob()
+ * returns 0 on success, -1 if the line is malformed, after printing an error message
+ */
+int parse_line(arena_t *arena, var_store_t *vars, const char *line, pipeline_t *pipeline);
+/*
+ * parses a command line like parse_line(), but leaves the variable references in words and file
+ * names as they are and does not print an error message if the line is malformed
+ */
+int parse_line_raw(arena_t *arena, const char *line, pipeline_t *pipeline);
+
+/*
+ * copies the word of len bytes at str into arena, replacing variable references by their values
+ * in vars, unless vars is NULL
+ * returns the copy, or NULL on failure, and sets empty if the word expanded to nothing
+ */
+char *expand_word(arena_t *arena, var_store_t *vars, const char *str, size_t len, int *empty);
+/*
+ * expands word into the sorted paths of the files its wildcards match, allocated from arena,
+ * keeping the listings of the directories read if SH_GLOB_CACHE is set in vars
+ * returns the number of paths and sets paths to them, 0 if word has no wildcard or nothing
+ * matched, -1 on failure
+ */
+int expand_glob(arena_t *arena, var_store_t *vars, const char *word, char ***paths);
+
+#endif
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "path.h"
+
+// number of buckets in the hash table when the cache is created
+#define INITIAL_BUCKETS 64
+// used when PATH is not set
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/* the location of one command */
+struct path_entry {
+  char *name;
+  char *path;
+  size_t dir;           // index of the PATH directory the program was found in
+  unsigned long hits;
+  struct path_entry *next;
+};
+
+/* one directory of PATH, with its modification time when it was last looked at */
+struct path_dir {
+  char *dir;
+  int stamped;
+  struct timespec mtime;
+};
+
+// path is the copy of PATH that dirs were parsed from
+// candidate is the buffer in which the full path of a program is built
+struct path_cache {
+  char *path;
+  struct path_dir *dirs;
+  size_t num_dirs;
+  struct path_entry **buckets;
+  size_t num_buckets;
+  size_t count;
+  char *candidate;
+  size_t candidate_cap;
+};
+
+/* FNV-1a hash of a command name */
+static size_t hash_name(const char *name, size_t num_buckets) {
+  unsigned long hash = 2166136261u;
+  while (*name) {
+    hash ^= (unsigned char) *name++;
+    hash *= 16777619u;
+  }
+  return (size_t) hash & (num_buckets - 1);
+}
+
+static struct path_entry *lookup(path_cache_t *cache, const char *name) {
+  struct path_entry *entry = cache->buckets[hash_name(name, cache->num_buckets)];
+  while (entry != NULL && strcmp(entry->name, name) != 0)
+    entry = entry->next;
+  return entry;
+}
+
+/* forgets the commands found in directory from_dir of PATH or any directory after it */
+static void remove_entries(path_cache_t *cache, size_t from_dir) {
+  size_t i;
+  for (i = 0; i < cache->num_buckets; i++) {
+    struct path_entry **link = &cache->buckets[i];
+    while (*link != NULL) {
+      struct path_entry *entry = *link;
+      if (entry->dir >= from_dir) {
+	*link = entry->next;
+	free(entry->name);
+	free(entry->path);
+	free(entry);
+	cache->count--;
+      } else {
+	link = &entry->next;
+      }
+    }
+  }
+}
+
+/* empties the cache and splits path into its directories, an empty one meaning the working
+ * directory. returns 0 on success, -1 on failure
+ */
+static int set_path(path_cache_t *cache, const char *path) {
+  size_t i;
+  remove_entries(cache, 0);
+  for (i = 0; i < cache->num_dirs; i++)
+    free(cache->dirs[i].dir);
+  free(cache->dirs);
+  free(cache->path);
+  cache->dirs = NULL;
+  cache->num_dirs = 0;
+
+  cache->path = strdup(path);
+  if (cache->path == NULL)
+    return -1;
+  size_t num_dirs = 1;
+  const char *p;
+  for (p = path; *p; p++)
+    num_dirs += *p == ':';
+  cache->dirs = (struct path_dir *) calloc(num_dirs, sizeof(struct path_dir));
+  if (cache->dirs == NULL)
+    return -1;
+  for (p = path; ; p++) {
+    size_t len = strcspn(p, ":");
+    struct path_dir *dir = &cache->dirs[cache->num_dirs++];
+    dir->dir = len ? strndup(p, len) : strdup(".");
+    if (dir->dir == NULL)
+      return -1;
+    p += len;
+    if (*p == '\0')
+      break;
+  }
+  return 0;
+}
+
+/* checks whether directory i of PATH has changed since it was last looked at, in which case
+ * a program may have been added to it or removed from it, and forgets the commands that could
+ * be affected: those found in the directory itself or in one after it. returns 1 if it changed
+ */
+static int dir_changed(path_cache_t *cache, size_t i) {
+  struct path_dir *dir = &cache->dirs[i];
+  struct stat st;
+  struct timespec mtime = {0, 0};
+  if (stat(dir->dir, &st) == 0)
+    mtime = st.st_mtim;
+  if (dir->stamped && mtime.tv_sec == dir->mtime.tv_sec && mtime.tv_nsec == dir->mtime.tv_nsec)
+    return 0;
+  remove_entries(cache, i);
+  dir->stamped = 1;
+  dir->mtime = mtime;
+  return 1;
+}
+
+/* builds dir/name in the candidate buffer, returns it or NULL on failure */
+static char *build_candidate(path_cache_t *cache, const char *dir, const char *name) {
+  size_t len = strlen(dir) + strlen(name) + 2;
+  if (cache->candidate_cap < len) {
+    char *candidate = (char *) realloc(cache->candidate, len);
+    if (candidate == NULL)
+      return NULL;
+    cache->candidate = candidate;
+    cache->candidate_cap = len;
+  }
+  sprintf(cache->candidate, "%s/%s", dir, name);
+  return cache->candidate;
+}
+
+/* doubles the number of buckets and rehashes every entry, returns 0 on success, -1 on failure */
+static int grow_buckets(path_cache_t *cache) {
+  size_t num_buckets = cache->num_buckets * 2, i;
+  struct path_entry **buckets = (struct path_entry **) calloc(num_buckets, sizeof(struct path_entry *));
+  if (buckets == NULL)
+    return -1;
+  for (i = 0; i < cache->num_buckets; i++) {
+    struct path_entry *entry = cache->buckets[i];
+    while (entry != NULL) {
+      struct path_entry *next = entry->next;
+      size_t b = hash_name(entry->name, num_buckets);
+      entry->next = buckets[b];
+      buckets[b] = entry;
+      entry = next;
+    }
+  }
+  free(cache->buckets);
+  cache->buckets = buckets;
+  cache->num_buckets = num_buckets;
+  return 0;
+}
+
+static struct path_entry *add_entry(path_cache_t *cache, const char *name, const char *path, size_t dir) {
+  if (cache->count >= cache->num_buckets && grow_buckets(cache) < 0)
+    return NULL;
+  struct path_entry *entry = (struct path_entry *) malloc(sizeof(struct path_entry));
+  if (entry == NULL)
+    return NULL;
+  entry->name = strdup(name);
+  entry->path = strdup(path);
+  if (entry->name == NULL || entry->path == NULL) {
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+    return NULL;
+  }
+  entry->dir = dir;
+  entry->hits = 0;
+  size_t b = hash_name(name, cache->num_buckets);
+  entry->next = cache->buckets[b];
+  cache->buckets[b] = entry;
+  cache->count++;
+  return entry;
+}
+
+/* initializes an empty command location cache, returns pointer */
+path_cache_t *init_path_cache() {
+  path_cache_t *cache = (path_cache_t *) calloc(1, sizeof(path_cache_t));
+  if (cache == NULL)
+    return NULL;
+  cache->num_buckets = INITIAL_BUCKETS;
+  cache->buckets = (struct path_entry **) calloc(INITIAL_BUCKETS, sizeof(struct path_entry *));
+  if (cache->buckets == NULL) {
+    free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+/*
+ * cleans up the cache
+ * Note: this function will free the path_cache pointer
+ */
+void cleanup_path_cache(path_cache_t *cache) {
+  if (cache == NULL)
+    return;
+  size_t i;
+  remove_entries(cache, 0);
+  for (i = 0; i < cache->num_dirs; i++)
+    free(cache->dirs[i].dir);
+  free(cache->dirs);
+  free(cache->path);
+  free(cache->buckets);
+  free(cache->candidate);
+  free(cache);
+}
+
+/*
+ * finds the program run by the command name in the directories listed in path, the value of
+ * PATH, or in the default ones if it is NULL
+ * a cached location is used as long as PATH is the same and neither the directory it is in
+ * nor any directory before it in PATH has been modified, so a repeated command only costs a
+ * stat() of those directories rather than a search of PATH
+ * returns the path of the program, which belongs to the cache and stays valid until
+ * the next call, or NULL if there is none
+ */
+const char *find_command(path_cache_t *cache, const char *path, const char *name) {
+  if (path == NULL)
+    path = DEFAULT_PATH;
+  if ((cache->path == NULL || strcmp(cache->path, path) != 0) && set_path(cache, path) < 0)
+    return NULL;
+
+  struct path_entry *entry = lookup(cache, name);
+  if (entry != NULL) {
+    size_t i, dir = entry->dir;
+    for (i = 0; i <= dir; i++) {
+      if (dir_changed(cache, i)) {
+	entry = NULL;
+	break;
+      }
+    }
+    if (entry != NULL) {
+      entry->hits++;
+      return entry->path;
+    }
+  }
+
+  size_t i;
+  for (i = 0; i < cache->num_dirs; i++) {
+    struct stat st;
+    dir_changed(cache, i);
+    char *candidate = build_candidate(cache, cache->dirs[i].dir, name);
+    if (candidate == NULL)
+      return NULL;
+    if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+      entry = add_entry(cache, name, candidate, i);
+      if (entry == NULL)
+	return candidate;
+      entry->hits++;
+      return entry->path;
+    }
+  }
+  return NULL;
+}
+
+/* forgets every cached location */
+void reset_path_cache(path_cache_t *cache) {
+  remove_entries(cache, 0);
+}
+
+/* hash command, prints out the cached locations and how often each was used */
+void print_path_cache(path_cache_t *cache) {
+  if (cache->count == 0) {
+    write(STDOUT_FILENO, "hash: hash table empty\n", 23);
+    return;
+  }
+
+  size_t i, len = 0, cap = 16;
+  struct path_entry *entry;
+  for (i = 0; i < cache->num_buckets; i++)
+    for (entry = cache->buckets[i]; entry != NULL; entry = entry->next)
+      cap += strlen(entry->path) + 24;
+  char *output = (char *) malloc(cap);
+  if (output == NULL)
+    return;
+  len += (size_t) sprintf(output, "hits\tcommand\n");
+  for (i = 0; i < cache->num_buckets; i++)
+    for (entry = cache->buckets[i]; entry != NULL; entry = entry->next)
+      len += (size_t) sprintf(output + len, "%4lu\t%s\n", entry->hits, entry->path);
+  write(STDOUT_FILENO, output, len);
+  free(output);
+}
@@ -0,0 +1,28 @@
+#ifndef PATH_H
+#define PATH_H
+
+typedef struct path_cache path_cache_t;
+
+/* initializes an empty command location cache, returns pointer */
+path_cache_t *init_path_cache();
+/*
+ * cleans up the cache
+ * Note: this function will free the path_cache pointer
+ */
+void cleanup_path_cache(path_cache_t *cache);
+
+/*
+ * finds the program run by the command name in the directories listed in path, the value of
+ * PATH, or in the default ones if it is NULL
+ * returns the path of the program, which belongs to the cache and stays valid until
+ * the next call, or NULL if there is none
+ */
+const char *find_command(path_cache_t *cache, const char *path, const char *name);
+
+/* forgets every cached location */
+void reset_path_cache(path_cache_t *cache);
+
+/* hash command, prints out the cached locations and how often each was used */
+void print_path_cache(path_cache_t *cache);
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+/* initializes reader to read fd block bytes at a time, returns 0 on success, -1 on failure */
+int init_reader(reader_t *reader, int fd, size_t block) {
+  memset(reader, 0, sizeof(reader_t));
+  reader->fd = fd;
+  reader->block = block;
+  reader->cap = block + 1;
+  reader->buf = (char *) malloc(reader->cap);
+  return reader->buf != NULL ? 0 : -1;
+}
+
+/* frees the buffer of reader, without closing its file descriptor */
+void cleanup_reader(reader_t *reader) {
+  free(reader->buf);
+  reader->buf = NULL;
+}
+
+/* reads up to a block of input after the unread bytes, first moving them to the front of the
+ * buffer and growing it if a line does not fit. returns the number of bytes read, 0 at the end
+ * of the input, -1 on failure
+ */
+static ssize_t fill(reader_t *reader) {
+  if (reader->start > 0) {
+    memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+  // always leave room for the null character
+  if (reader->cap - reader->end < reader->block + 1) {
+    size_t cap = reader->cap * 2;
+    if (cap < reader->end + reader->block + 1)
+      cap = reader->end + reader->block + 1;
+    char *buf = (char *) realloc(reader->buf, cap);
+    if (buf == NULL)
+      return -1;
+    reader->buf = buf;
+    reader->cap = cap;
+  }
+
+  ssize_t n;
+  do {
+    if (reader->wait != NULL)
+      reader->wait(reader->fd);
+    n = read(reader->fd, reader->buf + reader->end, reader->block);
+  } while (n < 0 && errno == EINTR);
+  if (n > 0)
+    reader->end += (size_t) n;
+  return n;
+}
+
+/*
+ * reads the next line
+ * returns the line without its newline and terminated by a null character, which stays
+ * valid until the next call, or NULL at the end of the input or on a read error (with errno
+ * set and reader->eof clear). len is set to the length of the line, and partial to whether
+ * the input ended before a newline
+ */
+char *next_line(reader_t *reader, size_t *len, int *partial) {
+  for (;;) {
+    char *line = reader->buf + reader->start;
+    size_t avail = reader->end - reader->start;
+    char *newline = (char *) memchr(line + reader->scanned, '\n', avail - reader->scanned);
+    if (newline != NULL) {
+      *newline = '\0';
+      *len = (size_t) (newline - line);
+      *partial = 0;
+      reader->start += *len + 1;
+      reader->scanned = 0;
+      return line;
+    }
+    reader->scanned = avail;
+
+    if (reader->eof) {
+      if (avail == 0)
+	return NULL;
+      line[avail] = '\0';
+      *len = avail;
+      *partial = 1;
+      reader->start = reader->end;
+      reader->scanned = 0;
+      return line;
+    }
+
+    ssize_t n = fill(reader);
+    if (n < 0)
+      return NULL;
+    if (n == 0)
+      reader->eof = 1;
+  }
+}
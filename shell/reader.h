@@ -0,0 +1,33 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+/* buffered reader that splits a file descriptor into lines of any length */
+typedef struct {
+  int fd;
+  char *buf;
+  size_t start;    // the unread bytes are buf[start] to buf[end - 1]
+  size_t end;
+  size_t scanned;  // bytes after start already known not to hold a newline
+  size_t cap;
+  size_t block;    // number of bytes asked for by each read()
+  int eof;
+  void (*wait)(int fd); // unless NULL, called before each read() to wait until fd is readable
+} reader_t;
+
+/* initializes reader to read fd block bytes at a time, returns 0 on success, -1 on failure */
+int init_reader(reader_t *reader, int fd, size_t block);
+/* frees the buffer of reader, without closing its file descriptor */
+void cleanup_reader(reader_t *reader);
+
+/*
+ * reads the next line
+ * returns the line without its newline and terminated by a null character, which stays
+ * valid until the next call, or NULL at the end of the input or on a read error (with errno
+ * set and reader->eof clear). len is set to the length of the line, and partial to whether
+ * the input ended before a newline
+ */
+char *next_line(reader_t *reader, size_t *len, int *partial);
+
+#endif
@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "script.h"
+
+#define SCRIPT_MAGIC "shscrpt3"
+// set in the reference of a word or file name that holds a variable or wildcard to expand
+#define EXPAND_BIT 0x80000000u
+// the number of commands of a line that could not be parsed, which is kept as text
+#define RAW_LINE 0xffffffffu
+
+/* the start of a compiled script, which is followed by the path of the script, padded to a
+ * multiple of 4 bytes, the records of its command lines and the strings they refer to. the
+ * device, inode, size and modification time are those of the script it was compiled from
+ */
+typedef struct {
+  char magic[8];
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint32_t path_len;
+  uint32_t num_records;   // number of uint32_t words of records
+  uint32_t strings_len;
+  uint32_t pad;
+} script_header_t;
+
+// each command line is recorded as uint32_t words: its number of commands and whether it runs in
+// the background, then for each command its number of words, its input file and its number of
+// output files, followed by each output file and whether it is truncated, then by its words.
+// words and files are references to strings: 0 for none, or 1 plus the offset of the string, with
+// EXPAND_BIT set if it holds a variable or a wildcard. a line that could not be parsed is RAW_LINE
+// followed by a reference to its text, and is parsed when it is run so that the error is reported
+// then
+struct script {
+  char *data;
+  size_t size;
+  int mapped;              // whether data is mapped from the cache rather than allocated
+  const uint32_t *next;    // the record of the next command line
+  const uint32_t *end;
+  char *strings;
+  size_t strings_len;
+};
+
+/* a compiled script being built */
+typedef struct {
+  uint32_t *records;
+  size_t num_records;
+  size_t records_cap;
+  char *strings;
+  size_t strings_len;
+  size_t strings_cap;
+} builder_t;
+
+static size_t pad4(size_t len) {
+  return (len + 3) & ~(size_t) 3;
+}
+
+/* adds value to the records, returns 0 on success, -1 on failure */
+static int add_record(builder_t *builder, uint32_t value) {
+  if (builder->num_records == builder->records_cap) {
+    size_t cap = builder->records_cap ? builder->records_cap * 2 : 4096;
+    uint32_t *records = (uint32_t *) realloc(builder->records, cap * sizeof(uint32_t));
+    if (records == NULL)
+      return -1;
+    builder->records = records;
+    builder->records_cap = cap;
+  }
+  builder->records[builder->num_records++] = value;
+  return 0;
+}
+
+/* adds a reference to a copy of str, or 0 if it is NULL, to the records, returns 0 on success,
+ * -1 on failure */
+static int add_string(builder_t *builder, const char *str) {
+  if (str == NULL)
+    return add_record(builder, 0);
+  size_t len = strlen(str) + 1;
+  if (builder->strings_len + len >= EXPAND_BIT)
+    return -1;
+  if (builder->strings_cap - builder->strings_len < len) {
+    size_t cap = builder->strings_cap ? builder->strings_cap : 65536;
+    while (cap - builder->strings_len < len)
+      cap *= 2;
+    char *strings = (char *) realloc(builder->strings, cap);
+    if (strings == NULL)
+      return -1;
+    builder->strings = strings;
+    builder->strings_cap = cap;
+  }
+  uint32_t ref = (uint32_t) builder->strings_len + 1;
+  if (strpbrk(str, "$*?[") != NULL)
+    ref |= EXPAND_BIT;
+  memcpy(builder->strings + builder->strings_len, str, len);
+  builder->strings_len += len;
+  return add_record(builder, ref);
+}
+
+/* adds the record of the command line to the records, returns 0 on success, -1 on failure */
+static int add_line(builder_t *builder, arena_t *arena, const char *line) {
+  pipeline_t pipeline;
+  if (parse_line_raw(arena, line, &pipeline) < 0)
+    return add_record(builder, RAW_LINE) || add_string(builder, line) ? -1 : 0;
+  if (pipeline.num_commands == 0)
+    return 0;
+  if (add_record(builder, (uint32_t) pipeline.num_commands) || add_record(builder, (uint32_t) pipeline.bg))
+    return -1;
+  int i, j;
+  for (i = 0; i < pipeline.num_commands; i++) {
+    command_t *command = &pipeline.commands[i];
+    if (add_record(builder, (uint32_t) command->argc) || add_string(builder, command->file_in)
+	|| add_record(builder, (uint32_t) command->num_outputs))
+      return -1;
+    output_t *output;
+    for (output = command->outputs; output != NULL; output = output->next) {
+      if (add_string(builder, output->file) || add_record(builder, (uint32_t) output->trunc))
+	return -1;
+    }
+    for (j = 0; j < command->argc; j++) {
+      if (add_string(builder, command->argv[j]))
+	return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * compiles the script read from fd, whose status is st and whose full path is path, into a single
+ * block that holds the header, the path, the records and the strings, parsing each line once
+ * returns the block and sets size to its size, or NULL on failure
+ */
+static char *compile_script(int fd, const struct stat *st, const char *path, size_t *size) {
+  size_t text_len = (size_t) st->st_size, done = 0;
+  char *text = (char *) malloc(text_len + 1), *data = NULL;
+  if (text == NULL)
+    return NULL;
+  while (done < text_len) {
+    ssize_t n = pread(fd, text + done, text_len - done, (off_t) done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += (size_t) n;
+  }
+  text_len = done;
+  text[text_len] = '\0';
+
+  builder_t builder;
+  memset(&builder, 0, sizeof(builder_t));
+  arena_t arena;
+  init_arena(&arena);
+  size_t start = 0;
+  int error = 0;
+  while (start < text_len && !error) {
+    char *newline = (char *) memchr(text + start, '\n', text_len - start);
+    size_t len = newline != NULL ? (size_t) (newline - (text + start)) : text_len - start;
+    text[start + len] = '\0';
+    reset_arena(&arena);
+    if (len > 0)
+      error = add_line(&builder, &arena, text + start);
+    start += len + 1;
+  }
+  cleanup_arena(&arena);
+  free(text);
+  if (error || builder.num_records > UINT32_MAX)
+    goto out;
+
+  size_t path_len = strlen(path);
+  *size = sizeof(script_header_t) + pad4(path_len) + builder.num_records * sizeof(uint32_t) + builder.strings_len;
+  data = (char *) calloc(1, *size);
+  if (data == NULL)
+    goto out;
+  script_header_t *header = (script_header_t *) data;
+  memcpy(header->magic, SCRIPT_MAGIC, sizeof(header->magic));
+  header->dev = (uint64_t) st->st_dev;
+  header->ino = (uint64_t) st->st_ino;
+  header->size = (uint64_t) st->st_size;
+  header->mtime_sec = (int64_t) st->st_mtim.tv_sec;
+  header->mtime_nsec = (int64_t) st->st_mtim.tv_nsec;
+  header->path_len = (uint32_t) path_len;
+  header->num_records = (uint32_t) builder.num_records;
+  header->strings_len = (uint32_t) builder.strings_len;
+  char *p = data + sizeof(script_header_t);
+  memcpy(p, path, path_len);
+  p += pad4(path_len);
+  if (builder.num_records > 0)
+    memcpy(p, builder.records, builder.num_records * sizeof(uint32_t));
+  p += builder.num_records * sizeof(uint32_t);
+  if (builder.strings_len > 0)
+    memcpy(p, builder.strings, builder.strings_len);
+
+out:
+  free(builder.records);
+  free(builder.strings);
+  return data;
+}
+
+/* checks that the size bytes at data are a compiled script of the script at path, whose status is
+ * st, returns 1 if they are, 0 if they are not */
+static int script_matches(const char *data, size_t size, const struct stat *st, const char *path) {
+  const script_header_t *header = (const script_header_t *) data;
+  size_t path_len = strlen(path);
+  if (size < sizeof(script_header_t) || memcmp(header->magic, SCRIPT_MAGIC, sizeof(header->magic)) != 0
+      || header->dev != (uint64_t) st->st_dev || header->ino != (uint64_t) st->st_ino
+      || header->size != (uint64_t) st->st_size || header->mtime_sec != (int64_t) st->st_mtim.tv_sec
+      || header->mtime_nsec != (int64_t) st->st_mtim.tv_nsec || header->path_len != path_len)
+    return 0;
+  if (size != sizeof(script_header_t) + pad4(path_len) + (size_t) header->num_records * sizeof(uint32_t)
+      + header->strings_len)
+    return 0;
+  // every string is terminated, so a reference inside the strings cannot run past them
+  if (header->strings_len > 0 && data[size - 1] != '\0')
+    return 0;
+  return memcmp(data + sizeof(script_header_t), path, path_len) == 0;
+}
+
+/* writes the compiled script of size bytes at data to cache_path, creating the cache directory
+ * cache_dir if it does not exist. it is written to a temporary file that is renamed over the old
+ * one, so a shell running the old one at the same time keeps its mapping of the old file
+ */
+static void save_script(const char *cache_dir, const char *cache_path, const char *data, size_t size) {
+  mkdir(cache_dir, S_IRWXU);
+  char temp_path[strlen(cache_path) + 24];
+  sprintf(temp_path, "%s.%ld", cache_path, (long) getpid());
+  int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd < 0)
+    return;
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = write(fd, data + done, size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += (size_t) n;
+  }
+  if (close(fd) < 0 || done < size || rename(temp_path, cache_path) < 0)
+    unlink(temp_path);
+}
+
+/*
+ * opens the compiled form of the script at path, which is open as fd, from the cache directory
+ * cache_dir. if there is none, or the script has changed since it was compiled, the script is
+ * compiled and the cache is replaced
+ * returns pointer, or NULL if the script cannot be compiled, in which case it is read as usual
+ */
+script_t *open_script(const char *path, int fd, const char *cache_dir) {
+  struct stat st;
+  char full_path[PATH_MAX];
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || realpath(path, full_path) == NULL)
+    return NULL;
+  script_t *script = (script_t *) calloc(1, sizeof(script_t));
+  if (script == NULL)
+    return NULL;
+
+  // the cache file is named after the FNV-1a hash of the full path of the script
+  unsigned long long hash = 14695981039346656037ull;
+  const char *c;
+  for (c = full_path; *c != '\0'; c++) {
+    hash ^= (unsigned char) *c;
+    hash *= 1099511628211ull;
+  }
+  char cache_path[strlen(cache_dir) + 24];
+  sprintf(cache_path, "%s/%016llx.shc", cache_dir, hash);
+
+  // the mapping is private and writable, since the commands may change their words in place,
+  // which only copies the pages they change
+  int cache_fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  struct stat cache_st;
+  if (cache_fd >= 0 && fstat(cache_fd, &cache_st) == 0 && cache_st.st_size >= (off_t) sizeof(script_header_t)) {
+    void *map = mmap(NULL, (size_t) cache_st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, cache_fd, 0);
+    if (map != MAP_FAILED) {
+      if (script_matches((const char *) map, (size_t) cache_st.st_size, &st, full_path)) {
+	script->data = (char *) map;
+	script->size = (size_t) cache_st.st_size;
+	script->mapped = 1;
+      } else {
+	munmap(map, (size_t) cache_st.st_size);
+      }
+    }
+  }
+  if (cache_fd >= 0)
+    close(cache_fd);
+
+  if (!script->mapped) {
+    script->data = compile_script(fd, &st, full_path, &script->size);
+    if (script->data == NULL) {
+      free(script);
+      return NULL;
+    }
+    save_script(cache_dir, cache_path, script->data, script->size);
+  }
+
+  const script_header_t *header = (const script_header_t *) script->data;
+  char *records = script->data + sizeof(script_header_t) + pad4(header->path_len);
+  script->next = (const uint32_t *) (void *) records;
+  script->end = script->next + header->num_records;
+  script->strings = records + (size_t) header->num_records * sizeof(uint32_t);
+  script->strings_len = header->strings_len;
+  return script;
+}
+
+/*
+ * unmaps the compiled script
+ * Note: this function will free the script pointer
+ */
+void close_script(script_t *script) {
+  if (script == NULL)
+    return;
+  if (script->mapped)
+    munmap(script->data, script->size);
+  else
+    free(script->data);
+  free(script);
+}
+
+/* gets the string that ref refers to into str, expanding its variables with vars into arena if it
+ * holds any, and sets empty if it expanded to nothing
+ * returns 0 on success, -1 if the reference is out of range, -2 if the arena ran out of memory
+ */
+static int get_string(script_t *script, uint32_t ref, arena_t *arena, var_store_t *vars, char **str, int *empty) {
+  size_t offset = (ref & ~EXPAND_BIT) - 1;
+  *str = NULL;
+  *empty = 0;
+  if (ref == 0)
+    return 0;
+  if (offset >= script->strings_len)
+    return -1;
+  char *text = script->strings + offset;
+  if (ref & EXPAND_BIT) {
+    *str = expand_word(arena, vars, text, strlen(text), empty);
+    return *str != NULL ? 0 : -2;
+  }
+  *str = text;
+  return 0;
+}
+
+/*
+ * gets the next command line of the script into pipeline, allocated from arena like
+ * parse_line(), expanding the variables it refers to with vars and the wildcards of its words
+ * returns 1 on success, 0 at the end of the script, -1 if the line is malformed, after printing
+ * an error message
+ */
+int next_command(script_t *script, arena_t *arena, var_store_t *vars, pipeline_t *pipeline) {
+  const uint32_t *r = script->next;
+  size_t left = (size_t) (script->end - r);
+  char *str;
+  int empty, error = 0;
+  if (left == 0)
+    return 0;
+  if (r[0] == RAW_LINE) {
+    if (left < 2 || get_string(script, r[1], arena, NULL, &str, &empty) < 0 || str == NULL)
+      goto corrupt;
+    script->next = r + 2;
+    return parse_line(arena, vars, str, pipeline) < 0 ? -1 : 1;
+  }
+
+  if (left < 2 || r[0] == 0)
+    goto corrupt;
+  int num_commands = (int) r[0], i, j;
+  pipeline->bg = r[1] != 0;
+  pipeline->num_commands = num_commands;
+  pipeline->commands = (command_t *) arena_alloc(arena, (size_t) num_commands * sizeof(command_t));
+  if (pipeline->commands == NULL)
+    goto out_of_memory;
+  r += 2;
+  left -= 2;
+  for (i = 0; i < num_commands; i++) {
+    command_t *command = &pipeline->commands[i];
+    if (left < 3 || left - 3 < r[0] || (left - 3 - r[0]) / 2 < r[2])
+      goto corrupt;
+    size_t argc = r[0], num_outputs = r[2];
+    const uint32_t *words = r + 3 + 2 * num_outputs;
+    // a file name that expands to nothing is an error, but the rest of the line is still read
+    if ((error = get_string(script, r[1], arena, vars, &command->file_in, &empty)) < 0)
+      goto fail;
+    int ambiguous = empty;
+    command->num_outputs = (int) num_outputs;
+    command->outputs = NULL;
+    if (num_outputs > 0) {
+      output_t *outputs = (output_t *) arena_alloc(arena, num_outputs * sizeof(output_t));
+      if (outputs == NULL)
+	goto out_of_memory;
+      for (j = 0; j < (int) num_outputs; j++) {
+	const uint32_t *o = r + 3 + 2 * j;
+	if ((error = get_string(script, o[0], arena, vars, &outputs[j].file, &empty)) < 0 || outputs[j].file == NULL)
+	  goto fail;
+	ambiguous |= empty;
+	outputs[j].trunc = o[1] != 0;
+	outputs[j].next = j + 1 < (int) num_outputs ? &outputs[j + 1] : NULL;
+      }
+      command->outputs = outputs;
+    }
+    size_t cap = argc;
+    command->argv = (char **) arena_alloc(arena, (cap + 1) * sizeof(char *));
+    if (command->argv == NULL)
+      goto out_of_memory;
+    command->argc = 0;
+    for (j = 0; j < (int) argc; j++) {
+      if ((error = get_string(script, words[j], arena, vars, &str, &empty)) < 0 || str == NULL)
+	goto fail;
+      if (empty)
+	continue;
+      char **paths;
+      int num_paths = words[j] & EXPAND_BIT ? expand_glob(arena, vars, str, &paths) : 0;
+      if (num_paths < 0)
+	goto out_of_memory;
+      if (num_paths == 0) {
+	command->argv[command->argc++] = str;
+	continue;
+      }
+      // the words matched take the place of one, so argv grows to hold them and those left
+      size_t needed = (size_t) command->argc + (size_t) num_paths + (argc - (size_t) j - 1);
+      if (needed > cap) {
+	char **argv = (char **) arena_alloc(arena, (needed + 1) * sizeof(char *));
+	if (argv == NULL)
+	  goto out_of_memory;
+	memcpy(argv, command->argv, (size_t) command->argc * sizeof(char *));
+	command->argv = argv;
+	cap = needed;
+      }
+      memcpy(command->argv + command->argc, paths, (size_t) num_paths * sizeof(char *));
+      command->argc += num_paths;
+    }
+    command->argv[command->argc] = NULL;
+    r = words + argc;
+    left -= 3 + 2 * num_outputs + argc;
+    if (ambiguous)
+      error = 1;
+  }
+  script->next = r;
+  if (error) {
+    write(STDERR_FILENO, "sh: Ambiguous redirect\n", 23);
+    return -1;
+  }
+
+  // as in parse_line(), a line whose words all expanded to nothing is blank
+  command_t *first = &pipeline->commands[0];
+  if (num_commands == 1 && first->argc == 0 && first->file_in == NULL && first->outputs == NULL) {
+    pipeline->num_commands = 0;
+    return 1;
+  }
+  for (i = 0; i < num_commands; i++) {
+    if (pipeline->commands[i].argc == 0) {
+      write(STDERR_FILENO, "sh: Invalid null command\n", 25);
+      return -1;
+    }
+  }
+  return 1;
+
+fail:
+  if (error == -2)
+    goto out_of_memory;
+corrupt:
+  write(STDERR_FILENO, "sh: Corrupt script cache\n", 25);
+  script->next = script->end;
+  return -1;
+out_of_memory:
+  write(STDERR_FILENO, "sh: Out of memory\n", 18);
+  script->next = script->end;
+  return -1;
+}
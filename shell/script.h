@@ -0,0 +1,31 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "arena.h"
+#include "parse.h"
+#include "vars.h"
+
+typedef struct script script_t;
+
+/*
+ * opens the compiled form of the script at path, which is open as fd, from the cache directory
+ * cache_dir. if there is none, or the script has changed since it was compiled, the script is
+ * compiled and the cache is replaced
+ * returns pointer, or NULL if the script cannot be compiled, in which case it is read as usual
+ */
+script_t *open_script(const char *path, int fd, const char *cache_dir);
+/*
+ * unmaps the compiled script
+ * Note: this function will free the script pointer
+ */
+void close_script(script_t *script);
+
+/*
+ * gets the next command line of the script into pipeline, allocated from arena like
+ * parse_line(), expanding the variables it refers to with vars and the wildcards of its words
+ * returns 1 on success, 0 at the end of the script, -1 if the line is malformed, after printing
+ * an error message
+ */
+int next_command(script_t *script, arena_t *arena, var_store_t *vars, pipeline_t *pipeline);
+
+#endif
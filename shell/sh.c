@@ -8,56 +8,302 @@
 #include <errno.h>
 #include <stdio.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
 #include "jobs.h"
+#include "path.h"
+#include "reader.h"
+#include "arena.h"
+#include "parse.h"
+#include "utils.h"
+#include "history.h"
+#include "vars.h"
+#include "script.h"
+#include "trace.h"
+#include "wildcard.h"
+#include "timer.h"
 
 #ifndef BUF_SIZE
 #define BUF_SIZE 1024
 #endif
+// bytes read at a time from a script, or from standard input when it is not a terminal
+#ifndef SCRIPT_BLOCK
+#define SCRIPT_BLOCK 65536
+#endif
+// number of sets of posix_spawn() file actions kept by launch()
+#define ACTION_CACHE_SIZE 8
+
+// seconds the parallel builtin waits before it looks at the load average again
+#define LOAD_RECHECK 1
+// a coprocess worker that exits sooner than this without answering anything is not restarted
+#define WORKER_MIN_LIFE 1.0
+// size asked for the pipe that feeds a command's output files when it has more than one
+#define FAN_OUT_PIPE_SIZE (1 << 20)
+// milliseconds in a tick of the timer wheel of every and at, the finest interval they can use
+#define TIMER_TICK_MS 10
+
+#ifndef EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE 1024 // must be a power of two
+#endif
+
+/* a change in the state of a child process, as reaped by child_handler() */
+typedef struct {
+  pid_t pid;
+  int status;
+  struct rusage usage;
+} child_event_t;
+
+/* a command run by the shell itself, or in a child process of the shell in a pipeline */
+typedef struct {
+  const char *name;
+  int (*run)(int argc, char **argv);
+} builtin_t;
+
+/* a command of a pipeline being run */
+typedef struct {
+  command_t *command;
+  const builtin_t *builtin; // NULL for an external command
+  char *path;     // where the program of an external command was found
+  int fd_in;      // opened by file_redirect()
+  int fd_out;
+  int fan_in;     // the read end of the pipe fd_out writes to when there are several output files
+  int *fds_out;   // those output files, which a fan-out process copies the pipe to
+  int num_out;
+} stage_t;
+
+/* a command line run by the parallel builtin */
+typedef struct {
+  char *line;
+  pid_t pgid;              // the process group of its job while it runs, 0 if it never started
+  int status;              // exit status, or 128 plus the number of the signal that terminated it
+  struct timespec start;
+  double seconds;
+} batch_cmd_t;
+
+/* the commands of a parallel builtin while it runs. slots holds the index in cmds of each
+ * running command, or -1 for a free slot
+ */
+typedef struct {
+  batch_cmd_t *cmds;
+  size_t num_cmds;
+  size_t cap;
+  long *slots;
+  int num_slots;
+  int running;
+} batch_t;
+
+/* a worker process of the coprocess pool, with a pipe to its standard input and one from its
+ * standard output */
+typedef struct {
+  pid_t pid;          // 0 once it has exited and was not started again
+  int to;             // -1 once the worker can no longer be used
+  int from;
+  long request;       // the request it is answering, or -1 if it is idle
+  char *buf;          // what it has printed of its answer so far
+  size_t len;
+  size_t cap;
+  struct timespec start;
+  unsigned long served;
+} worker_t;
+
+/* a request of coproc send, kept until it can be printed in the order the requests were read */
+typedef struct {
+  char *text;         // the answer, ending with a newline
+  size_t len;
+  int state;          // 0 while it is being answered, 1 once answered, 2 if its worker was lost
+} response_t;
+
+/* the coprocess pool: num_workers copies of the command argv, which is found at path. The
+ * requests of a running coproc send from number first on are in responses
+ */
+typedef struct {
+  char **argv;
+  char *path;
+  char *command;      // the name of the workers in the job list
+  worker_t *workers;
+  int num_workers;
+  response_t *responses;
+  size_t first;
+  size_t num_responses;
+  size_t cap;
+  char *out;          // the answers waiting to be written to standard output
+  size_t out_len;
+  size_t out_cap;
+} pool_t;
+
+/* a command line run by every or at once its timer is due */
+typedef struct sched {
+  wheel_timer_t timer;     // first, so that a due timer is its command
+  int id;
+  char *line;
+  uint64_t interval;       // ticks between runs, 0 for a command that runs once
+  int jid;                 // the job of its last run, 0 if it has not run yet
+  pid_t pgid;
+  unsigned long runs;
+  unsigned long skipped;   // runs left out because the last one was still active
+  struct sched *next;
+} sched_t;
 
 extern int errno;
-pid_t fg_pid;
+volatile pid_t fg_pid;
 job_list_t *my_jobs;
+path_cache_t *my_commands;
+history_t *my_history; // NULL if the command lines are not recorded
+var_store_t *my_vars;
 int next_id;
-int status;
+char wd[BUF_SIZE]; // the current working directory
+job_usage_t fg_usage; // the resources used by the last foreground job to exit
+int fg_exited;        // set when the foreground job exits or is terminated, rather than stopped
+batch_t *my_batch; // the batch of the parallel builtin, NULL unless it is running
+pool_t *my_pool;   // the workers started by coproc start, NULL if there are none
+timer_wheel_t *my_timers; // the timers of every and at, NULL until the first is scheduled
+sched_t *my_scheds;       // the commands they run, in the order they were scheduled
+int next_sched_id = 1;
+volatile sig_atomic_t interrupted;
+
+/* ring buffer of child events. child_handler() is the only writer of event_tail and
+ * drain_events() the only writer of event_head, so neither needs a lock. events_overflow
+ * is set when the handler finds the buffer full and leaves the remaining children unreaped
+ */
+child_event_t events[EVENT_QUEUE_SIZE];
+volatile sig_atomic_t event_head, event_tail, events_overflow;
 
-/* handler for SIGCONT, which is sent by child processes the to parent when there is
- * a change in their process state
+/* handler for SIGCHLD, which is sent by child processes to the parent when there is
+ * a change in their process state. it only reaps the children with wait4() and queues
+ * their status and resource usage for drain_events(), since the job list cannot be
+ * touched safely from a signal handler
  */
 void child_handler(int signum) {
-  pid_t child_pid;
-  if (signum == SIGCHLD) {
-    while((child_pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-      if (WIFEXITED(status)) {
-	remove_job_pid(my_jobs, child_pid);
-	if (fg_pid == child_pid)
-	  fg_pid = 0;
-      } else if (WIFSIGNALED(status)) {
-	int signal = WTERMSIG(status);
-	int jid = get_job_jid(my_jobs, child_pid);
-	char term_msg[100];
-	char *template = "\nsh: Job [%d] (%d) terminated by signal %d\n";
-	sprintf(term_msg, template, jid, child_pid, signal);
-	write(STDOUT_FILENO, term_msg, strlen(term_msg));
-	remove_job_pid(my_jobs, child_pid);
-	if (fg_pid == child_pid) {
-	  fg_pid = 0;
-	}
-      } else if (WIFSTOPPED(status)) {
-	update_job_pid(my_jobs, child_pid, _STATE_STOPPED);
-	if (fg_pid == child_pid) {
-	  fg_pid = 0;
-	}
-      } else if (WIFCONTINUED(status)) {
-	update_job_pid(my_jobs, child_pid, _STATE_RUNNING);
-      }
+  int saved_errno = errno;
+  (void) signum;
+  for (;;) {
+    int next = (event_tail + 1) & (EVENT_QUEUE_SIZE - 1);
+    if (next == event_head) {
+      events_overflow = 1;
+      break;
+    }
+    child_event_t *event = &events[event_tail];
+    event->pid = wait4(-1, &event->status, WNOHANG | WUNTRACED | WCONTINUED, &event->usage);
+    if (event->pid <= 0)
+      break;
+    if (WIFSTOPPED(event->status)) {
+      TRACE("stop", 'i', "pid", event->pid, NULL);
+    } else if (WIFCONTINUED(event->status)) {
+      TRACE("continue", 'i', "pid", event->pid, NULL);
+    } else {
+      TRACE("exit", 'i', "status", event->status, NULL);
+      TRACE("process", 'e', "pid", event->pid, NULL);
+    }
+    __atomic_signal_fence(__ATOMIC_SEQ_CST); // publish the event before the index
+    event_tail = next;
+  }
+  errno = saved_errno;
+}
+
+/* returns the number of seconds from start to end */
+double elapsed(struct timespec *start, struct timespec *end) {
+  return (double) (end->tv_sec - start->tv_sec) + (double) (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* batch_done records the exit status of the job whose pid is job_pid, if it was started by the
+ * parallel builtin, and frees its slot for the next command
+ */
+void batch_done(pid_t job_pid, int status) {
+  if (my_batch == NULL)
+    return;
+  int i;
+  for (i = 0; i < my_batch->num_slots; i++) {
+    long c = my_batch->slots[i];
+    if (c >= 0 && my_batch->cmds[c].pgid == job_pid) {
+      batch_cmd_t *cmd = &my_batch->cmds[c];
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      cmd->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+      cmd->seconds = elapsed(&cmd->start, &now);
+      my_batch->slots[i] = -1;
+      my_batch->running--;
+      return;
+    }
+  }
+}
+
+void pool_done(pid_t job_pid, int status);
+void run_timers();
+void wait_input(int fd);
+
+/* handle_event updates the job list for one child event, prints a notification if
+ * the process was terminated by a signal, and resets fg_pid if the foreground job exited,
+ * was terminated or stopped. The resource usage of an exited process is added to its job,
+ * and kept in fg_usage once the whole foreground job is done
+ */
+void handle_event(child_event_t *event) {
+  pid_t child_pid = event->pid;
+  int status = event->status;
+  if (WIFEXITED(status) || WIFSIGNALED(status)) {
+    // an earlier stage of a pipeline killed by SIGPIPE just means a later one stopped reading
+    if (WIFSIGNALED(status) && WTERMSIG(status) != SIGPIPE) {
+      int signal = WTERMSIG(status);
+      int jid = get_job_jid(my_jobs, child_pid);
+      char term_msg[100];
+      char *template = "\nsh: Job [%d] (%d) terminated by signal %d\n";
+      sprintf(term_msg, template, jid, child_pid, signal);
+      write(STDOUT_FILENO, term_msg, strlen(term_msg));
+    }
+    // a pipeline is done once its last process is gone
+    job_usage_t usage;
+    pid_t job_pid = remove_job_process(my_jobs, child_pid, &event->usage, &usage);
+    if (job_pid > 0 && fg_pid == job_pid) {
+      fg_pid = 0;
+      fg_usage = usage;
+      fg_exited = 1;
+    }
+    if (job_pid > 0) {
+      batch_done(job_pid, status);
+      pool_done(job_pid, status);
+    }
+  } else if (WIFSTOPPED(status)) {
+    update_job_pid(my_jobs, child_pid, STATE_STOPPED);
+    if (fg_pid && get_job_pid(my_jobs, get_job_jid(my_jobs, child_pid)) == fg_pid) {
+      fg_pid = 0;
+    }
+  } else if (WIFCONTINUED(status)) {
+    update_job_pid(my_jobs, child_pid, STATE_RUNNING);
+  }
+}
+
+/* drain_events handles every event queued by child_handler() in one batch. if the
+ * handler ran out of room, the children it left behind are reaped here with SIGCHLD
+ * blocked, so that the handler cannot interrupt and write to the queue at the same time
+ */
+void drain_events() {
+  for (;;) {
+    while (event_head != event_tail) {
+      handle_event(&events[event_head]);
+      __atomic_signal_fence(__ATOMIC_SEQ_CST); // finish with the event before freeing it
+      event_head = (event_head + 1) & (EVENT_QUEUE_SIZE - 1);
     }
+    if (!events_overflow)
+      break;
+
+    sigset_t set, oldset;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, &oldset);
+    events_overflow = 0;
+    child_handler(SIGCHLD);
+    sigprocmask(SIG_SETMASK, &oldset, NULL);
   }
 }
 
 /* handler for SIGINT, SIGTSTP, and SIGQUIT */
 void handler(int signum) {
+  if (signum == SIGINT)
+    interrupted = 1;
   if (fg_pid > 0) {
     kill(-fg_pid, signum);
   }
@@ -82,68 +328,19 @@ int install_handler(int signum, void (*handler)(int)) {
 }
 
 
-/* parse_redirect searches the user input pointed to by ptr for the redirection characters and
- * stores the redirection pathname to file, which is a pointer to a string initialized in the main
- * method so that it can be accessed after it leaves the scope. It does error checking for
- * multiple redirection and usage, and returns -1 on failure, 0 on success.
- *
- * ptr - a pointer to the current char pointer in main
- * dir_string - a cstring indicating the direction (i.e. input or output);
- * is_multiple - a boolean (int) indicating whether or not there has already been a file redirection
- *     in the specified direction;
- * file - a pointer to a string initialized in the main that will be malloced in this function
- *     indicating the path of the redirection file
- * trunc - a boolean indicating whether to truncate or append the output
- */
-int parse_redirect (char **ptr, char *dir_str, int *is_multiple, char **file, int *trunc) {
-  char err_msg[50];
-
-  if (*is_multiple) {
-    sprintf(err_msg, "sh: Multiple %s redirects\n", dir_str);
-    write(STDERR_FILENO, err_msg, strlen(err_msg));
-    return -1;
-  } else {
-    if (**ptr == '>' && *(*ptr + 1) == '>') { // check if >> rather than >
-      *trunc = 0;
-      *ptr += 2;
-    } else (*ptr)++;
-
-    *is_multiple = 1;
-    *ptr += strspn(*ptr, " \t");
-    
-    if (**ptr == '<' || **ptr == '>' || **ptr == '\0') { // no file after redirection symbol
-      strcpy(err_msg, "sh: No redirection file specified\n");
-      write(STDERR_FILENO, err_msg, strlen(err_msg));
-      return -1;
-    } else {
-      size_t path_len = strcspn(*ptr, " \t<>");
-      *file = (char *) malloc(path_len + 1);
-      strncpy(*file, *ptr, path_len);
-      *(*file + path_len) = '\0';
-      *ptr += path_len; // update the char pointer to the position in buf after the filename
-    }
-  }
-  return 0;
-}
-
 /* exec_cd executes the built-in command cd using chdir()
  *
- * argc - number of arguments
- * args - string of all the arguments
- * wd - a string representing the current working directory
+ * argc - number of words
+ * argv - the command and its arguments
  */
-int exec_cd(int argc, char **args, char *wd) {
-  if (argc != 1) {
+int exec_cd(int argc, char **argv) {
+  if (argc != 2) {
     write(STDERR_FILENO, "cd: Usage: cd <dir>\n", 20);
     return -1;
   } else {
-    size_t arg_len = strcspn(*args, " \t");
-    char arg[arg_len + 1];
-    arg[0] = '\0';
-    strncat(arg, *args, arg_len);
-    if(chdir(arg) < 0) {
-      char err_msg[arg_len + 5];
-      sprintf(err_msg, "cd: %s", arg);
+    if(chdir(argv[1]) < 0) {
+      char err_msg[strlen(argv[1]) + 5];
+      sprintf(err_msg, "cd: %s", argv[1]);
       perror(err_msg);
       return -1;
     }
@@ -152,39 +349,25 @@ int exec_cd(int argc, char **args, char *wd) {
   return 0;
 }
 
-/* exec_ln executes the built-in ln command using link(). It parses the args string by
- * separating the arguments on whitespace
+/* exec_ln executes the built-in ln command using link().
  *
- * argc - argument count
- * args - string of the arguments from user input
+ * argc - number of words
+ * argv - the command and its arguments
  */
-int exec_ln(int argc, char **args) {
-  if (argc != 2) {
-    write(STDERR_FILENO, "ln: Usage: ln <src> <dest>\n", 28);
+int exec_ln(int argc, char **argv) {
+  if (argc != 3) {
+    write(STDERR_FILENO, "ln: Usage: ln <src> <dest>\n", 27);
     return -1;
   } else {
-    size_t arg_len = strcspn(*args, " \t");
-    char arg1[arg_len + 1];
-    arg1[0] = '\0';
-    strncat(arg1, *args, arg_len);
-
-    char *argptr = *args;
-    argptr += arg_len;
-    argptr += strspn(argptr, " \t");
-    arg_len = strcspn(argptr, " \t");
-    char arg2[arg_len + 1];
-    arg2[0] = '\0';
-    strncat(arg2, argptr, arg_len);
-
-    int link_error = link(arg1, arg2);
-    if (errno == ENOENT) {
-      char err_msg[strlen(arg1) + 5];
-      sprintf(err_msg, "ln: %s", arg1);
+    int link_error = link(argv[1], argv[2]);
+    if (link_error < 0 && errno == ENOENT) {
+      char err_msg[strlen(argv[1]) + 5];
+      sprintf(err_msg, "ln: %s", argv[1]);
       perror(err_msg);
       return -1;
-    } else if (errno == EEXIST) {
-      char err_msg[strlen(arg2) + 5];
-      sprintf(err_msg, "ln: %s", arg2);
+    } else if (link_error < 0 && errno == EEXIST) {
+      char err_msg[strlen(argv[2]) + 5];
+      sprintf(err_msg, "ln: %s", argv[2]);
       perror(err_msg);
       return -1;
     } else if (link_error < 0) {
@@ -197,21 +380,17 @@ int exec_ln(int argc, char **args) {
 
 /* exec_rm executes the built-in rm command using unlink().
  *
- * argc - argument count
- * args - string of the arguments from user input
+ * argc - number of words
+ * argv - the command and its arguments
  */
-int exec_rm(int argc, char **args) {
-  if (argc != 1) {
+int exec_rm(int argc, char **argv) {
+  if (argc != 2) {
     write(STDERR_FILENO, "rm: Usage: rm <file>\n", 21);
     return -1;
   } else {
-    size_t arg_len = strcspn(*args, " \t");
-    char arg[arg_len + 1];
-    arg[0] = '\0';
-    strncat(arg, *args, arg_len);
-    if (unlink(arg)) {
-      char err_msg[arg_len + 5];
-      sprintf(err_msg, "rm: %s", arg);
+    if (unlink(argv[1])) {
+      char err_msg[strlen(argv[1]) + 5];
+      sprintf(err_msg, "rm: %s", argv[1]);
       perror(err_msg);
       return -1;
     }
@@ -220,31 +399,60 @@ int exec_rm(int argc, char **args) {
 }
 
 
+/* wait_fg suspends the shell until the foreground job has exited, been terminated or
+ * stopped, handling the events queued by child_handler() each time it wakes up until one
+ * of them resets fg_pid. SIGCHLD is blocked while fg_pid is checked and only unblocked
+ * atomically inside sigsuspend(), so a child that changes state between the check and
+ * the suspension still wakes the shell
+ */
+void wait_fg() {
+  sigset_t set, oldset, waitset;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, &oldset);
+  waitset = oldset;
+  sigdelset(&waitset, SIGCHLD);
+  TRACE("wait", 'B', "pgid", fg_pid, NULL);
+  drain_events();
+  while (fg_pid) {
+    // the commands of every and at still start while a job runs in the foreground
+    if (my_timers != NULL && num_timers(my_timers) > 0) {
+      struct pollfd fd = {timer_wheel_fd(my_timers), POLLIN, 0};
+      if (ppoll(&fd, 1, NULL, &waitset) > 0)
+	run_timers();
+    } else {
+      sigsuspend(&waitset);
+    }
+    drain_events();
+  }
+  TRACE("wait", 'E', NULL, 0, NULL);
+  sigprocmask(SIG_SETMASK, &oldset, NULL);
+}
+
 void reassign_tc(pid_t pid) {
   sigset_t sigttou, oldset;
   sigemptyset(&sigttou);
   sigaddset(&sigttou, SIGTTOU);
 
+  TRACE("tcsetpgrp", 'B', "pgid", pid, NULL);
   sigprocmask(SIG_BLOCK, &sigttou, &oldset);
   tcsetpgrp(STDIN_FILENO, pid);
   sigprocmask(SIG_UNBLOCK, &sigttou, &oldset);
+  TRACE("tcsetpgrp", 'E', NULL, 0, NULL);
 }
 
 /* exec_bg sends the SIGCONT signal to a job and immediately continues so that
  * the job will run in the background
  *
- * argc - arc count
- * args - string of arguments from user input
+ * argc - number of words
+ * argv - the command and its arguments
  */
- int exec_bg(int argc, char **args) {
-  if (argc != 1) {
+ int exec_bg(int argc, char **argv) {
+  if (argc != 2) {
     write(STDERR_FILENO, "bg: Usage: bg <job>\n", 20);
     return -1;
   } else {
-    size_t arg_len = strcspn(*args, " \t");
-    char arg[arg_len + 1];
-    arg[0] = '\0';
-    strncat(arg, *args, arg_len);
+    char *arg = argv[1];
     int pid;
     if (*arg == '%') {
       pid = get_job_pid(my_jobs, atoi(arg + 1));
@@ -253,8 +461,8 @@ void reassign_tc(pid_t pid) {
 	return -1;
       }
     } else {
-      pid = atoi(arg);
-      if (get_job_jid(my_jobs, pid) < 0) {
+      pid = get_job_pid(my_jobs, get_job_jid(my_jobs, atoi(arg)));
+      if (pid < 0) {
 	write(STDERR_FILENO, "bg: Process ID not found\n", 25);
 	return -1;
       }
@@ -265,21 +473,18 @@ void reassign_tc(pid_t pid) {
   return 0;
 }
 
-/* exec_fg sends the SIGCONT signal to a job and then executes a busy loop
+/* exec_fg sends the SIGCONT signal to a job and then waits for it with wait_fg()
  * so that the job will run in the foreground
  *
- * argc - argcount
- * args - string of arguments from user input
+ * argc - number of words
+ * argv - the command and its arguments
  */
-int exec_fg(int argc, char **args) {
-  if (argc != 1) {
+int exec_fg(int argc, char **argv) {
+  if (argc != 2) {
     write(STDERR_FILENO, "fg: Usage: fg <job>\n", 20);
     return -1;
   } else {
-    size_t arg_len = strcspn(*args, " \t");
- char arg[arg_len + 1];
-    arg[0] = '\0';
-    strncat(arg, *args, arg_len);
+    char *arg = argv[1];
     int pid;
     if (*arg == '%') {
       pid = get_job_pid(my_jobs, atoi(arg + 1));
@@ -288,8 +493,8 @@ int exec_fg(int argc, char **args) {
 	return -1;
       }
     } else {
-      pid = atoi(arg);
-      if (get_job_jid(my_jobs, pid) < 0) {
+      pid = get_job_pid(my_jobs, get_job_jid(my_jobs, atoi(arg)));
+      if (pid < 0) {
 	write(STDERR_FILENO, "fg: Process ID not found\n", 25);
 	return -1;
 	 }
@@ -297,287 +502,2005 @@ int exec_fg(int argc, char **args) {
     fg_pid = pid;
     reassign_tc(pid);
     kill(-pid, SIGCONT);
-    while (fg_pid) sleep(1);
+    wait_fg();
     reassign_tc(getpgid(getpid()));
   }
   return 0;
 }
 
-int exec_builtin(int argc, char **cmd, char **args, char *wd) {
-    if (strcmp(*cmd, "cd") == 0) {
-      exec_cd(argc, args, wd);
-    } else if (strcmp(*cmd, "ln") == 0) {
-      exec_ln(argc, args);
-    } else if (strcmp(*cmd, "rm") == 0) {
-      exec_rm(argc, args);
-    } else if (strcmp(*cmd, "bg") == 0) {
-      exec_bg(argc, args);
-    } else if (strcmp(*cmd, "fg") == 0) {
-      exec_fg(argc, args);
-    } else if (strcmp(*cmd, "jobs") == 0) {
-      jobs(my_jobs);
-    } else if (strcmp(*cmd, "exit") == 0) {
-      return 1;
-    } else {
-      return -1;
+/* exec_hash executes the built-in hash command. With no arguments it prints the cached
+ * locations of commands found in PATH, with -r it empties the cache, and otherwise it looks up
+ * each argument and adds its location to the cache
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_hash(int argc, char **argv) {
+  if (argc == 1) {
+    print_path_cache(my_commands);
+    return 0;
+  }
+
+  int error = 0, i;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      reset_path_cache(my_commands);
+    } else if (strchr(argv[i], '/') == NULL && find_command(my_commands, get_var(my_vars, "PATH", 4), argv[i]) == NULL) {
+      char err_msg[strlen(argv[i]) + 20];
+      sprintf(err_msg, "hash: %s: not found\n", argv[i]);
+      write(STDERR_FILENO, err_msg, strlen(err_msg));
+      error = -1;
     }
+  }
+  return error;
+}
+
+/* exec_jobs executes the built-in jobs command, which lists the jobs, with the CPU time and peak
+ * memory used by each if given -l
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_jobs(int argc, char **argv) {
+  if (argc == 1) {
+    jobs(my_jobs);
+  } else if (argc == 2 && strcmp(argv[1], "-l") == 0) {
+    jobs_long(my_jobs);
+  } else {
+    write(STDERR_FILENO, "jobs: Usage: jobs [-l]\n", 23);
+    return -1;
+  }
   return 0;
 }
 
-/* file_redirect opens the specified redirection files, uses dup2() to replace the standard file(s), and closes
- * the newly opened file. It also frees the filename char arrays malloc-ed in parse_redirect().
+/* exec_history executes the built-in history command. With no arguments it prints every command
+ * line recorded in the history file, with a number it prints that many of the last ones, and with
+ * -r <prefix> it prints the newest different lines that start with prefix (10 unless a number
+ * follows)
  *
- * input_redirect - boolean indicating whether or not there is input redirection
- * output_redirect - boolean indicating whether or not there is output redirection
- * file_in - pointer to the buffer in which the input filename is stored
- * file_out - pointer to the buffer in which the output filename is stored
- * trunc_file - boolean indicating whether the output file should be truncated
- */
-int file_redirect(int input_redirect, int output_redirect, char **file_in, char **file_out, int trunc_file) {
-  if (input_redirect) {
-    int fd = open(*file_in, O_RDONLY);
-    if (fd < 0) {
-      char err_msg[strlen(*file_in) + 5];
-      sprintf(err_msg, "sh: %s", *file_in);
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_history(int argc, char **argv) {
+  if (my_history == NULL) {
+    write(STDERR_FILENO, "history: No history file\n", 25);
+    return -1;
+  }
+  if (argc == 1) {
+    print_history(my_history, 0);
+  } else if (argc == 2 && argv[1][0] != '-') {
+    print_history(my_history, (size_t) atol(argv[1]));
+  } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "-r") == 0) {
+    print_history_matches(my_history, argv[2], strlen(argv[2]), argc == 4 ? (size_t) atol(argv[3]) : 10);
+  } else {
+    write(STDERR_FILENO, "history: Usage: history [n] or history -r <prefix> [n]\n", 55);
+    return -1;
+  }
+  return 0;
+}
+
+/* exec_export executes the built-in export command. With no arguments it prints the exported
+ * variables, otherwise each NAME=value argument sets and exports a variable, and each NAME
+ * argument exports a variable that is already set
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_export(int argc, char **argv) {
+  if (argc == 1) {
+    print_exports(my_vars);
+    return 0;
+  }
+
+  int error = 0, i;
+  for (i = 1; i < argc; i++) {
+    char *equals = strchr(argv[i], '=');
+    size_t name_len = equals != NULL ? (size_t) (equals - argv[i]) : strlen(argv[i]);
+    if (!valid_var_name(argv[i], name_len)) {
+      char err_msg[strlen(argv[i]) + 40];
+      sprintf(err_msg, "export: %s: Not a valid variable name\n", argv[i]);
+      write(STDERR_FILENO, err_msg, strlen(err_msg));
+      error = -1;
+    } else if (equals != NULL) {
+      *equals = '\0';
+      if (set_var(my_vars, argv[i], equals + 1, 1) < 0)
+	error = -1;
+      *equals = '=';
+    } else if (export_var(my_vars, argv[i]) < 0) {
+      error = -1;
+    }
+  }
+  return error;
+}
+
+/* exec_unset executes the built-in unset command, which removes each variable given
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_unset(int argc, char **argv) {
+  int i;
+  for (i = 1; i < argc; i++)
+    unset_var(my_vars, argv[i]);
+  return 0;
+}
+
+/* exec_exit executes the built-in exit command, returns 1 so that the shell quits */
+int exec_exit(int argc, char **argv) {
+  (void) argc;
+  (void) argv;
+  return 1;
+}
+
+int exec_parallel(int argc, char **argv);
+int exec_coproc(int argc, char **argv);
+int exec_every(int argc, char **argv);
+int exec_at(int argc, char **argv);
+
+/* the built-in commands, sorted by name for find_builtin() */
+static const builtin_t builtins[] = {
+  {"[", exec_test},
+  {"at", exec_at},
+  {"bg", exec_bg},
+  {"cat", exec_cat},
+  {"cd", exec_cd},
+  {"coproc", exec_coproc},
+  {"echo", exec_echo},
+  {"every", exec_every},
+  {"exit", exec_exit},
+  {"export", exec_export},
+  {"false", exec_false},
+  {"fg", exec_fg},
+  {"hash", exec_hash},
+  {"history", exec_history},
+  {"jobs", exec_jobs},
+  {"ln", exec_ln},
+  {"mkdir", exec_mkdir},
+  {"parallel", exec_parallel},
+  {"printf", exec_printf},
+  {"rm", exec_rm},
+  {"sleep", exec_sleep},
+  {"test", exec_test},
+  {"true", exec_true},
+  {"unset", exec_unset}
+};
+
+static int compare_builtin(const void *name, const void *builtin) {
+  return strcmp((const char *) name, ((const builtin_t *) builtin)->name);
+}
+
+/* find_builtin returns the built-in command called cmd, or NULL if it is not one */
+const builtin_t *find_builtin(const char *cmd) {
+  return (const builtin_t *) bsearch(cmd, builtins, sizeof(builtins) / sizeof(builtin_t), sizeof(builtin_t), compare_builtin);
+}
+
+/* close_redirects closes the redirection files of stage opened by file_redirect() that are
+ * still open */
+void close_redirects(stage_t *stage) {
+  int i;
+  if (stage->fd_in >= 0) close(stage->fd_in);
+  if (stage->fd_out >= 0) close(stage->fd_out);
+  if (stage->fan_in >= 0) close(stage->fan_in);
+  for (i = 0; i < stage->num_out; i++)
+    close(stage->fds_out[i]);
+  stage->fd_in = stage->fd_out = stage->fan_in = -1;
+  stage->num_out = 0;
+}
+
+/* file_redirect opens the redirection files of the command of stage in the shell, before the
+ * child process is created, and stores the new file descriptors in stage->fd_in and stage->fd_out
+ * (or -1 if there is no redirection in that direction). The descriptors are opened close-on-exec,
+ * so only the copies that replace the child's standard files survive execve(). A command with
+ * several output files writes to a pipe instead, whose read end is kept in stage->fan_in for
+ * fork_fan_out(), and the files are kept in stage->fds_out. A file given with >> is still opened
+ * for appending, so that its writes land at its end even if another process appends to it too;
+ * splice() cannot write to such a file, and copy_block() gives it the output with write().
+ *
+ * stage - the stage whose redirections are opened
+ * arena - the arena of the command line, from which stage->fds_out is allocated
+ */
+int file_redirect(stage_t *stage, arena_t *arena) {
+  command_t *command = stage->command;
+  int fan_out = command->num_outputs > 1;
+  stage->fd_in = stage->fd_out = stage->fan_in = -1;
+  stage->num_out = 0;
+  if (command->file_in) {
+    stage->fd_in = open(command->file_in, O_RDONLY | O_CLOEXEC);
+    if (stage->fd_in < 0) {
+      char err_msg[strlen(command->file_in) + 5];
+      sprintf(err_msg, "sh: %s", command->file_in);
       perror(err_msg);
       return -1;
     }
-    dup2(fd, STDIN_FILENO);
-    close(fd);
-    free(*file_in);
   }
-  if (output_redirect) {
-    int fd;
-    if (trunc_file) fd = open(*file_out, O_WRONLY | O_TRUNC | O_CREAT, S_IRWXU);
-    else fd = open(*file_out, O_WRONLY | O_APPEND | O_CREAT, S_IRWXU);
+  if (fan_out) {
+    stage->fds_out = (int *) arena_alloc(arena, (size_t) command->num_outputs * sizeof(int));
+    if (stage->fds_out == NULL) {
+      write(STDERR_FILENO, "sh: Out of memory\n", 18);
+      close_redirects(stage);
+      return -1;
+    }
+  }
+  output_t *output;
+  for (output = command->outputs; output != NULL; output = output->next) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (output->trunc ? O_TRUNC : O_APPEND);
+    int fd = open(output->file, flags, S_IRWXU);
     if (fd < 0) {
-      char err_msg[strlen(*file_out) + 5];
-      sprintf(err_msg, "sh: %s\n", *file_out);
+      char err_msg[strlen(output->file) + 5];
+      sprintf(err_msg, "sh: %s", output->file);
       perror(err_msg);
+      close_redirects(stage);
+      return -1;
+    }
+    if (!fan_out) {
+      stage->fd_out = fd;
+      continue;
+    }
+    stage->fds_out[stage->num_out++] = fd;
+  }
+  if (fan_out) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+      perror("sh: pipe");
+      close_redirects(stage);
       return -1;
     }
-    dup2(fd, STDOUT_FILENO);
-    close(fd);
-    free(*file_out);
+    // a bigger pipe moves more of the output with each call, but the default size will do
+    fcntl(pipefd[1], F_SETPIPE_SZ, FAN_OUT_PIPE_SIZE);
+    stage->fan_in = pipefd[0];
+    stage->fd_out = pipefd[1];
   }
   return 0;
 }
 
-  
-
-/* argc - argument count
- * program - a string representing the program name
- * args - a string representing the arguments from user input
+/* copy_block moves len bytes from the pipe in to the file out with splice(), or with read() and
+ * write() if out is something splice() cannot write to. If out is -1, or writing to it fails, the
+ * bytes are read and thrown away, and out is set to -1 after an error message is printed.
  *
- * exec_extern executes an external program given by the program argument. It forks
- * the child process and waits for it to complete before resuming the parent process.
+ * returns 0 on success, -1 if the pipe could not be read
  */
-int exec_extern(int argc, char **program, char **args, int in, int out, char **file_in, char **file_out, int trunc_file, int bg) {
-  int argv_len = argc + 2;
-  char *argv[argv_len];
-  argv[0] = *program;
+static int copy_block(int in, int *out, size_t len, const char *name) {
+  char buf[65536];
+  int use_splice = *out >= 0;
+  while (len > 0) {
+    ssize_t n;
+    if (use_splice) {
+      n = splice(in, NULL, *out, NULL, len, SPLICE_F_MOVE);
+      if (n < 0 && errno == EINVAL) {
+	use_splice = 0;
+	continue;
+      }
+      if (n < 0 && errno != EINTR) {
+	perror(name);
+	close(*out);
+	*out = -1;
+	use_splice = 0;
+	continue;
+      }
+    } else {
+      n = read(in, buf, len < sizeof(buf) ? len : sizeof(buf));
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return -1;
+      ssize_t done = 0;
+      while (*out >= 0 && done < n) {
+	ssize_t w = write(*out, buf + done, (size_t) (n - done));
+	if (w < 0 && errno == EINTR)
+	  continue;
+	if (w < 0) {
+	  perror(name);
+	  close(*out);
+	  *out = -1;
+	  break;
+	}
+	done += w;
+      }
+    }
+    if (n > 0)
+      len -= (size_t) n;
+  }
+  return 0;
+}
 
-  int i;
-  size_t argi_len;
-  char *arg_ptr = *args;
-  for (i = 1; i < argv_len - 1; i++) {
-    arg_ptr += strspn(arg_ptr, " \t");
-    argi_len = strcspn(arg_ptr, " \t");
+/* fan_out copies everything written to the pipe in to each of the num_fds files fds, until the
+ * pipe is closed, without copying it through user space: each block in the pipe is duplicated
+ * with tee() into a scratch pipe and spliced from there into a file, and the last file gets the
+ * block itself.
+ *
+ * returns 0 on success, 1 if a file could not be written to
+ */
+static int fan_out(int in, int *fds, int num_fds) {
+  int scratch[2], i, failed = 0;
+  if (pipe2(scratch, O_CLOEXEC) < 0) {
+    perror("sh: pipe");
+    return 1;
+  }
+  // tee() duplicates a whole block only if the scratch pipe can hold as much as in
+  int size = fcntl(in, F_GETPIPE_SZ);
+  if (size > 0)
+    fcntl(scratch[1], F_SETPIPE_SZ, size);
+  for (;;) {
+    // a block of the pipe, which is left in it while it is duplicated for each file but the last
+    ssize_t len = tee(in, scratch[1], INT_MAX, 0);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len == 0)
+      break;
+    if (len < 0) {
+      perror("sh: tee");
+      return 1;
+    }
+    // the first copy is always drained from the scratch pipe, even if its file failed earlier
+    for (i = 0; i < num_fds - 1; i++) {
+      if (i > 0 && fds[i] < 0)
+	continue;
+      if (i > 0 && tee(in, scratch[1], (size_t) len, 0) != len) {
+	perror("sh: tee");
+	return 1;
+      }
+      if (copy_block(scratch[0], &fds[i], (size_t) len, "sh: fan-out") < 0)
+	return 1;
+      failed |= fds[i] < 0;
+    }
+    if (copy_block(in, &fds[num_fds - 1], (size_t) len, "sh: fan-out") < 0)
+      return 1;
+    failed |= fds[num_fds - 1] < 0;
+  }
+  return failed;
+}
 
-    argv[i] = arg_ptr;
-    arg_ptr += argi_len;
-    *arg_ptr = '\0';
-    arg_ptr ++;
+/* fork_fan_out starts the process that copies the output of stage from stage->fan_in to each of
+ * its output files, in the process group pgid (or a new one if pgid is 0), so that it belongs to
+ * the job of the stage and the job is only done once the files are complete. The shell's copies
+ * of the pipe and the files are closed.
+ *
+ * returns the pid of the child, or -1 if it could not be started
+ */
+pid_t fork_fan_out(stage_t *stage, pid_t pgid) {
+  TRACE("fork", 'B', NULL, 0, "fan-out");
+  pid_t pid = fork();
+  if (pid == 0) {
+    trace_child();
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    setpgid(0, pgid);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    if (stage->fd_out >= 0)
+      close(stage->fd_out);
+    int result = fan_out(stage->fan_in, stage->fds_out, stage->num_out);
+    flush_trace(1);
+    _exit(result);
   }
-  argv[i] = NULL;
+  if (pid > 0)
+    setpgid(pid, pgid ? pgid : pid);
+  else
+    perror("sh: fork");
+  close(stage->fan_in);
+  stage->fan_in = -1;
+  int i;
+  for (i = 0; i < stage->num_out; i++)
+    close(stage->fds_out[i]);
+  stage->num_out = 0;
+  TRACE("fork", 'E', "pid", pid, NULL);
+  if (pid > 0)
+    TRACE("process", 'b', "pid", pid, "fan-out");
+  return pid;
+}
 
-  // check if command exists before redirection to prevent clobbering
-  int test_fd = open(argv[0], O_RDONLY);
-  if (test_fd < 0) {
-    if (errno == ENOENT) {
-      char err_msg[strlen(*program) + 25];
-      sprintf(err_msg, "sh: %s: Command not found\n", *program);
-      write(STDERR_FILENO, err_msg, strlen(err_msg));
+/* run_builtin runs a builtin that is not part of a pipeline in the shell itself. While it runs,
+ * its redirection files take the place of the shell's standard input and output, which are
+ * saved with dup() and put back afterwards, so that no child process is needed. With several
+ * output files, the fan-out process that writes them is a job of its own, which is waited for
+ * once the builtin is done.
+ *
+ * returns what the builtin returned, or -1 if a redirection file could not be opened
+ */
+int run_builtin(stage_t *stage, arena_t *arena) {
+  int saved_in = -1, saved_out = -1;
+  pid_t fan_pid = 0;
+  if (file_redirect(stage, arena))
+    return -1;
+  if (stage->num_out > 0) {
+    fan_pid = fork_fan_out(stage, 0);
+    if (fan_pid < 0) {
+      close_redirects(stage);
       return -1;
     }
-  } else {
-    close(test_fd);
+    add_job(my_jobs, next_id++, fan_pid, STATE_RUNNING, stage->command->argv[0]);
+  }
+  int fd_in = stage->fd_in, fd_out = stage->fd_out;
+  if (fd_in >= 0) {
+    saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd_in, STDIN_FILENO);
+    close(fd_in);
+  }
+  if (fd_out >= 0) {
+    saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd_out, STDOUT_FILENO);
+    close(fd_out);
   }
 
-  sigset_t set, oldset;
-  sigemptyset(&set);
-  sigaddset(&set, SIGCHLD);
-  sigprocmask(SIG_BLOCK, &set, &oldset);
-  pid_t n = fork();
-  if (!bg) fg_pid = n;
-  if (!n) {
-    setpgid(0, 0);
-    sigprocmask(SIG_UNBLOCK, &set, &oldset);
-
-    if(file_redirect(in, out, file_in, file_out, trunc_file))
-      exit(EXIT_FAILURE);
-
-    execve(argv[0], argv, NULL);
-    
-    remove_job_jid(my_jobs, next_id--);
-    perror(*program);
-    exit(EXIT_FAILURE);
+  interrupted = 0;
+  TRACE("builtin", 'B', NULL, 0, stage->builtin->name);
+  int result = stage->builtin->run(stage->command->argc, stage->command->argv);
+  TRACE("builtin", 'E', NULL, 0, NULL);
+
+  // a standard file the shell did not have open is closed again
+  if (fd_in >= 0) {
+    if (saved_in >= 0) {
+      dup2(saved_in, STDIN_FILENO);
+      close(saved_in);
+    } else {
+      close(STDIN_FILENO);
+    }
   }
-  if (!bg) reassign_tc(fg_pid);
-  add_job(my_jobs, next_id++, n, _STATE_RUNNING, *program);
-  sigprocmask(SIG_UNBLOCK, &set, &oldset);
-  while(fg_pid) sleep(1);
-  reassign_tc(getpgid(getpid()));
-  return 0;
+  if (fd_out >= 0) {
+    if (saved_out >= 0) {
+      dup2(saved_out, STDOUT_FILENO);
+      close(saved_out);
+    } else {
+      close(STDOUT_FILENO);
+    }
+  }
+  stage->fd_in = stage->fd_out = -1;
+  if (fan_pid > 0) {
+    fg_pid = fan_pid;
+    wait_fg();
+  }
+  return result;
 }
 
-/* cmd_line - a string of the command line input
- * wd - a string of the current working directory
+/* launch starts the program at path in the process group pgid, or a new process group if pgid is 0, with an empty signal mask, the
+ * default action for the signals the shell handles, and fd_in and fd_out (unless -1) as its
+ * standard input and output. Its environment is the exported variables, passed as the array
+ * the variable store keeps, so it is not built for every command. It uses posix_spawn(), which glibc implements with
+ * clone(CLONE_VM | CLONE_VFORK), so the shell's page tables are not copied no matter how
+ * much memory it uses. It falls back to fork() and execve() if posix_spawn() is not
+ * supported, or always if the shell was compiled with NO_SPAWN.
  *
- * parse_command separates the command line into the command type and its arguments.
- * It checks if it is one of the built-in commands, and if it is, it calls the
- * corresponding command. Otherwise, it calls exec_exter, which is responsible for
- * executing external programs
- */
-int parse_command(char *cmd_line, char **cmd, char **cmd_args) {
-  char *curr_char = cmd_line + strspn(cmd_line, " \t");
-
-  size_t cmd_len = strcspn(curr_char, " \t");
-  *cmd = (char *) malloc(cmd_len + 1);
-  strncpy(*cmd, curr_char, cmd_len);
-  *(*cmd + cmd_len) = '\0';
-  curr_char += cmd_len;
-  curr_char += strspn(curr_char, " \t");
-
-  size_t args_len = strlen(curr_char);
-  *cmd_args = (char *) malloc(args_len + 1);
-  strncpy(*cmd_args, curr_char, args_len);
-  *(*cmd_args + args_len) = '\0';
-  
-  int arg_count = 0;
-  while (*curr_char != '\0') {
-    curr_char += strspn(curr_char, " \t");
-    if (*curr_char == '\0') break;
-    curr_char += strcspn(curr_char, " \t");
-    arg_count++;
+ * returns the pid of the child, or -1 with errno set if it could not be started
+ */
+pid_t launch(const char *path, char **argv, int fd_in, int fd_out, pid_t pgid) {
+  pid_t pid;
+  char **envp = get_envp(my_vars);
+  TRACE("spawn", 'B', NULL, 0, argv[0]);
+#ifndef NO_SPAWN
+  static posix_spawnattr_t attr;
+  static int attr_ready = 0;
+  if (!attr_ready) {
+    sigset_t mask, defaults;
+    sigemptyset(&mask);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGTTOU);
+    sigaddset(&defaults, SIGTTIN);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    attr_ready = 1;
   }
-  
-  return arg_count;
+  posix_spawnattr_setpgroup(&attr, pgid);
+
+  // file actions allocate memory as they are added, so they are kept for the next command that
+  // uses the same descriptors, which are usually the same from one command line to the next
+  static struct {
+    int fd_in;
+    int fd_out;
+    posix_spawn_file_actions_t actions;
+  } action_cache[ACTION_CACHE_SIZE];
+  static int cached = 0, next_victim = 0;
+  int i;
+  for (i = 0; i < cached; i++) {
+    if (action_cache[i].fd_in == fd_in && action_cache[i].fd_out == fd_out)
+      break;
+  }
+  if (i == cached) {
+    if (cached < ACTION_CACHE_SIZE) {
+      cached++;
+    } else {
+      i = next_victim;
+      next_victim = (next_victim + 1) % ACTION_CACHE_SIZE;
+      posix_spawn_file_actions_destroy(&action_cache[i].actions);
+    }
+    action_cache[i].fd_in = fd_in;
+    action_cache[i].fd_out = fd_out;
+    posix_spawn_file_actions_init(&action_cache[i].actions);
+    if (fd_in >= 0)
+      posix_spawn_file_actions_adddup2(&action_cache[i].actions, fd_in, STDIN_FILENO);
+    if (fd_out >= 0)
+      posix_spawn_file_actions_adddup2(&action_cache[i].actions, fd_out, STDOUT_FILENO);
+  }
+  int error = posix_spawn(&pid, path, &action_cache[i].actions, &attr, argv, envp);
+  if (error != ENOSYS) {
+    TRACE("spawn", 'E', "pid", error ? -1 : pid, NULL);
+    if (!error)
+      TRACE("process", 'b', "pid", pid, argv[0]);
+    errno = error;
+    return error ? -1 : pid;
+  }
+#endif
+
+  pid = fork();
+  if (pid == 0) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    setpgid(0, pgid);
+    if (fd_in >= 0)
+      dup2(fd_in, STDIN_FILENO);
+    if (fd_out >= 0)
+      dup2(fd_out, STDOUT_FILENO);
+
+    execve(path, argv, envp);
+
+    perror(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (pid > 0)
+    setpgid(pid, pgid ? pgid : pid); // so the terminal can be handed over before the child runs
+  TRACE("spawn", 'E', "pid", pid, NULL);
+  if (pid > 0)
+    TRACE("process", 'b', "pid", pid, argv[0]);
+  return pid;
 }
 
-/* read_line reads the command line until CTRL-D or newline
+/* fork_builtin runs a builtin that is a stage of a pipeline in a child process in the process
+ * group pgid (or a new one if pgid is 0), so that it runs at the same time as the other stages
+ * and cannot block the shell on a full pipe. in and out (unless -1) become its standard input
+ * and output, and next_read is the read end of the pipe to the next stage, which the child closes
+ * so that the next stage exiting is noticed.
  *
- * buf - buffer from the main method in which read() stores its output
+ * returns the pid of the child, or -1 if it could not be started
  */
-int read_line(char *buf) {
-  int n = read(STDIN_FILENO, buf, BUF_SIZE);
-  
-  if (n < 0) {
-    perror("sh");
-    return -1;
-  } else if (n == 0) {
-    #ifndef NO_PROMPT
-    write(STDOUT_FILENO, "\n", 1); // remove this to past automatic test suite
-    #endif
-    return -1;
-  } else if (n == 1 && buf[0] == '\n') {
-    return 1;
-  } else {
-    if (buf[n - 1] == '\n') {
-      buf[n - 1] = '\0';
+pid_t fork_builtin(stage_t *stage, int in, int out, int next_read, pid_t pgid) {
+  TRACE("fork", 'B', NULL, 0, stage->builtin->name);
+  pid_t pid = fork();
+  if (pid == 0) {
+    trace_child();
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    setpgid(0, pgid);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    my_timers = NULL; // the scheduled commands are started by the shell alone
+    if (stage->builtin->run == exec_parallel) {
+      // a batch read from a pipe is run by this child, which only knows about its own jobs
+      cleanup_job_list(my_jobs);
+      my_jobs = init_job_list();
+      event_head = event_tail = events_overflow = 0;
+      fg_pid = 0;
     } else {
-      buf[n] = '\0';
-      write(STDOUT_FILENO, "\n", 1);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGCHLD, SIG_DFL);
+    }
+    if (in >= 0) {
+      dup2(in, STDIN_FILENO);
+      close(in);
     }
+    if (out >= 0) {
+      dup2(out, STDOUT_FILENO);
+      close(out);
+    }
+    if (next_read >= 0)
+      close(next_read);
+
+    int result = stage->builtin->run(stage->command->argc, stage->command->argv);
+    flush_trace(1);
+    _exit(result < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
   }
-  return 0;
+  if (pid > 0)
+    setpgid(pid, pgid ? pgid : pid);
+  TRACE("fork", 'E', "pid", pid, NULL);
+  if (pid > 0)
+    TRACE("process", 'b', "pid", pid, stage->builtin->name);
+  return pid;
 }
 
-/* background checks if command line ends with & and updates bg boolean variable 
+/* find_program finds the program of an external command: a name without a slash is looked up
+ * in PATH, a path is used as it is. The path is copied into the arena of the command line.
+ * returns 0 on success, -1 if there is no such command
  */
-void background(char *cmd_line, int *bg) {
-  char *ampersand = strpbrk(cmd_line, "&");
-  if (ampersand != NULL) {
-    ampersand++;
-    if (strspn(ampersand, " \t") == strlen(ampersand)) {
-      *(cmd_line + strcspn(cmd_line, "&")) = '\0';
-      *bg = 1;
+int find_program(stage_t *stage, arena_t *arena) {
+  char *cmd = stage->command->argv[0];
+
+  // check if command exists before redirection to prevent clobbering
+  const char *path = cmd;
+  int found = 1;
+  if (strchr(path, '/') == NULL) {
+    path = find_command(my_commands, get_var(my_vars, "PATH", 4), cmd);
+    found = path != NULL;
+  } else {
+    int test_fd = open(path, O_RDONLY);
+    if (test_fd < 0) {
+      if (errno == ENOENT)
+	found = 0;
+    } else {
+      close(test_fd);
     }
   }
+  if (!found) {
+    char err_msg[strlen(cmd) + 25];
+    sprintf(err_msg, "sh: %s: Command not found\n", cmd);
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return -1;
+  }
+  stage->path = arena_strndup(arena, path, strlen(path));
+  if (stage->path == NULL) {
+    write(STDERR_FILENO, "sh: Out of memory\n", 18);
+    return -1;
+  }
+  return 0;
 }
 
-/* terminate_children is called immediately before exiting the shell to kill any
- * child processes that may still be running in the background
- */
-void terminate_children() {
-  pid_t pid = 0;
-  while (pid >= 0) {;
-    pid = get_next_pid(my_jobs);
-    kill(-pid, SIGKILL);
+/* init_stages sets up a stage for each command of pipeline */
+void init_stages(stage_t *stages, pipeline_t *pipeline) {
+  int i;
+  for (i = 0; i < pipeline->num_commands; i++) {
+    stages[i].command = &pipeline->commands[i];
+    stages[i].builtin = find_builtin(stages[i].command->argv[0]);
+    stages[i].path = NULL;
+    stages[i].fd_in = -1;
+    stages[i].fd_out = -1;
+    stages[i].fan_in = -1;
+    stages[i].fds_out = NULL;
+    stages[i].num_out = 0;
   }
 }
 
-int main() {
-  my_jobs = init_job_list();
-  next_id = 1;
-  fg_pid = 0;
-  install_handler(SIGINT, &handler);
-  install_handler(SIGTSTP, &handler);
-  install_handler(SIGQUIT, &handler);
-  install_handler(SIGCHLD, &child_handler);
+/* stages - the commands of the pipeline, in order
+ * num_stages - number of stages
+ * bg - boolean indicating whether the pipeline runs in the background
+ * arena - the arena of the command line
+ *
+ * exec_extern executes a pipeline of one or more commands. Each stage is connected to the next
+ * by a pipe, unless it redirects its output, and all of them are started in the process group of
+ * the first, which is added to the job list as a single job. External programs are started with
+ * launch() and builtins in a child process with fork_builtin(). Unless the pipeline is started in
+ * the background, it waits for it to complete before resuming the parent process.
+ *
+ * returns the pid of the job, or -1 if it could not be started
+ */
+int exec_extern(stage_t *stages, int num_stages, int bg, arena_t *arena) {
+  int i, j;
 
-  char buf[BUF_SIZE], cmd_line[BUF_SIZE], wd[BUF_SIZE], *file_out, *file_in, *ptr, *cmd, *cmd_args;
-  int quit, input_redirect, output_redirect, trunc_file, bg;
-  getcwd(wd, BUF_SIZE);
+  // find every program and open every redirection file before anything is started, so that a
+  // mistake in one stage does not leave the others running
+  for (i = 0; i < num_stages; i++) {
+    if (!stages[i].builtin && find_program(&stages[i], arena))
+      return -1;
+  }
+  for (i = 0; i < num_stages; i++) {
+    stage_t *stage = &stages[i];
+    if (file_redirect(stage, arena)) {
+      for (j = 0; j < i; j++)
+	close_redirects(&stages[j]);
+      return -1;
+    }
+  }
 
-  quit = 0;
-  while (!quit) {
-    bg = 0;
-    input_redirect = 0;
-    output_redirect = 0;
-    trunc_file = 1;
-    cmd_line[0] = '\0';
+  // the job is listed under the programs of its stages
+  size_t command_len = 1;
+  for (i = 0; i < num_stages; i++)
+    command_len += strlen(stages[i].command->argv[0]) + 3;
+  char command[command_len];
+  command[0] = '\0';
+  for (i = 0; i < num_stages; i++) {
+    if (i > 0)
+      strcat(command, " | ");
+    strcat(command, stages[i].command->argv[0]);
+  }
 
-    #ifndef NO_PROMPT
-    if (write(STDOUT_FILENO, wd, strlen(wd)) < 0) break;
-    if (write(STDOUT_FILENO, " $ ", 3) < 0) break;
-    #endif
+  // the children cannot be removed from the job list before they are added, since child_handler()
+  // only queues their events and the job list is updated by drain_events() later. SIGCHLD is
+  // blocked while the stages are started all the same, because a process group ceases to exist
+  // once its leader is reaped and the later stages could not join it
+  sigset_t set, oldset;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, &oldset);
+  int jid = next_id;
+  pid_t pgid = 0;
+  int prev_read = -1;
+  for (i = 0; i < num_stages; i++) {
+    stage_t *stage = &stages[i];
+    int pipefd[2] = {-1, -1};
+    if (i < num_stages - 1 && pipe2(pipefd, O_CLOEXEC) < 0) {
+      perror("sh: pipe");
+      break;
+    }
+    int in = stage->fd_in >= 0 ? stage->fd_in : prev_read;
+    int out = stage->fd_out >= 0 ? stage->fd_out : pipefd[1];
 
-    int read_error = read_line(buf);
-    if(read_error < 0) break;
-    else if (read_error > 0) continue;
+    pid_t pid;
+    if (stage->builtin)
+      pid = fork_builtin(stage, in, out, pipefd[0], pgid);
+    else
+      pid = launch(stage->path, stage->command->argv, in, out, pgid);
+    if (pid < 0)
+      perror(stage->command->argv[0]);
 
-    int parse_error = 0;
-    ptr = buf;
-    background(ptr, &bg);
+    if (stage->fd_in >= 0) close(stage->fd_in);
+    if (stage->fd_out >= 0) close(stage->fd_out);
+    stage->fd_in = stage->fd_out = -1;
+    if (prev_read >= 0) close(prev_read);
+    if (pipefd[1] >= 0) close(pipefd[1]);
+    prev_read = pipefd[0];
+    if (pid < 0) {
+      close_redirects(stage);
+      continue;
+    }
+
+    if (pgid == 0) {
+      pgid = pid;
+      add_job(my_jobs, next_id++, pid, STATE_RUNNING, command);
+    } else {
+      add_job_process(my_jobs, jid, pid);
+    }
+    // the output files of the stage are written by a process of the same job
+    if (stage->num_out > 0 && (pid = fork_fan_out(stage, pgid)) > 0)
+      add_job_process(my_jobs, jid, pid);
+  }
+  sigprocmask(SIG_SETMASK, &oldset, NULL);
+  if (prev_read >= 0)
+    close(prev_read);
+  for (; i < num_stages; i++) // stages left behind by a failed pipe()
+    close_redirects(&stages[i]);
+  if (pgid == 0)
+    return -1;
+
+  if (!bg) {
+    fg_pid = pgid;
+    reassign_tc(fg_pid);
+    wait_fg();
+    reassign_tc(getpgid(getpid()));
+  }
+  return pgid;
+}
+
+/* batch_add keeps a copy of line as the next command of batch, returns its index or -1 on failure */
+long batch_add(batch_t *batch, const char *line) {
+  if (batch->num_cmds == batch->cap) {
+    size_t cap = batch->cap ? batch->cap * 2 : 64;
+    batch_cmd_t *cmds = (batch_cmd_t *) realloc(batch->cmds, cap * sizeof(batch_cmd_t));
+    if (cmds == NULL)
+      return -1;
+    batch->cmds = cmds;
+    batch->cap = cap;
+  }
+  batch_cmd_t *cmd = &batch->cmds[batch->num_cmds];
+  cmd->line = strdup(line);
+  if (cmd->line == NULL)
+    return -1;
+  cmd->pgid = 0;
+  cmd->status = 0;
+  cmd->seconds = 0;
+  clock_gettime(CLOCK_MONOTONIC, &cmd->start);
+  return (long) batch->num_cmds++;
+}
+
+/* batch_start parses and starts command c of batch as a background job in the free slot slot.
+ * A command that cannot be parsed gets the status 2, and one that cannot be started 127.
+ */
+void batch_start(batch_t *batch, long c, int slot, arena_t *arena) {
+  batch_cmd_t *cmd = &batch->cmds[c];
+  pipeline_t pipeline;
+  reset_arena(arena);
+  if (parse_line(arena, my_vars, cmd->line, &pipeline) || pipeline.num_commands == 0) {
+    cmd->status = 2;
+    return;
+  }
+  // the commands must not read the rest of the batch when it comes from standard input
+  if (pipeline.commands[0].file_in == NULL)
+    pipeline.commands[0].file_in = "/dev/null";
+
+  stage_t stages[pipeline.num_commands];
+  init_stages(stages, &pipeline);
+  pid_t pgid = exec_extern(stages, pipeline.num_commands, 1, arena);
+  if (pgid < 0) {
+    cmd->status = 127;
+    return;
+  }
+  cmd->pgid = pgid;
+  batch->slots[slot] = c;
+  batch->running++;
+}
+
+/* batch_report prints the exit status and run time of each command of batch in the order they
+ * were read, followed by the number that failed and the wall time of the whole batch, with a
+ * single write()
+ */
+void batch_report(batch_t *batch, double seconds) {
+  size_t i, len = 0, cap = 96, failed = 0;
+  for (i = 0; i < batch->num_cmds; i++)
+    cap += strlen(batch->cmds[i].line) + 48;
+  char *output = (char *) malloc(cap);
+  if (output == NULL)
+    return;
+  for (i = 0; i < batch->num_cmds; i++) {
+    batch_cmd_t *cmd = &batch->cmds[i];
+    failed += cmd->status != 0;
+    len += (size_t) sprintf(output + len, "[%lu] exit %d %.3fs %s\n", (unsigned long) i + 1, cmd->status, cmd->seconds, cmd->line);
+  }
+  len += (size_t) sprintf(output + len, "parallel: %lu commands, %lu failed, %.3fs total%s\n", (unsigned long) batch->num_cmds,
+			  (unsigned long) failed, seconds, interrupted ? " (interrupted)" : "");
+  write(STDOUT_FILENO, output, len);
+  free(output);
+}
+
+/* exec_parallel executes the built-in parallel command, which runs the command lines of a file, or
+ * of standard input if no file is given, as background jobs with at most N of them running at a
+ * time (the number of processors by default). With -l, no command is started while the load
+ * average is at least the given value. The shell sleeps in ppoll() until a job exits, SIGINT is
+ * received or, when it is held back by the load average, it is time to look at it again.
+ * SIGINT stops it from starting more commands and is forwarded to the running ones.
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_parallel(int argc, char **argv) {
+  int max_jobs = (int) sysconf(_SC_NPROCESSORS_ONLN), i;
+  double max_load = 0;
+  char *file = NULL;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      max_jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      max_load = atof(argv[++i]);
+    } else if (file == NULL && argv[i][0] != '-') {
+      file = argv[i];
+    } else {
+      max_jobs = 0;
+      break;
+    }
+  }
+  if (max_jobs < 1) {
+    write(STDERR_FILENO, "parallel: Usage: parallel [-j <jobs>] [-l <load>] [file]\n", 57);
+    return -1;
+  }
+
+  int input = STDIN_FILENO;
+  if (file != NULL && (input = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+    char err_msg[strlen(file) + 11];
+    sprintf(err_msg, "parallel: %s", file);
+    perror(err_msg);
+    return -1;
+  }
+  batch_t batch;
+  memset(&batch, 0, sizeof(batch_t));
+  batch.num_slots = max_jobs;
+  batch.slots = (long *) malloc((size_t) max_jobs * sizeof(long));
+  reader_t reader;
+  if (batch.slots == NULL || init_reader(&reader, input, SCRIPT_BLOCK)) {
+    write(STDERR_FILENO, "parallel: Out of memory\n", 24);
+    free(batch.slots);
+    if (input != STDIN_FILENO)
+      close(input);
+    return -1;
+  }
+  reader.wait = wait_input;
+  for (i = 0; i < max_jobs; i++)
+    batch.slots[i] = -1;
+  arena_t arena;
+  init_arena(&arena);
 
-    while (!parse_error) {
-      if (*ptr != '<' && *ptr != '>') {
-	size_t cmd_len = strcspn(ptr, "<>");
-	strncat(cmd_line, ptr, cmd_len);
-	ptr = strpbrk(ptr, "<>");
+  // SIGCHLD and SIGINT are only let in while the shell sleeps in ppoll(), like sigsuspend() in
+  // wait_fg(), so a job that exits just before the shell goes to sleep still wakes it up
+  sigset_t set, oldset, waitset;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGINT);
+  sigprocmask(SIG_BLOCK, &set, &oldset);
+  waitset = oldset;
+  sigdelset(&waitset, SIGCHLD);
+  sigdelset(&waitset, SIGINT);
+
+  struct timespec start, end, recheck = {LOAD_RECHECK, 0};
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  interrupted = 0;
+  my_batch = &batch;
+  int more = 1, forwarded = 0;
+  for (;;) {
+    drain_events();
+    if (interrupted && !forwarded) {
+      for (i = 0; i < batch.num_slots; i++) {
+	if (batch.slots[i] >= 0)
+	  kill(-batch.cmds[batch.slots[i]].pgid, SIGINT);
       }
-      if (!ptr) break;
+      forwarded = 1;
+    }
 
-      if (*ptr == '<') {
-	parse_error = parse_redirect(&ptr, "input", &input_redirect, &file_in, &trunc_file);
-      } else if (*ptr == '>') {
-	parse_error = parse_redirect(&ptr, "output", &output_redirect, &file_out, &trunc_file);
+    int throttled = 0;
+    while (more && !interrupted && batch.running < batch.num_slots) {
+      double load;
+      if (max_load > 0 && getloadavg(&load, 1) == 1 && load >= max_load) {
+	throttled = 1;
+	break;
+      }
+      size_t len;
+      int partial;
+      char *line;
+      do {
+	line = next_line(&reader, &len, &partial);
+      } while (line != NULL && strspn(line, " \t") == len);
+      if (line == NULL) {
+	if (!reader.eof)
+	  perror("parallel");
+	more = 0;
+	break;
+      }
+      long c = batch_add(&batch, line);
+      if (c < 0) {
+	write(STDERR_FILENO, "parallel: Out of memory\n", 24);
+	more = 0;
+	break;
       }
+      for (i = 0; batch.slots[i] >= 0; i++)
+	;
+      batch_start(&batch, c, i, &arena);
     }
-    if (parse_error) continue;
 
-    int arg_count = parse_command(cmd_line, &cmd, &cmd_args);
-    int is_builtin = exec_builtin(arg_count, &cmd, &cmd_args, wd);
-    if (is_builtin == 1) break;
-    if (is_builtin == -1) {
-      exec_extern(arg_count, &cmd, &cmd_args, input_redirect, output_redirect, &file_in, &file_out, trunc_file, bg);
+    if (batch.running == 0 && !throttled)
+      break;
+    // the commands of every and at keep starting however long the batch runs
+    struct pollfd timer = {timers_fd(), POLLIN, 0};
+    if (ppoll(&timer, 1, throttled ? &recheck : NULL, &waitset) > 0)
+      run_timers();
+  }
+  my_batch = NULL;
+  sigprocmask(SIG_SETMASK, &oldset, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  batch_report(&batch, elapsed(&start, &end));
+  int error = interrupted ? -1 : 0;
+  size_t c;
+  for (c = 0; c < batch.num_cmds; c++) {
+    if (batch.cmds[c].status != 0)
+      error = -1;
+    free(batch.cmds[c].line);
+  }
+  free(batch.cmds);
+  free(batch.slots);
+  cleanup_reader(&reader);
+  cleanup_arena(&arena);
+  if (input != STDIN_FILENO)
+    close(input);
+  return error;
+}
+
+/* pool_spawn starts worker w of pool as a background job whose standard input and output are
+ * pipes to the shell, returns 0 on success, -1 with errno set on failure
+ */
+int pool_spawn(pool_t *pool, worker_t *w) {
+  int to[2], from[2];
+  w->pid = 0;
+  w->to = w->from = -1;
+  w->request = -1;
+  w->len = 0;
+  w->served = 0;
+  if (pipe2(to, O_CLOEXEC) < 0)
+    return -1;
+  if (pipe2(from, O_CLOEXEC) < 0) {
+    close(to[0]);
+    close(to[1]);
+    return -1;
+  }
+  pid_t pid = launch(pool->path, pool->argv, to[0], from[1], 0);
+  int saved_errno = errno;
+  close(to[0]);
+  close(from[1]);
+  if (pid < 0) {
+    close(to[1]);
+    close(from[0]);
+    errno = saved_errno;
+    return -1;
+  }
+  add_job(my_jobs, next_id++, pid, STATE_RUNNING, pool->command);
+  w->pid = pid;
+  w->to = to[1];
+  w->from = from[0];
+  clock_gettime(CLOCK_MONOTONIC, &w->start);
+  return 0;
+}
+
+/* worker_lost closes the pipes of worker w, which has exited or closed its standard output, and
+ * gives up on the request it was answering
+ */
+void worker_lost(pool_t *pool, worker_t *w) {
+  if (w->to >= 0)
+    close(w->to);
+  if (w->from >= 0)
+    close(w->from);
+  w->to = w->from = -1;
+  w->len = 0;
+  if (w->request >= 0) {
+    pool->responses[(size_t) w->request - pool->first].state = 2;
+    w->request = -1;
+  }
+}
+
+/* pool_done starts the coprocess worker whose job pid is job_pid again, if there is one, unless
+ * it exited by itself at once without being sent anything, which would only happen again
+ */
+void pool_done(pid_t job_pid, int status) {
+  if (my_pool == NULL)
+    return;
+  int i;
+  for (i = 0; i < my_pool->num_workers; i++) {
+    worker_t *w = &my_pool->workers[i];
+    if (w->pid != job_pid)
+      continue;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int at_once = WIFEXITED(status) && w->served == 0 && w->request < 0
+		  && elapsed(&w->start, &now) < WORKER_MIN_LIFE;
+    worker_lost(my_pool, w);
+    w->pid = 0;
+    if (at_once) {
+      char err_msg[64];
+      sprintf(err_msg, "coproc: Worker (%d) exited at once, not restarted\n", job_pid);
+      write(STDERR_FILENO, err_msg, strlen(err_msg));
+    } else if (pool_spawn(my_pool, w) < 0) {
+      perror("coproc");
+    }
+    return;
+  }
+}
+
+/* pool_output adds len bytes of text to the answers waiting to be written, returns 0 on success,
+ * -1 on failure */
+int pool_output(pool_t *pool, const char *text, size_t len) {
+  if (pool->out_cap - pool->out_len < len) {
+    size_t cap = pool->out_cap ? pool->out_cap : 65536;
+    while (cap - pool->out_len < len)
+      cap *= 2;
+    char *out = (char *) realloc(pool->out, cap);
+    if (out == NULL)
+      return -1;
+    pool->out = out;
+    pool->out_cap = cap;
+  }
+  memcpy(pool->out + pool->out_len, text, len);
+  pool->out_len += len;
+  return 0;
+}
+
+/* pool_write writes the answers waiting in pool to standard output */
+void pool_write(pool_t *pool) {
+  size_t done = 0;
+  while (done < pool->out_len) {
+    ssize_t n = write(STDOUT_FILENO, pool->out + done, pool->out_len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += (size_t) n;
+  }
+  pool->out_len = 0;
+}
+
+/* pool_flush moves the answers of the requests that are done, up to the first one still being
+ * answered, to the output, and reports the requests whose worker was lost
+ */
+void pool_flush(pool_t *pool) {
+  size_t i;
+  for (i = 0; i < pool->num_responses && pool->responses[i].state != 0; i++) {
+    response_t *r = &pool->responses[i];
+    if (r->state == 2) {
+      char err_msg[64];
+      sprintf(err_msg, "coproc: Request %lu lost, its worker exited\n", (unsigned long) (pool->first + i + 1));
+      write(STDERR_FILENO, err_msg, strlen(err_msg));
+    } else if (r->text != NULL) {
+      pool_output(pool, r->text, r->len);
+      free(r->text);
+    }
+  }
+  if (i > 0) {
+    memmove(pool->responses, pool->responses + i, (pool->num_responses - i) * sizeof(response_t));
+    pool->num_responses -= i;
+    pool->first += i;
+  }
+  if (pool->out_len >= 65536)
+    pool_write(pool);
+}
+
+/* pool_read reads what worker w has printed, taking each line as the answer to its request. The
+ * answer to the oldest request still open goes straight to the output, and any other is kept
+ * until the requests before it are answered
+ */
+void pool_read(pool_t *pool, worker_t *w) {
+  if (w->cap - w->len < 4096) {
+    size_t cap = w->cap ? w->cap * 2 : 8192;
+    char *buf = (char *) realloc(w->buf, cap);
+    if (buf == NULL) {
+      worker_lost(pool, w);
+      return;
+    }
+    w->buf = buf;
+    w->cap = cap;
+  }
+  ssize_t n = read(w->from, w->buf + w->len, w->cap - w->len);
+  if (n < 0 && errno == EINTR)
+    return;
+  if (n <= 0) {
+    worker_lost(pool, w);
+    return;
+  }
+  w->len += (size_t) n;
+
+  char *newline;
+  while (w->request >= 0 && (newline = (char *) memchr(w->buf, '\n', w->len)) != NULL) {
+    size_t len = (size_t) (newline - w->buf) + 1;
+    response_t *r = &pool->responses[(size_t) w->request - pool->first];
+    r->state = 1;
+    if (r == pool->responses) {
+      if (pool_output(pool, w->buf, len) < 0)
+	r->state = 2;
+    } else if ((r->text = (char *) malloc(len)) != NULL) {
+      memcpy(r->text, w->buf, len);
+      r->len = len;
+    } else {
+      r->state = 2;
+    }
+    memmove(w->buf, w->buf + len, w->len - len);
+    w->len -= len;
+    w->request = -1;
+    w->served++;
+    pool_flush(pool);
+  }
+}
+
+/* pool_request opens a new request for worker w and sends it line, which is len bytes long and
+ * is followed by a writable null character, returns 0 on success, -1 on failure
+ */
+int pool_request(pool_t *pool, worker_t *w, char *line, size_t len) {
+  if (pool->num_responses == pool->cap) {
+    size_t cap = pool->cap ? pool->cap * 2 : 64;
+    response_t *responses = (response_t *) realloc(pool->responses, cap * sizeof(response_t));
+    if (responses == NULL)
+      return -1;
+    pool->responses = responses;
+    pool->cap = cap;
+  }
+  response_t *r = &pool->responses[pool->num_responses];
+  r->text = NULL;
+  r->len = 0;
+  r->state = 0;
+  w->request = (long) (pool->first + pool->num_responses++);
+
+  // the line goes out with its newline in place of the null character in a single write()
+  line[len++] = '\n';
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(w->to, line + done, len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      // a worker that has exited raises SIGPIPE, which is blocked and thrown away
+      sigset_t pipe_set;
+      struct timespec zero = {0, 0};
+      sigemptyset(&pipe_set);
+      sigaddset(&pipe_set, SIGPIPE);
+      sigtimedwait(&pipe_set, NULL, &zero);
+      worker_lost(pool, w);
+      break;
+    }
+    done += (size_t) n;
+  }
+  return 0;
+}
+
+/* pool_send answers the request lines read from input by handing each to an idle worker of pool
+ * and printing the line each worker answers with, in the order of the requests. The shell sleeps
+ * in ppoll() until a worker answers or SIGCHLD or SIGINT is received, and SIGINT kills the
+ * workers that are still answering and stops the requests
+ * returns 0 on success, -1 on failure
+ */
+int pool_send(pool_t *pool, int input) {
+  reader_t reader;
+  if (init_reader(&reader, input, SCRIPT_BLOCK)) {
+    write(STDERR_FILENO, "coproc: Out of memory\n", 22);
+    return -1;
+  }
+  reader.wait = wait_input;
+  struct pollfd fds[pool->num_workers + 1]; // and the timerfd of every and at
+  int busy[pool->num_workers], i, more = 1, error = 0;
+
+  sigset_t set, oldset, waitset;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGPIPE);
+  sigprocmask(SIG_BLOCK, &set, &oldset);
+  waitset = oldset;
+  sigdelset(&waitset, SIGCHLD);
+  sigdelset(&waitset, SIGINT);
+  interrupted = 0;
+
+  for (;;) {
+    drain_events(); // lost workers are started again by pool_done()
+    if (interrupted && more) {
+      for (i = 0; i < pool->num_workers; i++) {
+	if (pool->workers[i].request >= 0) {
+	  kill(pool->workers[i].pid, SIGKILL);
+	  worker_lost(pool, &pool->workers[i]);
+	}
+      }
+      more = 0;
+      error = -1;
+    }
+
+    while (more) {
+      for (i = 0; i < pool->num_workers; i++) {
+	worker_t *w = &pool->workers[i];
+	if (w->pid > 0 && w->to >= 0 && w->request < 0)
+	  break;
+      }
+      if (i == pool->num_workers)
+	break;
+      size_t len;
+      int partial;
+      char *line = next_line(&reader, &len, &partial);
+      if (line == NULL) {
+	if (!reader.eof) {
+	  perror("coproc");
+	  error = -1;
+	}
+	more = 0;
+      } else if (pool_request(pool, &pool->workers[i], line, len) < 0) {
+	write(STDERR_FILENO, "coproc: Out of memory\n", 22);
+	more = 0;
+	error = -1;
+      }
+    }
+    pool_flush(pool);
+
+    int n = 0, alive = 0;
+    for (i = 0; i < pool->num_workers; i++) {
+      worker_t *w = &pool->workers[i];
+      alive += w->pid > 0;
+      if (w->request >= 0) {
+	fds[n].fd = w->from;
+	fds[n].events = POLLIN;
+	busy[n++] = i;
+      }
+    }
+    if (n == 0 && (!more || alive == 0)) {
+      if (more) {
+	write(STDERR_FILENO, "coproc: No workers left\n", 24);
+	error = -1;
+      }
+      break;
+    }
+    pool_write(pool);
+    // with nothing to read, the shell waits for a lost worker to exit and be started again
+    fds[n].fd = timers_fd();
+    fds[n].events = POLLIN;
+    if (ppoll(fds, (nfds_t) n + 1, NULL, &waitset) > 0) {
+      for (i = 0; i < n; i++) {
+	if (fds[i].revents)
+	  pool_read(pool, &pool->workers[busy[i]]);
+      }
+      if (fds[n].revents & POLLIN)
+	run_timers();
+    }
+  }
+  pool_write(pool);
+  pool->first = 0;
+  pool->num_responses = 0;
+  sigprocmask(SIG_SETMASK, &oldset, NULL);
+  cleanup_reader(&reader);
+  return error;
+}
+
+/* pool_stop closes the pipes to the workers of pool, which exit once they read the end of their
+ * input and are then removed from the job list as usual, and frees the pool
+ */
+void pool_stop(pool_t *pool) {
+  if (pool == NULL)
+    return;
+  int i;
+  for (i = 0; i < pool->num_workers; i++) {
+    worker_t *w = &pool->workers[i];
+    if (w->to >= 0)
+      close(w->to);
+    if (w->from >= 0)
+      close(w->from);
+    free(w->buf);
+  }
+  free(pool->workers);
+  free(pool->responses);
+  free(pool->out);
+  free(pool->argv);
+  free(pool->path);
+  free(pool->command);
+  free(pool);
+}
+
+/* pool_start starts a pool of num_workers copies of the command argc and argv, returns the pool,
+ * or NULL on failure after printing an error message
+ */
+pool_t *pool_start(int num_workers, int argc, char **argv) {
+  const char *path = argv[0];
+  if (strchr(path, '/') == NULL && (path = find_command(my_commands, get_var(my_vars, "PATH", 4), argv[0])) == NULL) {
+    char err_msg[strlen(argv[0]) + 30];
+    sprintf(err_msg, "coproc: %s: Command not found\n", argv[0]);
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return NULL;
+  }
+
+  // the words of the command come from the arena of the command line, so they are copied into a
+  // single block that holds the argv array followed by the strings
+  size_t size = (size_t) (argc + 1) * sizeof(char *);
+  int i;
+  for (i = 0; i < argc; i++)
+    size += strlen(argv[i]) + 1;
+  pool_t *pool = (pool_t *) calloc(1, sizeof(pool_t));
+  if (pool == NULL)
+    goto out_of_memory;
+  pool->argv = (char **) malloc(size);
+  pool->path = strdup(path);
+  pool->command = (char *) malloc(strlen(argv[0]) + 8);
+  pool->workers = (worker_t *) calloc((size_t) num_workers, sizeof(worker_t));
+  if (pool->argv == NULL || pool->path == NULL || pool->command == NULL || pool->workers == NULL)
+    goto out_of_memory;
+  char *str = (char *) (pool->argv + argc + 1);
+  for (i = 0; i < argc; i++) {
+    pool->argv[i] = strcpy(str, argv[i]);
+    str += strlen(argv[i]) + 1;
+  }
+  pool->argv[argc] = NULL;
+  sprintf(pool->command, "coproc %s", argv[0]);
+
+  pool->num_workers = num_workers;
+  for (i = 0; i < num_workers; i++) {
+    if (pool_spawn(pool, &pool->workers[i]) < 0) {
+      perror("coproc");
+      pool_stop(pool);
+      return NULL;
+    }
+  }
+  return pool;
+
+out_of_memory:
+  write(STDERR_FILENO, "coproc: Out of memory\n", 22);
+  pool_stop(pool);
+  return NULL;
+}
+
+/* pool_print prints the workers of pool with their job ids and how many requests each answered,
+ * with a single write() */
+void pool_print(pool_t *pool) {
+  char *output = (char *) malloc((size_t) pool->num_workers * 64 + strlen(pool->command) + 32);
+  if (output == NULL)
+    return;
+  size_t len = (size_t) sprintf(output, "%s: %d workers\n", pool->command, pool->num_workers);
+  int i;
+  for (i = 0; i < pool->num_workers; i++) {
+    worker_t *w = &pool->workers[i];
+    const char *state = w->pid == 0 ? "exited" : w->to < 0 ? "closed" : "idle";
+    len += (size_t) sprintf(output + len, "[%d] (%d) %s, %lu answered\n", w->pid ? get_job_jid(my_jobs, w->pid) : 0,
+			    w->pid, state, w->served);
+  }
+  write(STDOUT_FILENO, output, len);
+  free(output);
+}
+
+/* exec_coproc executes the built-in coproc command. coproc start [-n N] <command> starts N
+ * workers running command (the number of processors by default) as background jobs, with pipes
+ * to their standard input and output. coproc send [file] sends each line of file, or of standard
+ * input, to an idle worker and prints the line it answers with, in the order of the requests, so
+ * that a helper program is started once rather than for every request. A worker that exits is
+ * started again as soon as SIGCHLD is handled. coproc stop closes the pipes to the workers, and
+ * coproc on its own lists them.
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_coproc(int argc, char **argv) {
+  if (argc == 1) {
+    if (my_pool == NULL) {
+      write(STDERR_FILENO, "coproc: No workers\n", 19);
+      return -1;
+    }
+    pool_print(my_pool);
+    return 0;
+  }
+
+  if (strcmp(argv[1], "start") == 0) {
+    int num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN), i = 2;
+    if (argc > 3 && strcmp(argv[2], "-n") == 0) {
+      num_workers = atoi(argv[3]);
+      i = 4;
+    }
+    if (i < argc && num_workers > 0) {
+      if (my_pool != NULL) {
+	write(STDERR_FILENO, "coproc: Workers are already running\n", 36);
+	return -1;
+      }
+      my_pool = pool_start(num_workers, argc - i, argv + i);
+      return my_pool != NULL ? 0 : -1;
+    }
+  } else if (strcmp(argv[1], "send") == 0 && argc <= 3) {
+    if (my_pool == NULL) {
+      write(STDERR_FILENO, "coproc: No workers\n", 19);
+      return -1;
+    }
+    int input = STDIN_FILENO;
+    if (argc == 3 && (input = open(argv[2], O_RDONLY | O_CLOEXEC)) < 0) {
+      char err_msg[strlen(argv[2]) + 9];
+      sprintf(err_msg, "coproc: %s", argv[2]);
+      perror(err_msg);
+      return -1;
+    }
+    int error = pool_send(my_pool, input);
+    if (input != STDIN_FILENO)
+      close(input);
+    return error;
+  } else if (strcmp(argv[1], "stop") == 0 && argc == 2) {
+    pool_t *pool = my_pool;
+    my_pool = NULL;
+    pool_stop(pool);
+    return 0;
+  }
+  write(STDERR_FILENO, "coproc: Usage: coproc [start [-n <workers>] <command> | send [file] | stop]\n", 76);
+  return -1;
+}
+
+/* sched_start starts a run of sched as a background job, with /dev/null as its standard input
+ * unless it redirects it. The command line is parsed again for each run, so that the variables
+ * it refers to have their values at the time.
+ */
+void sched_start(sched_t *sched, arena_t *arena) {
+  pipeline_t pipeline;
+  reset_arena(arena);
+  if (parse_line(arena, my_vars, sched->line, &pipeline) || pipeline.num_commands == 0)
+    return;
+  if (pipeline.commands[0].file_in == NULL)
+    pipeline.commands[0].file_in = "/dev/null";
+  stage_t stages[pipeline.num_commands];
+  init_stages(stages, &pipeline);
+  pid_t pgid = exec_extern(stages, pipeline.num_commands, 1, arena);
+  if (pgid < 0)
+    return;
+  sched->pgid = pgid;
+  sched->jid = get_job_jid(my_jobs, pgid);
+  sched->runs++;
+}
+
+/* sched_remove takes sched out of my_scheds and frees it */
+void sched_remove(sched_t *sched) {
+  sched_t **link = &my_scheds;
+  while (*link != sched)
+    link = &(*link)->next;
+  *link = sched->next;
+  free(sched->line);
+  free(sched);
+}
+
+/* run_timers starts the commands of every and at that are due. A run is skipped if the job of
+ * the last run is still in the job list, running or stopped. A command of every is scheduled
+ * again an interval after it was due, so that it does not drift, but runs that were missed
+ * while the shell was busy are not made up for.
+ */
+void run_timers() {
+  static arena_t arena; // the command lines of the runs, kept apart from the line being run
+  static int arena_ready;
+  if (my_timers == NULL)
+    return;
+  wheel_timer_t *due = expire_timers(my_timers);
+  if (due == NULL)
+    return;
+  if (!arena_ready) {
+    init_arena(&arena);
+    arena_ready = 1;
+  }
+  drain_events(); // a run that just exited no longer counts as active
+  while (due != NULL) {
+    sched_t *sched = (sched_t *) due;
+    due = due->next;
+    if (sched->jid > 0 && get_job_pid(my_jobs, sched->jid) == sched->pgid) {
+      sched->skipped++;
+    } else {
+      TRACE("timer", 'i', "id", sched->id, sched->line);
+      sched_start(sched, &arena);
+    }
+    if (sched->interval == 0) {
+      sched_remove(sched);
+      continue;
+    }
+    uint64_t expires = sched->timer.expires + sched->interval, now = current_tick(my_timers);
+    if (expires <= now)
+      expires += (now - expires) / sched->interval * sched->interval + sched->interval;
+    add_timer(my_timers, &sched->timer, expires);
+  }
+}
+
+/* timers_fd returns the timerfd of every and at while commands are scheduled, or -1, which poll()
+ * ignores, so that every wait of the shell can start the commands as they fall due
+ */
+int timers_fd() {
+  return my_timers != NULL && num_timers(my_timers) > 0 ? timer_wheel_fd(my_timers) : -1;
+}
+
+/* wait_input is the wait function of the reader of command lines: while commands are scheduled,
+ * it sleeps in poll() until fd is readable, running the commands that fall due meanwhile
+ */
+void wait_input(int fd) {
+  while (my_timers != NULL && num_timers(my_timers) > 0) {
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {timer_wheel_fd(my_timers), POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno != EINTR)
+	return;
+      continue;
+    }
+    if (fds[1].revents & POLLIN)
+      run_timers();
+    if (fds[0].revents)
+      return;
+  }
+}
+
+/* parse_interval returns the number of milliseconds in an interval such as 10, 1.5s, 250ms, 5m or
+ * 2h, in seconds unless a unit follows, or -1 if it is not one
+ */
+long parse_interval(const char *arg) {
+  char *end;
+  errno = 0;
+  double value = strtod(arg, &end);
+  if (end == arg || errno != 0 || value < 0)
+    return -1;
+  double scale;
+  if (*end == '\0' || strcmp(end, "s") == 0)
+    scale = 1000;
+  else if (strcmp(end, "ms") == 0)
+    scale = 1;
+  else if (strcmp(end, "m") == 0)
+    scale = 60 * 1000;
+  else if (strcmp(end, "h") == 0)
+    scale = 60 * 60 * 1000;
+  else
+    return -1;
+  value *= scale;
+  return value <= (double) LONG_MAX / 2 ? (long) value : -1;
+}
+
+/* sched_list prints every scheduled command with a single write(): its id, when it runs and the
+ * number of runs made and skipped so far
+ */
+void sched_list() {
+  sched_t *sched;
+  size_t len = 0, cap = 1;
+  for (sched = my_scheds; sched != NULL; sched = sched->next)
+    cap += strlen(sched->line) + 128;
+  char *output = (char *) malloc(cap);
+  if (output == NULL)
+    return;
+  uint64_t now = my_timers != NULL ? current_tick(my_timers) : 0;
+  for (sched = my_scheds; sched != NULL; sched = sched->next) {
+    double next = sched->timer.expires > now ? (double) ((sched->timer.expires - now) * TIMER_TICK_MS) / 1000 : 0;
+    if (sched->interval > 0)
+      len += (size_t) sprintf(output + len, "[%d] every %gs, next in %.2fs, %lu runs, %lu skipped: %s\n", sched->id,
+			      (double) (sched->interval * TIMER_TICK_MS) / 1000, next, sched->runs, sched->skipped, sched->line);
+    else
+      len += (size_t) sprintf(output + len, "[%d] at, in %.2fs: %s\n", sched->id, next, sched->line);
+  }
+  write(STDOUT_FILENO, output, len);
+  free(output);
+}
+
+/* schedule adds the command argv, of argc words, to run every interval milliseconds if periodic
+ * is set, or once after interval milliseconds otherwise. Its words make up a command line of
+ * their own, which is run as a background job when its timer is due.
+ *
+ * returns 0 on success, -1 on failure
+ */
+int schedule(const char *name, long interval, int periodic, int argc, char **argv) {
+  if (my_timers == NULL && (my_timers = init_timer_wheel(TIMER_TICK_MS)) == NULL) {
+    char err_msg[16];
+    sprintf(err_msg, "%s: timerfd", name);
+    perror(err_msg);
+    return -1;
+  }
+  size_t len = 0;
+  int i;
+  for (i = 0; i < argc; i++)
+    len += strlen(argv[i]) + 1;
+  sched_t *sched = (sched_t *) calloc(1, sizeof(sched_t));
+  if (sched == NULL || (sched->line = (char *) malloc(len)) == NULL) {
+    free(sched);
+    char err_msg[32];
+    sprintf(err_msg, "%s: Out of memory\n", name);
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return -1;
+  }
+  sched->line[0] = '\0';
+  for (i = 0; i < argc; i++) {
+    if (i > 0)
+      strcat(sched->line, " ");
+    strcat(sched->line, argv[i]);
+  }
+  uint64_t ticks = (uint64_t) (interval + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  if (ticks == 0)
+    ticks = 1;
+  sched->id = next_sched_id++;
+  sched->interval = periodic ? ticks : 0;
+  sched_t **link = &my_scheds;
+  while (*link != NULL)
+    link = &(*link)->next;
+  *link = sched;
+  add_timer(my_timers, &sched->timer, current_tick(my_timers) + ticks);
+  return 0;
+}
+
+/* exec_sched runs every or at, named name, which differ only in whether the command repeats */
+int exec_sched(const char *name, int periodic, int argc, char **argv) {
+  if (argc == 1) {
+    sched_list();
+    return 0;
+  }
+  if (strcmp(argv[1], "-c") == 0) {
+    if (argc == 2) {
+      char err_msg[48];
+      sprintf(err_msg, "%s: Usage: %s -c <id>...\n", name, name);
+      write(STDERR_FILENO, err_msg, strlen(err_msg));
+      return -1;
+    }
+    int i, error = 0;
+    for (i = 2; i < argc; i++) {
+      sched_t *sched = my_scheds;
+      while (sched != NULL && sched->id != atoi(argv[i]))
+	sched = sched->next;
+      if (sched == NULL) {
+	char err_msg[strlen(argv[i]) + 48];
+	sprintf(err_msg, "%s: %s: No such scheduled command\n", name, argv[i]);
+	write(STDERR_FILENO, err_msg, strlen(err_msg));
+	error = -1;
+	continue;
+      }
+      cancel_timer(my_timers, &sched->timer);
+      sched_remove(sched);
+    }
+    return error;
+  }
+  long interval = parse_interval(argv[1]);
+  if (argc < 3 || interval < 0 || (periodic && interval == 0)) {
+    char err_msg[64];
+    sprintf(err_msg, "%s: Usage: %s <%s> <command>\n", name, name, periodic ? "interval" : "delay");
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return -1;
+  }
+  return schedule(name, interval, periodic, argc - 2, argv + 2);
+}
+
+/* exec_every executes the built-in every command. every <interval> <command> runs command as a
+ * background job every interval, given in seconds or with a unit of ms, s, m or h, starting one
+ * interval from now. A run is skipped while the last one is still active. every on its own lists
+ * the commands scheduled by every and at, and every -c <id> cancels one.
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_every(int argc, char **argv) {
+  return exec_sched("every", 1, argc, argv);
+}
+
+/* exec_at executes the built-in at command. at <delay> <command> runs command once as a
+ * background job after delay, which is given like the interval of every. at on its own and
+ * at -c <id> work like every.
+ *
+ * argc - number of words
+ * argv - the command and its arguments
+ */
+int exec_at(int argc, char **argv) {
+  return exec_sched("at", 0, argc, argv);
+}
+
+/* the clock and the resources used by the shell and its children when a timed command line started */
+typedef struct {
+  struct timespec real;
+  struct rusage self;
+  struct rusage children;
+} time_mark_t;
+
+void start_time(time_mark_t *mark) {
+  clock_gettime(CLOCK_MONOTONIC, &mark->real);
+  getrusage(RUSAGE_SELF, &mark->self);
+  getrusage(RUSAGE_CHILDREN, &mark->children);
+}
+
+/* returns the number of seconds from start to end */
+double elapsed_tv(struct timeval *start, struct timeval *end) {
+  return (double) (end->tv_sec - start->tv_sec) + (double) (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+/* report_time prints the real, user and system time and the peak memory of a command line prefixed
+ * with time to standard error. For a pipeline they are the resources its job used, as added up by
+ * handle_event() from wait4(), and for a builtin run by the shell itself they are those used by
+ * the shell and by the children it reaped in the meantime
+ *
+ * mark - the clock and resource usage when the command line started
+ * usage - the resources used by the job of the pipeline, or NULL for a builtin
+ */
+void report_time(time_mark_t *mark, job_usage_t *usage) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  struct timeval zero = {0, 0};
+  double user, sys;
+  long max_rss;
+  if (usage != NULL) {
+    user = elapsed_tv(&zero, &usage->userTime);
+    sys = elapsed_tv(&zero, &usage->sysTime);
+    max_rss = usage->maxRss;
+  } else {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    user = elapsed_tv(&mark->self.ru_utime, &self.ru_utime) + elapsed_tv(&mark->children.ru_utime, &children.ru_utime);
+    sys = elapsed_tv(&mark->self.ru_stime, &self.ru_stime) + elapsed_tv(&mark->children.ru_stime, &children.ru_stime);
+    max_rss = self.ru_maxrss > children.ru_maxrss ? self.ru_maxrss : children.ru_maxrss;
+  }
+  char report[160];
+  sprintf(report, "\nreal\t%.3fs\nuser\t%.3fs\nsys\t%.3fs\nmaxrss\t%ldKB\n", elapsed(&mark->real, &now), user, sys, max_rss);
+  write(STDERR_FILENO, report, strlen(report));
+}
+
+/* expand_history replaces an event at the start of line with the command line it refers to in the
+ * history: !! is the last line, !<n> line n and !<prefix> the newest line that starts with prefix.
+ * The expanded line is allocated in the arena and printed, so the user can see what is run.
+ *
+ * returns the expanded line, line itself if it does not start with an event, or NULL if there is
+ * no such line in the history
+ */
+char *expand_history(char *line, arena_t *arena) {
+  if (my_history == NULL || line[0] != '!' || line[1] == '\0' || line[1] == ' ' || line[1] == '\t')
+    return line;
+  size_t event_len = strcspn(line, " \t"), len;
+  const char *entry;
+  if (line[1] == '!' && event_len == 2)
+    entry = get_history(my_history, 0, &len);
+  else if (strspn(line + 1, "0123456789") == event_len - 1)
+    entry = atol(line + 1) > 0 ? get_history(my_history, (size_t) atol(line + 1), &len) : NULL;
+  else
+    entry = search_history(my_history, line + 1, event_len - 1, &len);
+  if (entry == NULL) {
+    char err_msg[event_len + 30];
+    sprintf(err_msg, "sh: %.*s: event not found\n", (int) event_len, line);
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return NULL;
+  }
+
+  size_t rest = strlen(line + event_len);
+  char *expanded = (char *) arena_alloc(arena, len + rest + 2);
+  if (expanded == NULL) {
+    write(STDERR_FILENO, "sh: Out of memory\n", 18);
+    return NULL;
+  }
+  memcpy(expanded, entry, len);
+  memcpy(expanded + len, line + event_len, rest);
+  expanded[len + rest] = '\n';
+  write(STDOUT_FILENO, expanded, len + rest + 1);
+  expanded[len + rest] = '\0';
+  return expanded;
+}
+
+/* read_line reads the next command line, of any length, until newline or the end of the input
+ *
+ * reader - the buffered reader of the terminal or script the commands come from
+ * line - set to the command line, which stays valid until the next call
+ * interactive - boolean indicating whether the commands are typed by the user
+ */
+int read_line(reader_t *reader, char **line, int interactive) {
+  size_t len;
+  int partial;
+  *line = next_line(reader, &len, &partial);
+
+  if (*line == NULL) {
+    if (!reader->eof) {
+      perror("sh");
+      return -1;
+    }
+    #ifndef NO_PROMPT
+    if (interactive)
+      write(STDOUT_FILENO, "\n", 1); // remove this to past automatic test suite
+    #endif
+    return -1;
+  } else if (len == 0) {
+    return 1;
+  } else if (partial && interactive) {
+    write(STDOUT_FILENO, "\n", 1);
+  }
+  return 0;
+}
+
+/* terminate_children is called immediately before exiting the shell to kill any
+ * child processes that may still be running in the background
+ */
+void terminate_children() {
+  pid_t pid = 0;
+  while (pid >= 0) {;
+    pid = get_next_pid(my_jobs);
+    kill(-pid, SIGKILL);
+  }
+}
+
+int main(int argc, char **argv) {
+  my_jobs = init_job_list();
+  my_commands = init_path_cache();
+  my_vars = init_vars(environ);
+  next_id = 1;
+  fg_pid = 0;
+  install_handler(SIGINT, &handler);
+  install_handler(SIGTSTP, &handler);
+  install_handler(SIGQUIT, &handler);
+  install_handler(SIGCHLD, &child_handler);
+
+  // sh <script> runs the commands in script instead of reading them from standard input
+  int interactive = 1, input = STDIN_FILENO;
+  if (argc > 1) {
+    input = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (input < 0) {
+      char err_msg[strlen(argv[1]) + 5];
+      sprintf(err_msg, "sh: %s", argv[1]);
+      perror(err_msg);
+      return EXIT_FAILURE;
+    }
+    interactive = 0;
+  }
+  // with SH_SCRIPT_CACHE set to a directory, the script is compiled once and its commands are
+  // taken already parsed from the compiled form that is cached there
+  // SH_TRACE names a file that the events of every command line are traced to
+  const char *trace_file = get_var(my_vars, "SH_TRACE", 8);
+  if (trace_file != NULL && trace_file[0] != '\0' && init_trace(trace_file) < 0) {
+    char err_msg[strlen(trace_file) + 5];
+    sprintf(err_msg, "sh: %s", trace_file);
+    perror(err_msg);
+  }
+
+  script_t *script = NULL;
+  const char *cache_dir = get_var(my_vars, "SH_SCRIPT_CACHE", 15);
+  if (!interactive && cache_dir != NULL && cache_dir[0] != '\0')
+    script = open_script(argv[1], input, cache_dir);
+  // the command lines typed at a terminal are recorded in $HISTFILE, or ~/.sh_history, which is
+  // shared by every shell that uses it. other input is only recorded if HISTFILE is set
+  const char *hist_file = get_var(my_vars, "HISTFILE", 8), *home = get_var(my_vars, "HOME", 4);
+  my_history = NULL;
+  if (interactive && (hist_file != NULL || (isatty(input) && home != NULL))) {
+    char default_file[hist_file != NULL ? 1 : strlen(home) + 13];
+    if (hist_file == NULL) {
+      sprintf(default_file, "%s/.sh_history", home);
+      hist_file = default_file;
+    }
+    my_history = init_history(hist_file);
+  }
+
+  reader_t reader;
+  if (init_reader(&reader, input, isatty(input) ? BUF_SIZE : SCRIPT_BLOCK)) {
+    perror("sh");
+    return EXIT_FAILURE;
+  }
+  reader.wait = wait_input;
+
+  // everything parsed from a command line is allocated from the arena, which is reset after each
+  // line and keeps its memory, so running a command line does not usually call malloc() at all
+  arena_t arena;
+  init_arena(&arena);
+
+  char *buf;
+  int quit;
+  getcwd(wd, BUF_SIZE);
+
+  quit = 0;
+  while (!quit) {
+    reset_arena(&arena);
+    drain_events();
+    run_timers();
+    flush_trace(0);
+
+    pipeline_t pipeline;
+    if (script != NULL) {
+      TRACE("parse", 'B', NULL, 0, NULL);
+      int result = next_command(script, &arena, my_vars, &pipeline);
+      TRACE("parse", 'E', NULL, 0, NULL);
+      if (result == 0) break;
+      if (result < 0 || pipeline.num_commands == 0)
+	continue;
+    } else {
+      #ifndef NO_PROMPT
+      if (interactive) {
+	if (write(STDOUT_FILENO, wd, strlen(wd)) < 0) break;
+	if (write(STDOUT_FILENO, " $ ", 3) < 0) break;
+      }
+      #endif
+
+      TRACE("read", 'B', NULL, 0, NULL);
+      int read_error = read_line(&reader, &buf, interactive);
+      TRACE("read", 'E', NULL, 0, NULL);
+      if(read_error < 0) break;
+      else if (read_error > 0) continue;
+      drain_events(); // catch up with jobs that changed state while the line was typed
+
+      buf = expand_history(buf, &arena);
+      if (buf == NULL)
+	continue;
+      if (my_history != NULL && buf[strspn(buf, " \t")] != '\0')
+	add_history(my_history, buf, strlen(buf));
+
+      TRACE("parse", 'B', NULL, 0, NULL);
+      int error = parse_line(&arena, my_vars, buf, &pipeline);
+      TRACE("parse", 'E', NULL, 0, NULL);
+      if (error || pipeline.num_commands == 0)
+	continue;
+    }
+
+    // NAME=value on its own sets a variable of the shell, which is not exported
+    command_t *first = &pipeline.commands[0];
+    char *equals = strchr(first->argv[0], '=');
+    if (pipeline.num_commands == 1 && first->argc == 1 && equals != NULL
+	&& valid_var_name(first->argv[0], (size_t) (equals - first->argv[0]))) {
+      *equals = '\0';
+      set_var(my_vars, first->argv[0], equals + 1, 0);
+      continue;
+    }
+
+    // time <command> reports the resources used by the rest of the line once it is done
+    int timed = strcmp(first->argv[0], "time") == 0;
+    if (timed) {
+      if (first->argc == 1) {
+	write(STDERR_FILENO, "time: Usage: time <command>\n", 28);
+	continue;
+      } else if (pipeline.bg) {
+	write(STDERR_FILENO, "time: Cannot time a background job\n", 35);
+	continue;
+      }
+      first->argv++;
+      first->argc--;
+    }
+
+    int num_stages = pipeline.num_commands;
+    stage_t stages[num_stages];
+    init_stages(stages, &pipeline);
+
+    time_mark_t mark;
+    if (timed)
+      start_time(&mark);
+    if (num_stages == 1 && stages[0].builtin) {
+      quit = run_builtin(&stages[0], &arena) == 1;
+      if (timed)
+	report_time(&mark, NULL);
+    } else {
+      fg_exited = 0;
+      pid_t pgid = exec_extern(stages, num_stages, pipeline.bg, &arena);
+      if (timed && pgid > 0 && fg_exited)
+	report_time(&mark, &fg_usage);
     }
-    free(cmd);
-    free(cmd_args);
   }
 
+  pool_stop(my_pool);
+  my_pool = NULL;
   terminate_children();
   cleanup_job_list(my_jobs);
+  cleanup_path_cache(my_commands);
+  cleanup_history(my_history);
+  cleanup_vars(my_vars);
+  cleanup_wildcard_cache();
+  while (my_scheds != NULL)
+    sched_remove(my_scheds);
+  cleanup_timer_wheel(my_timers);
+  close_script(script);
+  cleanup_trace();
+  cleanup_reader(&reader);
+  cleanup_arena(&arena);
+  if (input != STDIN_FILENO)
+    close(input);
   return 0;
 }
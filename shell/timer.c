@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "timer.h"
+
+// each level of the wheel has 256 slots, and each slot of a level spans all the slots of the
+// level below it, so four levels reach 2^32 ticks ahead
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK ((uint64_t) WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN(level) ((uint64_t) 1 << (WHEEL_BITS * (level)))
+#define NEVER UINT64_MAX
+
+/* a timer in level 0 is due at the tick of its slot. a timer in a higher level is moved down,
+ * with the others of its slot, once the ticks below its slot have all gone by */
+struct timer_wheel {
+  wheel_timer_t *slots[WHEEL_LEVELS][WHEEL_SIZE];
+  uint64_t now;            // the next tick to be processed
+  uint64_t armed;          // the tick the timerfd is set for, NEVER if it is not set
+  struct timespec start;   // the time of tick 0 on CLOCK_MONOTONIC
+  unsigned int tick_ms;
+  size_t count;
+  int fd;
+};
+
+/*
+ * creates a hierarchical timer wheel with ticks of tick_ms milliseconds, counted from now, and
+ * a timerfd that becomes readable once a timer is due
+ * returns the wheel, or NULL on failure
+ */
+timer_wheel_t *init_timer_wheel(unsigned int tick_ms) {
+  timer_wheel_t *wheel = (timer_wheel_t *) calloc(1, sizeof(timer_wheel_t));
+  if (wheel == NULL)
+    return NULL;
+  wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (wheel->fd < 0) {
+    free(wheel);
+    return NULL;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &wheel->start);
+  wheel->tick_ms = tick_ms > 0 ? tick_ms : 1;
+  wheel->armed = NEVER;
+  return wheel;
+}
+
+/* frees wheel and closes its timerfd, but not the timers left in it */
+void cleanup_timer_wheel(timer_wheel_t *wheel) {
+  if (wheel == NULL)
+    return;
+  close(wheel->fd);
+  free(wheel);
+}
+
+/* returns the timerfd of wheel, which is close-on-exec and non-blocking */
+int timer_wheel_fd(const timer_wheel_t *wheel) {
+  return wheel->fd;
+}
+
+/* returns the number of timers scheduled in wheel */
+size_t num_timers(const timer_wheel_t *wheel) {
+  return wheel->count;
+}
+
+/* returns the tick the clock of wheel is at */
+uint64_t current_tick(const timer_wheel_t *wheel) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t ms = (int64_t) (now.tv_sec - wheel->start.tv_sec) * 1000 + (now.tv_nsec - wheel->start.tv_nsec) / 1000000;
+  return ms > 0 ? (uint64_t) ms / wheel->tick_ms : 0;
+}
+
+/* puts timer in the slot for its expiry: the lowest level whose slots, counted from the current
+ * one, reach that far */
+static void link_timer(timer_wheel_t *wheel, wheel_timer_t *timer) {
+  if (timer->expires < wheel->now)
+    timer->expires = wheel->now;
+  if (timer->expires - wheel->now >= WHEEL_SPAN(WHEEL_LEVELS))
+    timer->expires = wheel->now + WHEEL_SPAN(WHEEL_LEVELS) - 1;
+  uint64_t delta = timer->expires - wheel->now;
+  int level = 0;
+  while (level < WHEEL_LEVELS - 1 && delta >= WHEEL_SPAN(level + 1))
+    level++;
+  wheel_timer_t **slot = &wheel->slots[level][(timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+  timer->next = *slot;
+  if (*slot != NULL)
+    (*slot)->pprev = &timer->next;
+  timer->pprev = slot;
+  *slot = timer;
+}
+
+/*
+ * returns the first tick from wheel->now on at which something happens, or NEVER: the tick of
+ * the first timer of level 0, or that at which the first occupied slot of a higher level is moved
+ * down. with exact set, the expiry of the earliest timer of such a slot is returned instead,
+ * which is when a timer is next due
+ */
+static uint64_t next_tick(const timer_wheel_t *wheel, int exact) {
+  uint64_t best = NEVER, tick;
+  int level, k;
+  for (k = 0; k < WHEEL_SIZE; k++) {
+    if (wheel->slots[0][(wheel->now + (uint64_t) k) & WHEEL_MASK] != NULL) {
+      best = wheel->now + (uint64_t) k;
+      break;
+    }
+  }
+  for (level = 1; level < WHEEL_LEVELS; level++) {
+    uint64_t span = WHEEL_SPAN(level);
+    tick = (wheel->now + span - 1) & ~(span - 1);
+    for (k = 0; k < WHEEL_SIZE && tick < best; k++, tick += span) {
+      const wheel_timer_t *timer = wheel->slots[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+      if (timer == NULL)
+	continue;
+      if (!exact) {
+	best = tick;
+      } else {
+	// the timers of a slot are due between its tick and that of the next slot
+	for (; timer != NULL; timer = timer->next) {
+	  if (timer->expires < best)
+	    best = timer->expires;
+	}
+      }
+      break;
+    }
+  }
+  return best;
+}
+
+/* sets the timerfd of wheel to become readable at tick, or never if tick is NEVER */
+static void arm(timer_wheel_t *wheel, uint64_t tick) {
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  wheel->armed = tick;
+  if (tick != NEVER) {
+    uint64_t ms = tick * wheel->tick_ms;
+    spec.it_value.tv_sec = wheel->start.tv_sec + (time_t) (ms / 1000);
+    spec.it_value.tv_nsec = wheel->start.tv_nsec + (long) (ms % 1000) * 1000000;
+    if (spec.it_value.tv_nsec >= 1000000000) {
+      spec.it_value.tv_sec++;
+      spec.it_value.tv_nsec -= 1000000000;
+    }
+  }
+  timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/* schedules timer to be due at the tick expires, or at the next tick processed if it has passed */
+void add_timer(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t expires) {
+  // an empty wheel has nothing to process until now
+  if (wheel->count == 0) {
+    uint64_t now = current_tick(wheel);
+    if (now > wheel->now)
+      wheel->now = now;
+  }
+  timer->expires = expires;
+  link_timer(wheel, timer);
+  wheel->count++;
+  if (timer->expires < wheel->armed)
+    arm(wheel, timer->expires);
+}
+
+/* takes timer out of wheel if it is scheduled. the timerfd may still become readable for it,
+ * which finds nothing due */
+void cancel_timer(timer_wheel_t *wheel, wheel_timer_t *timer) {
+  if (timer->pprev == NULL)
+    return;
+  *timer->pprev = timer->next;
+  if (timer->next != NULL)
+    timer->next->pprev = timer->pprev;
+  timer->pprev = NULL;
+  wheel->count--;
+}
+
+/*
+ * takes the timers that are due out of wheel and sets its timerfd for the next one
+ * returns them linked by next in the order they fell due, or NULL if none is due
+ */
+wheel_timer_t *expire_timers(timer_wheel_t *wheel) {
+  uint64_t current = current_tick(wheel);
+  if (wheel->armed == NEVER || current < wheel->armed)
+    return NULL;
+  uint64_t expirations;
+  read(wheel->fd, &expirations, sizeof(expirations));
+
+  wheel_timer_t *due = NULL, **last = &due;
+  while (wheel->now <= current) {
+    // the ticks where nothing happens are skipped, however long the shell was away
+    uint64_t tick = next_tick(wheel, 0);
+    if (tick > current) {
+      wheel->now = current + 1;
+      break;
+    }
+    wheel->now = tick;
+
+    // at the start of each turn of a level, the slot of the level above that covers the turn
+    // is moved down into it
+    int level;
+    for (level = 1; level < WHEEL_LEVELS && (tick & (WHEEL_SPAN(level) - 1)) == 0; level++) {
+      wheel_timer_t **slot = &wheel->slots[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+      wheel_timer_t *timer = *slot, *next;
+      *slot = NULL;
+      for (; timer != NULL; timer = next) {
+	next = timer->next;
+	link_timer(wheel, timer);
+      }
+    }
+
+    wheel_timer_t **slot = &wheel->slots[0][tick & WHEEL_MASK];
+    while (*slot != NULL) {
+      wheel_timer_t *timer = *slot;
+      *slot = timer->next;
+      timer->pprev = NULL;
+      timer->next = NULL;
+      *last = timer;
+      last = &timer->next;
+      wheel->count--;
+    }
+    wheel->now = tick + 1;
+  }
+  arm(wheel, wheel->count > 0 ? next_tick(wheel, 1) : NEVER);
+  return due;
+}
@@ -0,0 +1,43 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* a timer of a timer wheel, meant to be the first member of the record of what it schedules */
+typedef struct wheel_timer {
+  uint64_t expires;            // the tick at which it is due
+  struct wheel_timer *next;
+  struct wheel_timer **pprev;  // the link that points to it in its slot, NULL if it is not scheduled
+} wheel_timer_t;
+
+typedef struct timer_wheel timer_wheel_t;
+
+/*
+ * creates a hierarchical timer wheel with ticks of tick_ms milliseconds, counted from now, and
+ * a timerfd that becomes readable once a timer is due
+ * returns the wheel, or NULL on failure
+ */
+timer_wheel_t *init_timer_wheel(unsigned int tick_ms);
+/* frees wheel and closes its timerfd, but not the timers left in it */
+void cleanup_timer_wheel(timer_wheel_t *wheel);
+
+/* returns the timerfd of wheel, which is close-on-exec and non-blocking */
+int timer_wheel_fd(const timer_wheel_t *wheel);
+/* returns the number of timers scheduled in wheel */
+size_t num_timers(const timer_wheel_t *wheel);
+/* returns the tick the clock of wheel is at */
+uint64_t current_tick(const timer_wheel_t *wheel);
+
+/* schedules timer to be due at the tick expires, or at the next tick processed if it has passed */
+void add_timer(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t expires);
+/* takes timer out of wheel if it is scheduled */
+void cancel_timer(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+/*
+ * takes the timers that are due out of wheel and sets its timerfd for the next one
+ * returns them linked by next in the order they fell due, or NULL if none is due
+ */
+wheel_timer_t *expire_timers(timer_wheel_t *wheel);
+
+#endif
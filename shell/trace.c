@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 65536 // must be a power of two
+#endif
+// number of events formatted at a time by flush_trace(), each into at most 256 bytes
+#define TRACE_CHUNK 256
+
+/* an event as it is recorded, before it is formatted */
+typedef struct {
+  const char *name;
+  const char *arg;
+  long long ts;       // nanoseconds of CLOCK_MONOTONIC
+  long value;
+  char phase;
+  char detail[23];    // null-terminated, without characters that would need escaping in JSON
+} trace_event_t;
+
+volatile sig_atomic_t trace_enabled;
+
+// ring buffer of events. trace_event() reserves a slot by advancing tail with a compare and swap,
+// so that child_handler() can record events while the shell is recording one itself, and
+// flush_trace() is the only writer of head. an event that finds the buffer full is dropped
+static trace_event_t *ring;
+static unsigned long head, tail, dropped;
+static int trace_fd = -1;
+static pid_t trace_pid;
+
+/* starts recording events to the Chrome trace-event file at path, which is created or
+ * truncated, returns 0 on success, -1 on failure */
+int init_trace(const char *path) {
+  ring = (trace_event_t *) malloc(TRACE_EVENTS * sizeof(trace_event_t));
+  if (ring == NULL)
+    return -1;
+  // the file is appended to, so that forked children can add their events with single writes
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (trace_fd < 0) {
+    free(ring);
+    ring = NULL;
+    return -1;
+  }
+  trace_pid = getpid();
+  head = tail = dropped = 0;
+  char start[128];
+  int len = sprintf(start, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"sh\"}},\n", trace_pid);
+  write(trace_fd, start, (size_t) len);
+  trace_enabled = 1;
+  return 0;
+}
+
+/* records an event, see TRACE() */
+void trace_event(const char *name, char phase, const char *arg, long value, const char *detail) {
+  unsigned long slot = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+  do {
+    if (slot - __atomic_load_n(&head, __ATOMIC_RELAXED) >= TRACE_EVENTS) {
+      dropped++;
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&tail, &slot, slot + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  trace_event_t *event = &ring[slot & (TRACE_EVENTS - 1)];
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  event->ts = (long long) now.tv_sec * 1000000000 + now.tv_nsec;
+  event->name = name;
+  event->phase = phase;
+  event->arg = arg;
+  event->value = value;
+  size_t i = 0;
+  for (; detail != NULL && detail[i] != '\0' && i < sizeof(event->detail) - 1; i++) {
+    char c = detail[i];
+    event->detail[i] = c == '"' || c == '\\' || (unsigned char) c < 0x20 ? '?' : c;
+  }
+  event->detail[i] = '\0';
+}
+
+/* formats event as a line of the trace file into out, returns its length */
+static size_t format_event(char *out, const trace_event_t *event) {
+  int len = sprintf(out, "{\"name\":\"%s\",\"cat\":\"sh\",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d",
+		    event->name, event->phase, event->ts / 1000, event->ts % 1000, trace_pid, trace_pid);
+  if (event->phase == 'b' || event->phase == 'e')
+    len += sprintf(out + len, ",\"id\":%ld", event->value);
+  len += sprintf(out + len, ",\"args\":{");
+  if (event->arg != NULL)
+    len += sprintf(out + len, "\"%s\":%ld%s", event->arg, event->value, event->detail[0] ? "," : "");
+  if (event->detail[0])
+    len += sprintf(out + len, "\"cmd\":\"%s\"", event->detail);
+  len += sprintf(out + len, "}},\n");
+  return (size_t) len;
+}
+
+/* writes the recorded events to the trace file once the ring buffer is half full, or all of them
+ * if force is set */
+void flush_trace(int force) {
+  if (!trace_enabled)
+    return;
+  unsigned long end = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  if (!force && end - head < TRACE_EVENTS / 2)
+    return;
+  static char out[TRACE_CHUNK * 256];
+  unsigned long next = head;
+  while (next != end) {
+    size_t len = 0;
+    unsigned long stop = end - next > TRACE_CHUNK ? next + TRACE_CHUNK : end;
+    for (; next != stop; next++)
+      len += format_event(out + len, &ring[next & (TRACE_EVENTS - 1)]);
+    write(trace_fd, out, len);
+    __atomic_store_n(&head, next, __ATOMIC_RELEASE); // the slots can be used again
+  }
+}
+
+/* writes the events that are left to the trace file and closes it */
+void cleanup_trace() {
+  if (trace_fd < 0)
+    return;
+  flush_trace(1);
+  trace_enabled = 0;
+  // the last event has no comma after it, which closes the array
+  char end[160];
+  int len = sprintf(end, "{\"name\":\"trace_end\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"dropped\":%lu}}\n]\n",
+		    trace_pid, dropped);
+  write(trace_fd, end, (size_t) len);
+  close(trace_fd);
+  trace_fd = -1;
+  free(ring);
+  ring = NULL;
+}
+
+/* starts a new buffer in a forked child of the shell, which flushes its own events to the same
+ * file with its own pid, without the events the shell had not written yet */
+void trace_child() {
+  if (!trace_enabled)
+    return;
+  head = tail;
+  dropped = 0;
+  trace_pid = getpid();
+}
@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+// set while events are recorded, so that a disabled trace costs one test at each call site
+extern volatile sig_atomic_t trace_enabled;
+
+/*
+ * records an event of the command lifecycle if tracing is enabled. phase is a Chrome trace-event
+ * phase: 'B' and 'E' for the start and end of a span of the shell, 'i' for an instant, and 'b'
+ * and 'e' for the start and end of the life of a process, which are matched by value. arg names
+ * value in the arguments of the event, and detail (unless NULL) is a command name shown with it
+ * it is safe to call from a signal handler, with detail NULL
+ */
+#ifdef NO_TRACE
+#define TRACE(name, phase, arg, value, detail) ((void) 0)
+#else
+#define TRACE(name, phase, arg, value, detail) \
+  do { if (trace_enabled) trace_event(name, phase, arg, value, detail); } while (0)
+#endif
+
+/* starts recording events to the Chrome trace-event file at path, which is created or
+ * truncated, returns 0 on success, -1 on failure */
+int init_trace(const char *path);
+/* writes the events that are left to the trace file and closes it */
+void cleanup_trace();
+
+/* records an event, see TRACE() */
+void trace_event(const char *name, char phase, const char *arg, long value, const char *detail);
+
+/* writes the recorded events to the trace file once the ring buffer is half full, or all of them
+ * if force is set */
+void flush_trace(int force);
+
+/* starts a new buffer in a forked child of the shell, which flushes its own events to the same
+ * file with its own pid, without the events the shell had not written yet */
+void trace_child();
+
+#endif
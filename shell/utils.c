@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "utils.h"
+
+// bytes moved at a time by cat
+#define COPY_CHUNK 65536
+
+/* output of echo and printf, formatted in full before a single write. the buffer is kept from
+ * one command to the next, so it only grows to fit the longest output
+ */
+static char *output;
+static size_t output_len, output_cap;
+
+/* makes room for len more bytes of output, returns 0 on success, -1 on failure */
+static int reserve(size_t len) {
+  if (output_cap - output_len > len)
+    return 0;
+  size_t cap = output_cap ? output_cap * 2 : 256;
+  while (cap - output_len <= len)
+    cap *= 2;
+  char *buf = (char *) realloc(output, cap);
+  if (buf == NULL)
+    return -1;
+  output = buf;
+  output_cap = cap;
+  return 0;
+}
+
+static int append(const char *str, size_t len) {
+  if (reserve(len))
+    return -1;
+  memcpy(output + output_len, str, len);
+  output_len += len;
+  return 0;
+}
+
+/* writes all len bytes of buf to fd, returns 0 on success, -1 on failure */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+/* writes the output formatted so far to standard output, returns 0 on success, -1 on failure */
+static int flush_output(const char *name) {
+  int error = write_all(STDOUT_FILENO, output, output_len);
+  output_len = 0;
+  if (error)
+    perror(name);
+  return error;
+}
+
+/* echo [-n] [arg...], prints the arguments separated by spaces */
+int exec_echo(int argc, char **argv) {
+  int first = 1, newline = 1, i;
+  if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+    newline = 0;
+    first++;
+  }
+  output_len = 0;
+  for (i = first; i < argc; i++) {
+    if ((i > first && append(" ", 1)) || append(argv[i], strlen(argv[i]))) {
+      write(STDERR_FILENO, "echo: Out of memory\n", 20);
+      return -1;
+    }
+  }
+  if (newline && append("\n", 1)) {
+    write(STDERR_FILENO, "echo: Out of memory\n", 20);
+    return -1;
+  }
+  return flush_output("echo");
+}
+
+/* appends the character of the escape sequence at *format, which follows a backslash, and
+ * moves format to its last character. returns 0 on success, -1 on failure */
+static int append_escape(const char **format) {
+  char c;
+  switch (**format) {
+  case 'n': c = '\n'; break;
+  case 't': c = '\t'; break;
+  case 'r': c = '\r'; break;
+  case 'a': c = '\a'; break;
+  case 'b': c = '\b'; break;
+  case 'f': c = '\f'; break;
+  case 'v': c = '\v'; break;
+  case '\\': c = '\\'; break;
+  case '\0':
+    (*format)--; // a backslash at the end is printed as it is
+    return append("\\", 1);
+  default:
+    return append(*format - 1, 2);
+  }
+  return append(&c, 1);
+}
+
+/* appends arg as converted by the conversion specification spec, which is %, then flags, width
+ * and precision, and then one of the conversion characters of printf. returns 0 on success, -1 on
+ * failure */
+static int append_conversion(char *spec, size_t spec_len, const char *arg) {
+  char conversion = spec[spec_len - 1];
+  int len;
+  if (conversion == 's') {
+    len = snprintf(NULL, 0, spec, arg);
+    if (len < 0 || reserve((size_t) len))
+      return -1;
+    sprintf(output + output_len, spec, arg);
+  } else if (conversion == 'c') {
+    if (*arg == '\0')
+      return 0;
+    len = snprintf(NULL, 0, spec, *arg);
+    if (len < 0 || reserve((size_t) len))
+      return -1;
+    sprintf(output + output_len, spec, *arg);
+  } else {
+    // integers are converted as longs
+    spec[spec_len - 1] = 'l';
+    spec[spec_len] = conversion;
+    spec[spec_len + 1] = '\0';
+    char *end;
+    errno = 0;
+    if (conversion == 'd' || conversion == 'i') {
+      long value = strtol(arg, &end, 0);
+      len = snprintf(NULL, 0, spec, value);
+      if (len < 0 || reserve((size_t) len))
+	return -1;
+      sprintf(output + output_len, spec, value);
+    } else {
+      unsigned long value = strtoul(arg, &end, 0);
+      len = snprintf(NULL, 0, spec, value);
+      if (len < 0 || reserve((size_t) len))
+	return -1;
+      sprintf(output + output_len, spec, value);
+    }
+    if (*end != '\0' || errno) {
+      char err_msg[strlen(arg) + 40];
+      sprintf(err_msg, "printf: %s: invalid number\n", arg);
+      write(STDERR_FILENO, err_msg, strlen(err_msg));
+    }
+  }
+  output_len += (size_t) len;
+  return 0;
+}
+
+/* printf <format> [arg...], prints the arguments as described by format, which is reused
+ * for as long as arguments are left */
+int exec_printf(int argc, char **argv) {
+  if (argc < 2) {
+    write(STDERR_FILENO, "printf: Usage: printf <format> [arg...]\n", 40);
+    return -1;
+  }
+  int arg = 2, error = 0;
+  output_len = 0;
+  do {
+    int first_arg = arg;
+    const char *f;
+    for (f = argv[1]; *f && !error; f++) {
+      if (*f == '\\') {
+	f++;
+	error = append_escape(&f);
+      } else if (*f == '%' && f[1] == '%') {
+	f++;
+	error = append("%", 1);
+      } else if (*f == '%') {
+	// the specification is copied with room for the l of a long conversion
+	char spec[32];
+	size_t spec_len = strspn(f + 1, "-+ #0") + 1;
+	spec_len += strspn(f + spec_len, "0123456789");
+	if (f[spec_len] == '.') {
+	  spec_len++;
+	  spec_len += strspn(f + spec_len, "0123456789");
+	}
+	if (f[spec_len] == '\0' || strchr("sdiuoxXc", f[spec_len]) == NULL || spec_len + 3 > sizeof(spec)) {
+	  char err_msg[64];
+	  sprintf(err_msg, "printf: %.*s: invalid conversion\n", (int) (spec_len < 16 ? spec_len + 1 : 16), f);
+	  write(STDERR_FILENO, err_msg, strlen(err_msg));
+	  output_len = 0;
+	  return -1;
+	}
+	spec_len++;
+	memcpy(spec, f, spec_len);
+	spec[spec_len] = '\0';
+	error = append_conversion(spec, spec_len, arg < argc ? argv[arg++] : strchr("sc", spec[spec_len - 1]) ? "" : "0");
+	f += spec_len - 1;
+      } else {
+	error = append(f, 1);
+      }
+    }
+    if (arg == first_arg)
+      break;
+  } while (arg < argc && !error);
+  if (error) {
+    write(STDERR_FILENO, "printf: Out of memory\n", 22);
+    output_len = 0;
+    return -1;
+  }
+  return flush_output("printf");
+}
+
+/* copies from in to out with read() and write() until the end of the input. a terminal is polled
+ * first, since poll() is not restarted after a signal and SIGINT can stop the copy, together with
+ * the timerfd of every and at, so that their commands start while cat waits for a line.
+ * returns 0 on success, -1 on failure with errno set, or if interrupted
+ */
+static int copy_rw(int in, int out) {
+  static char buf[COPY_CHUNK];
+  int tty = isatty(in);
+  for (;;) {
+    if (interrupted)
+      return -1;
+    if (tty) {
+      struct pollfd pfd[2] = {{in, POLLIN, 0}, {timers_fd(), POLLIN, 0}};
+      if (poll(pfd, 2, -1) < 0) {
+	if (errno == EINTR)
+	  continue;
+	return -1;
+      }
+      if (pfd[1].revents & POLLIN)
+	run_timers();
+      if (pfd[0].revents == 0)
+	continue;
+    }
+    ssize_t n = read(in, buf, sizeof(buf));
+    if (n == 0)
+      return 0;
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    if (write_all(out, buf, (size_t) n))
+      return -1;
+  }
+}
+
+/* copies from in to out until the end of the input without bringing the data into the shell:
+ * with splice() if either is a pipe, or else with sendfile() from a file, falling back to read()
+ * and write() when the kernel supports neither for these descriptors.
+ * returns 0 on success, -1 on failure with errno set
+ */
+static int copy_fd(int in, int out) {
+  if (isatty(in))
+    return copy_rw(in, out);
+  ssize_t n;
+  while (!interrupted && ((n = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE)) > 0 || (n < 0 && errno == EINTR)))
+    ;
+  if (interrupted)
+    return -1;
+  if (n == 0)
+    return 0;
+  if (errno != EINVAL && errno != ENOSYS)
+    return -1;
+  while (!interrupted && ((n = sendfile(out, in, NULL, COPY_CHUNK)) > 0 || (n < 0 && errno == EINTR)))
+    ;
+  if (interrupted)
+    return -1;
+  if (n == 0)
+    return 0;
+  if (errno != EINVAL && errno != ENOSYS)
+    return -1;
+  return copy_rw(in, out);
+}
+
+/* cat [file...], copies the files (or standard input for - or no file) to standard output */
+int exec_cat(int argc, char **argv) {
+  if (argc == 1) {
+    if (copy_fd(STDIN_FILENO, STDOUT_FILENO) == 0 || interrupted)
+      return interrupted ? -1 : 0;
+    perror("cat");
+    return -1;
+  }
+
+  int error = 0, i;
+  for (i = 1; i < argc && !interrupted; i++) {
+    int fd = STDIN_FILENO;
+    if (strcmp(argv[i], "-") != 0 && (fd = open(argv[i], O_RDONLY | O_CLOEXEC)) < 0) {
+      char err_msg[strlen(argv[i]) + 6];
+      sprintf(err_msg, "cat: %s", argv[i]);
+      perror(err_msg);
+      error = -1;
+      continue;
+    }
+    if (copy_fd(fd, STDOUT_FILENO) && !interrupted) {
+      char err_msg[strlen(argv[i]) + 6];
+      sprintf(err_msg, "cat: %s", argv[i]);
+      perror(err_msg);
+      error = -1;
+    }
+    if (fd != STDIN_FILENO)
+      close(fd);
+  }
+  return interrupted ? -1 : error;
+}
+
+/* converts str to an integer for test, returns 0 on success, -1 if it is not one */
+static int test_integer(const char *str, long *value) {
+  char *end;
+  errno = 0;
+  *value = strtol(str, &end, 10);
+  if (*str == '\0' || *end != '\0' || errno) {
+    char err_msg[strlen(str) + 40];
+    sprintf(err_msg, "test: %s: integer expression expected\n", str);
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return -1;
+  }
+  return 0;
+}
+
+/* evaluates a test expression of the words argv, returns 1 if it is true, 0 if it is false,
+ * -1 if it is not valid */
+static int test_expression(int argc, char **argv) {
+  if (argc == 0)
+    return 0;
+  if (strcmp(argv[0], "!") == 0 && argc > 1) {
+    int result = test_expression(argc - 1, argv + 1);
+    return result < 0 ? -1 : !result;
+  }
+  if (argc == 1)
+    return argv[0][0] != '\0';
+
+  if (argc == 2) {
+    const char *op = argv[0], *arg = argv[1];
+    struct stat st;
+    if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') {
+      char err_msg[strlen(op) + 40];
+      sprintf(err_msg, "test: %s: unary operator expected\n", op);
+      write(STDERR_FILENO, err_msg, strlen(err_msg));
+      return -1;
+    }
+    switch (op[1]) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 'e': return stat(arg, &st) == 0;
+    case 'f': return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+    case 'd': return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+    case 's': return stat(arg, &st) == 0 && st.st_size > 0;
+    case 'L':
+    case 'h': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    }
+    char err_msg[strlen(op) + 40];
+    sprintf(err_msg, "test: %s: unary operator expected\n", op);
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return -1;
+  }
+
+  if (argc == 3) {
+    const char *op = argv[1];
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+      return strcmp(argv[0], argv[2]) == 0;
+    if (strcmp(op, "!=") == 0)
+      return strcmp(argv[0], argv[2]) != 0;
+    static const char *int_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL};
+    int i;
+    for (i = 0; int_ops[i] != NULL && strcmp(op, int_ops[i]) != 0; i++)
+      ;
+    if (int_ops[i] != NULL) {
+      long a, b;
+      if (test_integer(argv[0], &a) || test_integer(argv[2], &b))
+	return -1;
+      switch (i) {
+      case 0: return a == b;
+      case 1: return a != b;
+      case 2: return a < b;
+      case 3: return a <= b;
+      case 4: return a > b;
+      default: return a >= b;
+      }
+    }
+    char err_msg[strlen(op) + 40];
+    sprintf(err_msg, "test: %s: binary operator expected\n", op);
+    write(STDERR_FILENO, err_msg, strlen(err_msg));
+    return -1;
+  }
+
+  write(STDERR_FILENO, "test: too many arguments\n", 25);
+  return -1;
+}
+
+/* test <expression> or [ <expression> ], evaluates a file, string or integer comparison */
+int exec_test(int argc, char **argv) {
+  if (strcmp(argv[0], "[") == 0) {
+    if (strcmp(argv[argc - 1], "]") != 0) {
+      write(STDERR_FILENO, "[: missing ]\n", 13);
+      return -1;
+    }
+    argc--;
+  }
+  return test_expression(argc - 1, argv + 1) == 1 ? 0 : -1;
+}
+
+/* creates the directory dir, and its parents if they do not exist when parents is set,
+ * returns 0 on success, -1 on failure */
+static int make_dir(char *dir, int parents) {
+  struct stat st;
+  if (parents && *dir) {
+    char *slash;
+    for (slash = strchr(dir + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+      *slash = '\0';
+      int error = mkdir(dir, 0777) < 0 && (errno != EEXIST || stat(dir, &st) < 0 || !S_ISDIR(st.st_mode));
+      *slash = '/';
+      if (error)
+	return -1;
+    }
+  }
+  if (mkdir(dir, 0777) < 0) {
+    if (parents && errno == EEXIST && stat(dir, &st) == 0 && S_ISDIR(st.st_mode))
+      return 0;
+    return -1;
+  }
+  return 0;
+}
+
+/* mkdir [-p] <dir>..., creates the directories, and with -p their parents as needed */
+int exec_mkdir(int argc, char **argv) {
+  int parents = argc > 1 && strcmp(argv[1], "-p") == 0;
+  if (argc < 2 + parents) {
+    write(STDERR_FILENO, "mkdir: Usage: mkdir [-p] <dir>...\n", 34);
+    return -1;
+  }
+  int error = 0, i;
+  for (i = 1 + parents; i < argc; i++) {
+    if (make_dir(argv[i], parents)) {
+      char err_msg[strlen(argv[i]) + 8];
+      sprintf(err_msg, "mkdir: %s", argv[i]);
+      perror(err_msg);
+      error = -1;
+    }
+  }
+  return error;
+}
+
+/* sleep <seconds>, waits for a possibly fractional number of seconds */
+int exec_sleep(int argc, char **argv) {
+  char *end;
+  double seconds = argc == 2 ? strtod(argv[1], &end) : -1;
+  if (argc != 2 || *end != '\0' || seconds < 0) {
+    write(STDERR_FILENO, "sleep: Usage: sleep <seconds>\n", 30);
+    return -1;
+  }
+  struct timespec deadline, now;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += (time_t) seconds;
+  deadline.tv_nsec += (long) ((seconds - (double) (time_t) seconds) * 1e9);
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  // ppoll() is never restarted after a signal, so SIGINT ends the sleep. it also wakes up for the
+  // commands of every and at, and goes back to sleep until the deadline once they are started
+  for (;;) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct timespec left = {deadline.tv_sec - now.tv_sec, deadline.tv_nsec - now.tv_nsec};
+    if (left.tv_nsec < 0) {
+      left.tv_sec--;
+      left.tv_nsec += 1000000000;
+    }
+    if (left.tv_sec < 0)
+      return 0;
+    struct pollfd fd = {timers_fd(), POLLIN, 0};
+    int n = ppoll(&fd, 1, &left, NULL);
+    if (n < 0 && (errno != EINTR || interrupted))
+      return -1;
+    if (n > 0)
+      run_timers();
+  }
+}
+
+/* true, does nothing successfully */
+int exec_true(int argc, char **argv) {
+  (void) argc;
+  (void) argv;
+  return 0;
+}
+
+/* false, does nothing unsuccessfully */
+int exec_false(int argc, char **argv) {
+  (void) argc;
+  (void) argv;
+  return -1;
+}
@@ -0,0 +1,39 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <signal.h>
+
+/*
+ * common utilities run by the shell itself instead of a child process
+ * each takes the words of the command, the name of the utility first, and returns 0 on
+ * success, or -1 on failure (or, for test, if the expression is false)
+ */
+
+/* set by the shell when SIGINT is received, which stops cat and sleep */
+extern volatile sig_atomic_t interrupted;
+
+/* provided by the shell: timers_fd() returns the timerfd of every and at while commands are
+ * scheduled, or -1, and run_timers() starts those that are due. sleep, and cat reading a terminal,
+ * wait on the timerfd too, so that the commands keep starting while they block */
+int timers_fd(void);
+void run_timers(void);
+
+/* echo [-n] [arg...], prints the arguments separated by spaces */
+int exec_echo(int argc, char **argv);
+/* printf <format> [arg...], prints the arguments as described by format, which is reused
+ * for as long as arguments are left */
+int exec_printf(int argc, char **argv);
+/* cat [file...], copies the files (or standard input for - or no file) to standard output */
+int exec_cat(int argc, char **argv);
+/* test <expression> or [ <expression> ], evaluates a file, string or integer comparison */
+int exec_test(int argc, char **argv);
+/* mkdir [-p] <dir>..., creates the directories, and with -p their parents as needed */
+int exec_mkdir(int argc, char **argv);
+/* sleep <seconds>, waits for a possibly fractional number of seconds */
+int exec_sleep(int argc, char **argv);
+/* true, does nothing successfully */
+int exec_true(int argc, char **argv);
+/* false, does nothing unsuccessfully */
+int exec_false(int argc, char **argv);
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vars.h"
+
+// number of buckets in the hash table when the store is created
+#define INITIAL_BUCKETS 64
+
+/* a variable, kept as the name=value string that is passed in the environment, so that the
+ * environment can point to it without making a copy */
+struct var {
+  char *pair;
+  size_t name_len;
+  int has_value;       // whether pair holds =value after the name
+  int exported;
+  struct var *next;
+};
+
+// envp is the environment built from the exported variables, which is stale when dirty is set
+struct var_store {
+  struct var **buckets;
+  size_t num_buckets;
+  size_t count;
+  char **envp;
+  size_t envp_cap;
+  int dirty;
+};
+
+/* FNV-1a hash of a variable name of len bytes */
+static size_t hash_name(const char *name, size_t len, size_t num_buckets) {
+  unsigned long hash = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+  return (size_t) hash & (num_buckets - 1);
+}
+
+static struct var *lookup(var_store_t *store, const char *name, size_t len) {
+  struct var *var = store->buckets[hash_name(name, len, store->num_buckets)];
+  while (var != NULL && (var->name_len != len || memcmp(var->pair, name, len) != 0))
+    var = var->next;
+  return var;
+}
+
+/* doubles the number of buckets and rehashes every variable, returns 0 on success, -1 on failure */
+static int grow_buckets(var_store_t *store) {
+  size_t num_buckets = store->num_buckets * 2, i;
+  struct var **buckets = (struct var **) calloc(num_buckets, sizeof(struct var *));
+  if (buckets == NULL)
+    return -1;
+  for (i = 0; i < store->num_buckets; i++) {
+    struct var *var = store->buckets[i];
+    while (var != NULL) {
+      struct var *next = var->next;
+      size_t b = hash_name(var->pair, var->name_len, num_buckets);
+      var->next = buckets[b];
+      buckets[b] = var;
+      var = next;
+    }
+  }
+  free(store->buckets);
+  store->buckets = buckets;
+  store->num_buckets = num_buckets;
+  return 0;
+}
+
+/* finds the variable name, adding it without a value if it does not exist, returns NULL on failure */
+static struct var *find_or_add(var_store_t *store, const char *name) {
+  size_t len = strlen(name);
+  struct var *var = lookup(store, name, len);
+  if (var != NULL)
+    return var;
+  if (store->count >= store->num_buckets && grow_buckets(store) < 0)
+    return NULL;
+  var = (struct var *) malloc(sizeof(struct var));
+  if (var == NULL || (var->pair = strdup(name)) == NULL) {
+    free(var);
+    return NULL;
+  }
+  var->name_len = len;
+  var->has_value = 0;
+  var->exported = 0;
+  size_t b = hash_name(name, len, store->num_buckets);
+  var->next = store->buckets[b];
+  store->buckets[b] = var;
+  store->count++;
+  return var;
+}
+
+/* initializes a variable store with every variable of env (a NULL-terminated array of
+ * name=value strings, such as environ) exported, returns pointer */
+var_store_t *init_vars(char **env) {
+  var_store_t *store = (var_store_t *) calloc(1, sizeof(var_store_t));
+  if (store == NULL)
+    return NULL;
+  store->num_buckets = INITIAL_BUCKETS;
+  store->buckets = (struct var **) calloc(INITIAL_BUCKETS, sizeof(struct var *));
+  if (store->buckets == NULL) {
+    free(store);
+    return NULL;
+  }
+  store->dirty = 1;
+
+  for (; env != NULL && *env != NULL; env++) {
+    const char *equals = strchr(*env, '=');
+    if (equals == NULL || !valid_var_name(*env, (size_t) (equals - *env)))
+      continue;
+    char name[equals - *env + 1];
+    memcpy(name, *env, (size_t) (equals - *env));
+    name[equals - *env] = '\0';
+    set_var(store, name, equals + 1, 1);
+  }
+  return store;
+}
+
+/*
+ * cleans up the store
+ * Note: this function will free the var_store pointer
+ */
+void cleanup_vars(var_store_t *store) {
+  if (store == NULL)
+    return;
+  size_t i;
+  for (i = 0; i < store->num_buckets; i++) {
+    struct var *var = store->buckets[i];
+    while (var != NULL) {
+      struct var *next = var->next;
+      free(var->pair);
+      free(var);
+      var = next;
+    }
+  }
+  free(store->buckets);
+  free(store->envp);
+  free(store);
+}
+
+/* whether the len bytes at name are a valid variable name: a letter or underscore followed by
+ * letters, digits and underscores */
+int valid_var_name(const char *name, size_t len) {
+  size_t i;
+  if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+    return 0;
+  for (i = 0; i < len; i++) {
+    char c = name[i];
+    if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+      return 0;
+  }
+  return 1;
+}
+
+/* gets the value of the variable whose name is the len bytes at name, returns NULL if it is not
+ * set. the value stays valid until the variable is changed */
+const char *get_var(var_store_t *store, const char *name, size_t len) {
+  struct var *var = lookup(store, name, len);
+  return var != NULL && var->has_value ? var->pair + len + 1 : NULL;
+}
+
+/* sets the variable name to value, exporting it to the environment of commands if export is set
+ * (a variable that is already exported stays exported), returns 0 on success, -1 on failure */
+int set_var(var_store_t *store, const char *name, const char *value, int export) {
+  struct var *var = find_or_add(store, name);
+  if (var == NULL)
+    return -1;
+  size_t value_len = strlen(value);
+  if (!var->has_value || strcmp(var->pair + var->name_len + 1, value) != 0) {
+    char *pair = (char *) malloc(var->name_len + value_len + 2);
+    if (pair == NULL)
+      return -1;
+    memcpy(pair, var->pair, var->name_len);
+    pair[var->name_len] = '=';
+    memcpy(pair + var->name_len + 1, value, value_len + 1);
+    free(var->pair);
+    var->pair = pair;
+    var->has_value = 1;
+    store->dirty |= var->exported;
+  }
+  if (export && !var->exported) {
+    var->exported = 1;
+    store->dirty = 1;
+  }
+  return 0;
+}
+
+/* exports the variable name, which is only passed to commands once it has a value, returns 0 on
+ * success, -1 on failure */
+int export_var(var_store_t *store, const char *name) {
+  struct var *var = find_or_add(store, name);
+  if (var == NULL)
+    return -1;
+  if (!var->exported) {
+    var->exported = 1;
+    store->dirty |= var->has_value;
+  }
+  return 0;
+}
+
+/* removes the variable name, returns 0 on success, -1 if it was not set */
+int unset_var(var_store_t *store, const char *name) {
+  size_t len = strlen(name);
+  struct var **link = &store->buckets[hash_name(name, len, store->num_buckets)];
+  while (*link != NULL && ((*link)->name_len != len || memcmp((*link)->pair, name, len) != 0))
+    link = &(*link)->next;
+  if (*link == NULL)
+    return -1;
+  struct var *var = *link;
+  *link = var->next;
+  store->dirty |= var->exported && var->has_value;
+  store->count--;
+  free(var->pair);
+  free(var);
+  return 0;
+}
+
+/*
+ * gets the environment of commands: a NULL-terminated array of name=value strings of the exported
+ * variables, which is only rebuilt when an exported variable has changed since the last call
+ * the array belongs to the store and stays valid until the next change
+ */
+char **get_envp(var_store_t *store) {
+  if (!store->dirty)
+    return store->envp;
+  if (store->envp_cap < store->count + 1) {
+    size_t cap = store->count + 1 > store->envp_cap * 2 ? store->count + 1 : store->envp_cap * 2;
+    char **envp = (char **) realloc(store->envp, cap * sizeof(char *));
+    if (envp == NULL)
+      return store->envp; // the last environment that could be built
+    store->envp = envp;
+    store->envp_cap = cap;
+  }
+  size_t i, n = 0;
+  struct var *var;
+  for (i = 0; i < store->num_buckets; i++) {
+    for (var = store->buckets[i]; var != NULL; var = var->next) {
+      if (var->exported && var->has_value)
+	store->envp[n++] = var->pair;
+    }
+  }
+  store->envp[n] = NULL;
+  store->dirty = 0;
+  return store->envp;
+}
+
+/* export command, prints out the exported variables with a single write */
+void print_exports(var_store_t *store) {
+  char **envp = get_envp(store), **pair;
+  size_t len = 0;
+  for (pair = envp; pair != NULL && *pair != NULL; pair++)
+    len += strlen(*pair) + 8;
+  char *output = (char *) malloc(len + 1);
+  if (output == NULL)
+    return;
+  len = 0;
+  for (pair = envp; pair != NULL && *pair != NULL; pair++)
+    len += (size_t) sprintf(output + len, "export %s\n", *pair);
+  write(STDOUT_FILENO, output, len);
+  free(output);
+}
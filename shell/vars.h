@@ -0,0 +1,44 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+
+typedef struct var_store var_store_t;
+
+/* initializes a variable store with every variable of env (a NULL-terminated array of
+ * name=value strings, such as environ) exported, returns pointer */
+var_store_t *init_vars(char **env);
+/*
+ * cleans up the store
+ * Note: this function will free the var_store pointer
+ */
+void cleanup_vars(var_store_t *store);
+
+/* whether the len bytes at name are a valid variable name: a letter or underscore followed by
+ * letters, digits and underscores */
+int valid_var_name(const char *name, size_t len);
+
+/* gets the value of the variable whose name is the len bytes at name, returns NULL if it is not
+ * set. the value stays valid until the variable is changed */
+const char *get_var(var_store_t *store, const char *name, size_t len);
+
+/* sets the variable name to value, exporting it to the environment of commands if export is set
+ * (a variable that is already exported stays exported), returns 0 on success, -1 on failure */
+int set_var(var_store_t *store, const char *name, const char *value, int export);
+/* exports the variable name, which is only passed to commands once it has a value, returns 0 on
+ * success, -1 on failure */
+int export_var(var_store_t *store, const char *name);
+/* removes the variable name, returns 0 on success, -1 if it was not set */
+int unset_var(var_store_t *store, const char *name);
+
+/*
+ * gets the environment of commands: a NULL-terminated array of name=value strings of the exported
+ * variables, which is only rebuilt when an exported variable has changed since the last call
+ * the array belongs to the store and stays valid until the next change
+ */
+char **get_envp(var_store_t *store);
+
+/* export command, prints out the exported variables with a single write */
+void print_exports(var_store_t *store);
+
+#endif
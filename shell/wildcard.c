@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "wildcard.h"
+
+// bytes of directory entries asked for by each getdents64()
+#define DENTS_SIZE (1 << 20)
+// number of buckets of the cache of directory listings, must be a power of two
+#define CACHE_BUCKETS 64
+// seconds a directory must have gone unmodified before its listing is cached, since a change
+// within the same tick of its timestamp would go unnoticed
+#define CACHE_SETTLE 1
+
+/* a directory entry as returned by getdents64() */
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+enum { OP_CHAR, OP_ANY, OP_STAR, OP_CLASS };
+
+/* an instruction of a compiled pattern: a character, any character, any run of characters, or a
+ * character of the set of a class */
+typedef struct {
+  unsigned char type;
+  unsigned char c;
+  unsigned char set[32];
+} op_t;
+
+/* a pattern for one name, compiled. min_len is the number of characters any match has, and
+ * suffix the literal characters after its last *, which are compared first */
+typedef struct {
+  op_t *ops;
+  size_t num_ops;
+  size_t min_len;
+  char suffix[64];
+  size_t suffix_len;
+  int dot;           // whether the pattern starts with a . and may match a hidden name
+} matcher_t;
+
+/* the cached listing of the directory with the device and inode dev and ino as it was at its
+ * modification time mtime. names holds each name preceded by its type and followed by a null
+ * character */
+typedef struct listing {
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  char *names;
+  size_t len;
+  size_t cap;
+  struct listing *next;
+} listing_t;
+
+/* an expansion in progress. path holds the directory being looked at and results the matched
+ * paths, each followed by a null character */
+typedef struct {
+  char path[PATH_MAX];
+  char *results;
+  size_t len;
+  size_t cap;
+  size_t count;
+  int use_cache;
+  int error;
+} expansion_t;
+
+/* what is wanted from the entries of one directory: the names that match, which are results if
+ * the pattern ends here and are otherwise kept in dirs to be descended into */
+typedef struct {
+  expansion_t *expansion;
+  const matcher_t *matcher;
+  size_t path_len;
+  int last;
+  char *dirs;
+  size_t dirs_len;
+  size_t dirs_cap;
+} visit_t;
+
+static listing_t *cache[CACHE_BUCKETS];
+static char *dents; // the getdents64() buffer, kept from one expansion to the next
+
+/* returns the length of the class that starts at the [ at pattern[i], up to and including its ],
+ * or 0 if it is not closed before len */
+static size_t class_length(const char *pattern, size_t i, size_t len) {
+  size_t j = i + 1;
+  if (j < len && (pattern[j] == '!' || pattern[j] == '^'))
+    j++;
+  if (j < len && pattern[j] == ']') // a ] straight after the [ is part of the set
+    j++;
+  while (j < len && pattern[j] != ']')
+    j++;
+  return j < len ? j - i + 1 : 0;
+}
+
+/* whether the len bytes at pattern hold a wildcard */
+static int has_wildcard_n(const char *pattern, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    if (pattern[i] == '*' || pattern[i] == '?' || (pattern[i] == '[' && class_length(pattern, i, len) > 0))
+      return 1;
+  }
+  return 0;
+}
+
+/* whether word holds a wildcard: *, ? or [ */
+int has_wildcard(const char *word) {
+  return strpbrk(word, "*?[") != NULL && has_wildcard_n(word, strlen(word));
+}
+
+/* compiles the pattern of len bytes into matcher, returns 0 on success, -1 on failure */
+static int compile_pattern(const char *pattern, size_t len, matcher_t *matcher) {
+  matcher->ops = (op_t *) malloc((len + 1) * sizeof(op_t));
+  if (matcher->ops == NULL)
+    return -1;
+  matcher->num_ops = 0;
+  matcher->min_len = 0;
+  matcher->dot = len > 0 && pattern[0] == '.';
+  size_t i = 0, j;
+  while (i < len) {
+    op_t *op = &matcher->ops[matcher->num_ops];
+    size_t class_len = pattern[i] == '[' ? class_length(pattern, i, len) : 0;
+    if (pattern[i] == '*') {
+      i++;
+      if (matcher->num_ops > 0 && op[-1].type == OP_STAR)
+	continue; // ** is the same as *
+      op->type = OP_STAR;
+      matcher->num_ops++;
+      continue;
+    }
+    matcher->min_len++;
+    matcher->num_ops++;
+    if (pattern[i] == '?') {
+      op->type = OP_ANY;
+      i++;
+    } else if (class_len > 0) {
+      size_t end = i + class_len - 1;
+      int negate = pattern[i + 1] == '!' || pattern[i + 1] == '^';
+      op->type = OP_CLASS;
+      memset(op->set, 0, sizeof(op->set));
+      for (j = i + 1 + (size_t) negate; j < end; j++) {
+	unsigned char from = (unsigned char) pattern[j], to = from;
+	if (j + 2 < end && pattern[j + 1] == '-') {
+	  to = (unsigned char) pattern[j + 2];
+	  j += 2;
+	}
+	unsigned int c;
+	for (c = from; c <= to; c++)
+	  op->set[c >> 3] = (unsigned char) (op->set[c >> 3] | (1u << (c & 7)));
+      }
+      if (negate) {
+	for (j = 0; j < sizeof(op->set); j++)
+	  op->set[j] = (unsigned char) ~op->set[j];
+      }
+      i += class_len;
+    } else {
+      op->type = OP_CHAR;
+      op->c = (unsigned char) pattern[i++];
+    }
+  }
+
+  // the literal characters after the last * must end every match
+  matcher->suffix_len = 0;
+  for (j = matcher->num_ops; j > 0 && matcher->ops[j - 1].type == OP_CHAR; j--)
+    ;
+  if (j > 0 && matcher->num_ops - j <= sizeof(matcher->suffix)) {
+    for (; j < matcher->num_ops; j++)
+      matcher->suffix[matcher->suffix_len++] = (char) matcher->ops[j].c;
+  }
+  return 0;
+}
+
+static int op_matches(const op_t *op, unsigned char c) {
+  switch (op->type) {
+  case OP_CHAR:
+    return op->c == c;
+  case OP_ANY:
+    return 1;
+  default:
+    return (op->set[c >> 3] >> (c & 7)) & 1;
+  }
+}
+
+/* whether the name of len bytes matches the compiled pattern. a * that fails to match the rest
+ * of the name only backtracks to the last * seen, so matching takes linear time in practice */
+static int name_matches(const matcher_t *matcher, const char *name, size_t len) {
+  if (len < matcher->min_len || (name[0] == '.' && !matcher->dot))
+    return 0;
+  if (matcher->suffix_len > 0 && memcmp(name + len - matcher->suffix_len, matcher->suffix, matcher->suffix_len) != 0)
+    return 0;
+  const op_t *ops = matcher->ops;
+  size_t p = 0, i = 0, star_p = 0, star_i = 0, n = matcher->num_ops;
+  int starred = 0;
+  while (i < len) {
+    if (p < n && ops[p].type == OP_STAR) {
+      starred = 1;
+      star_p = ++p;
+      star_i = i;
+    } else if (p < n && op_matches(&ops[p], (unsigned char) name[i])) {
+      p++;
+      i++;
+    } else if (starred) {
+      p = star_p;
+      i = ++star_i;
+    } else {
+      return 0;
+    }
+  }
+  while (p < n && ops[p].type == OP_STAR)
+    p++;
+  return p == n;
+}
+
+/* appends size bytes of data to the buffer buf of len bytes and capacity cap, returns 0 on
+ * success, -1 on failure */
+static int append(char **buf, size_t *len, size_t *cap, const char *data, size_t size) {
+  if (*cap - *len < size) {
+    size_t new_cap = *cap ? *cap * 2 : 65536;
+    while (new_cap - *len < size)
+      new_cap *= 2;
+    char *new_buf = (char *) realloc(*buf, new_cap);
+    if (new_buf == NULL)
+      return -1;
+    *buf = new_buf;
+    *cap = new_cap;
+  }
+  memcpy(*buf + *len, data, size);
+  *len += size;
+  return 0;
+}
+
+/* adds the path held in the first path_len bytes of expansion->path followed by name of len bytes
+ * to the results */
+static void add_result(expansion_t *expansion, size_t path_len, const char *name, size_t len) {
+  if (append(&expansion->results, &expansion->len, &expansion->cap, expansion->path, path_len)
+      || append(&expansion->results, &expansion->len, &expansion->cap, name, len + 1)) {
+    expansion->error = 1;
+    return;
+  }
+  expansion->count++;
+}
+
+/* looks at an entry of the directory being expanded */
+static void visit_entry(visit_t *visit, const char *name, size_t len, unsigned char type) {
+  if (!name_matches(visit->matcher, name, len))
+    return;
+  expansion_t *expansion = visit->expansion;
+  if (visit->last) {
+    add_result(expansion, visit->path_len, name, len);
+    return;
+  }
+  // only directories can be descended into, and a symbolic link may point to one
+  if (type != DT_DIR) {
+    struct stat st;
+    if ((type != DT_UNKNOWN && type != DT_LNK) || visit->path_len + len >= PATH_MAX)
+      return;
+    memcpy(expansion->path + visit->path_len, name, len + 1);
+    if (stat(expansion->path, &st) < 0 || !S_ISDIR(st.st_mode))
+      return;
+  }
+  if (append(&visit->dirs, &visit->dirs_len, &visit->dirs_cap, name, len + 1))
+    expansion->error = 1;
+}
+
+/* calls visit_entry() for each entry of the open directory fd but . and .., reading them with
+ * getdents64() a megabyte at a time, or adds them to listing instead if it is not NULL
+ * returns 0 on success, -1 on failure */
+static int read_dir(int fd, visit_t *visit, listing_t *listing) {
+  if (dents == NULL && (dents = (char *) malloc(DENTS_SIZE)) == NULL)
+    return -1;
+  for (;;) {
+    long n = syscall(SYS_getdents64, fd, dents, DENTS_SIZE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return (int) n;
+    long offset = 0;
+    while (offset < n) {
+      struct linux_dirent64 *entry = (struct linux_dirent64 *) (void *) (dents + offset);
+      const char *name = entry->d_name;
+      offset += entry->d_reclen;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+	continue;
+      size_t len = strlen(name);
+      if (listing == NULL) {
+	visit_entry(visit, name, len, entry->d_type);
+      } else {
+	char type = (char) entry->d_type;
+	if (append(&listing->names, &listing->len, &listing->cap, &type, 1)
+	    || append(&listing->names, &listing->len, &listing->cap, name, len + 1))
+	  return -1;
+      }
+    }
+  }
+}
+
+/* reads the entries of the directory dir for visit, from the cache if the listing there is as
+ * new as the directory. otherwise the directory is read and, once it has stayed unmodified for
+ * CACHE_SETTLE seconds, its listing replaces the one in the cache */
+static void list_dir(expansion_t *expansion, const char *dir, visit_t *visit) {
+  struct stat st;
+  if (!expansion->use_cache) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+      if (read_dir(fd, visit, NULL) < 0)
+	expansion->error = 1;
+      close(fd);
+    }
+    return;
+  }
+
+  if (stat(dir, &st) < 0)
+    return;
+  size_t bucket = (size_t) (st.st_ino ^ st.st_dev) & (CACHE_BUCKETS - 1);
+  listing_t **link = &cache[bucket], *listing;
+  while (*link != NULL && ((*link)->ino != st.st_ino || (*link)->dev != st.st_dev))
+    link = &(*link)->next;
+  listing = *link;
+  if (listing == NULL || listing->mtime.tv_sec != st.st_mtim.tv_sec || listing->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+    // the listing is read again, with the modification time it had before it was read
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      if (fd >= 0)
+	close(fd);
+      return;
+    }
+    if (listing == NULL) {
+      if ((listing = (listing_t *) calloc(1, sizeof(listing_t))) == NULL) {
+	close(fd);
+	expansion->error = 1;
+	return;
+      }
+      listing->dev = st.st_dev;
+      listing->ino = st.st_ino;
+      listing->next = *link;
+      *link = listing;
+    }
+    listing->len = 0;
+    int error = read_dir(fd, visit, listing);
+    close(fd);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    listing->mtime = st.st_mtim;
+    if (error || now.tv_sec - st.st_mtim.tv_sec < CACHE_SETTLE)
+      listing->mtime.tv_nsec = -1; // never matches, so the directory is read again next time
+    if (error) {
+      expansion->error = 1;
+      return;
+    }
+  }
+
+  size_t offset = 0;
+  while (offset < listing->len) {
+    unsigned char type = (unsigned char) listing->names[offset];
+    const char *name = listing->names + offset + 1;
+    size_t len = strlen(name);
+    visit_entry(visit, name, len, type);
+    offset += len + 2;
+  }
+}
+
+/* expands the rest of the pattern, rest, in the directory held in the first path_len bytes of
+ * expansion->path, which end with a slash unless path_len is 0 */
+static void expand(expansion_t *expansion, size_t path_len, const char *rest) {
+  char *path = expansion->path;
+  if (expansion->error)
+    return;
+  if (*rest == '\0') { // the pattern ended with a slash, so only directories match
+    add_result(expansion, path_len, "", 0);
+    return;
+  }
+  const char *slash = strchr(rest, '/'), *next = NULL;
+  size_t len = slash != NULL ? (size_t) (slash - rest) : strlen(rest);
+  if (slash != NULL)
+    for (next = slash; *next == '/'; next++)
+      ;
+  if (path_len + len + 2 > PATH_MAX)
+    return;
+
+  // a part without a wildcard is taken as it is, and only checked for at the end
+  if (!has_wildcard_n(rest, len)) {
+    memcpy(path + path_len, rest, len);
+    path_len += len;
+    if (next != NULL) {
+      path[path_len++] = '/';
+      expand(expansion, path_len, next);
+      return;
+    }
+    struct stat st;
+    path[path_len] = '\0';
+    if (lstat(path, &st) == 0)
+      add_result(expansion, path_len, "", 0);
+    return;
+  }
+
+  matcher_t matcher;
+  if (compile_pattern(rest, len, &matcher) < 0) {
+    expansion->error = 1;
+    return;
+  }
+  visit_t visit;
+  memset(&visit, 0, sizeof(visit_t));
+  visit.expansion = expansion;
+  visit.matcher = &matcher;
+  visit.path_len = path_len;
+  visit.last = next == NULL;
+  path[path_len] = '\0';
+  list_dir(expansion, path_len > 0 ? path : ".", &visit);
+  free(matcher.ops);
+
+  size_t offset = 0;
+  while (offset < visit.dirs_len) {
+    const char *name = visit.dirs + offset;
+    size_t name_len = strlen(name);
+    offset += name_len + 1;
+    if (path_len + name_len + 2 > PATH_MAX)
+      continue;
+    memcpy(path + path_len, name, name_len);
+    path[path_len + name_len] = '/';
+    expand(expansion, path_len + name_len + 1, next);
+  }
+  free(visit.dirs);
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/*
+ * expands the pattern word into the paths of the files it matches, sorted, with the array and
+ * the paths allocated from arena in a single block. a name that starts with . is only matched
+ * by a pattern that starts with . too. if use_cache is set, the listings of the directories
+ * that are read are kept, and used again as long as the directory has not been modified
+ * returns the number of paths and sets paths to them, 0 if nothing matched, -1 on failure
+ */
+int expand_wildcard(arena_t *arena, const char *word, int use_cache, char ***paths) {
+  expansion_t *expansion = (expansion_t *) malloc(sizeof(expansion_t));
+  if (expansion == NULL)
+    return -1;
+  expansion->results = NULL;
+  expansion->len = expansion->cap = expansion->count = 0;
+  expansion->use_cache = use_cache;
+  expansion->error = 0;
+  size_t path_len = 0;
+  if (word[0] == '/') {
+    expansion->path[path_len++] = '/';
+    while (*word == '/')
+      word++;
+  }
+  expand(expansion, path_len, word);
+
+  int count = expansion->error || expansion->count > INT_MAX ? -1 : (int) expansion->count;
+  if (count > 0) {
+    char **array = (char **) arena_alloc(arena, (size_t) (count + 1) * sizeof(char *) + expansion->len);
+    if (array == NULL) {
+      count = -1;
+    } else {
+      char *str = (char *) (array + count + 1);
+      memcpy(str, expansion->results, expansion->len);
+      int i;
+      for (i = 0; i < count; i++) {
+	array[i] = str;
+	str += strlen(str) + 1;
+      }
+      qsort(array, (size_t) count, sizeof(char *), compare_paths);
+      array[count] = NULL;
+      *paths = array;
+    }
+  }
+  free(expansion->results);
+  free(expansion);
+  return count;
+}
+
+/* frees the cached directory listings */
+void cleanup_wildcard_cache() {
+  size_t i;
+  for (i = 0; i < CACHE_BUCKETS; i++) {
+    while (cache[i] != NULL) {
+      listing_t *next = cache[i]->next;
+      free(cache[i]->names);
+      free(cache[i]);
+      cache[i] = next;
+    }
+  }
+  free(dents);
+  dents = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include "arena.h"
+
+/* whether word holds a wildcard: *, ? or [ */
+int has_wildcard(const char *word);
+
+/*
+ * expands the pattern word into the paths of the files it matches, sorted, with the array and
+ * the paths allocated from arena in a single block. a name that starts with . is only matched
+ * by a pattern that starts with . too. if use_cache is set, the listings of the directories
+ * that are read are kept, and used again as long as the directory has not been modified
+ * returns the number of paths and sets paths to them, 0 if nothing matched, -1 on failure
+ */
+int expand_wildcard(arena_t *arena, const char *word, int use_cache, char ***paths);
+
+/* frees the cached directory listings */
+void cleanup_wildcard_cache();
+
+#endif